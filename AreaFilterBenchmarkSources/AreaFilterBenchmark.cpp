@@ -0,0 +1,195 @@
+// AreaFilterBenchmark.cpp : Compares the area filter of the hand detector with counting every window pixel by pixel.
+//
+// Usage: AreaFilterBenchmark [--masks DIR] [--repeats N] [--radius N] [--seed N]
+//
+// The masks are the ground truths of the skin colour trainer, 1.jpg, 2.jpg and so on, with a share of their pixels
+// flipped at random to stand in for the noise of the skin classification. For every noise level the benchmark reports
+// milliseconds per mask for both filters and checks that they give the same result, exiting with an error if not.
+
+#include "AreaFilter.h"
+#include "WorkStealingPool.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define DEFAULT_MASKS_FOLDER		"./SkinColorDetectionTrainerSources/ground_truths/"
+#define DEFAULT_REPEATS				5
+#define DEFAULT_NOISE_SEED			1
+// Shares of pixels flipped, from a clean mask to a very noisy one
+const double noise_levels[] = { 0.0, 0.01, 0.05, 0.15, 0.3 };
+
+/// The area filter as the hand detector had it, counting every pixel of a window
+void FilterByCounting(const Mat& initial_guess, Mat* filtered_image, int corner_offset, float area_threshold)
+{
+	int target_rows = initial_guess.rows;
+	int target_cols = initial_guess.cols;
+	filtered_image->create(initial_guess.size(), CV_8U);
+	WorkStealingPool::Shared().ParallelForTiles(target_rows, target_cols, [&](const ImageTile& tile)
+	{
+		for (int row = tile.row_begin; row < tile.row_end; ++row)
+		{
+			for (int col = tile.col_begin; col < tile.col_end; ++col)
+			{
+				int c1row = max(row - corner_offset, 0);
+				int c1col = max(col - corner_offset, 0);
+				int c2row = max(row - corner_offset, 0);
+				int c2col = min(col + corner_offset, target_cols - 1);
+				int c3row = min(row + corner_offset, target_rows - 1);
+				int c3col = min(col + corner_offset, target_cols - 1);
+				int c4row = min(row + corner_offset, target_rows - 1);
+				int c4col = max(col - corner_offset, 0);
+
+				uchar value = initial_guess.at<uchar>(row, col);
+				if (value != initial_guess.at<uchar>(c1row, c1col) || value != initial_guess.at<uchar>(c2row, c2col) ||
+					value != initial_guess.at<uchar>(c3row, c3col) || value != initial_guess.at<uchar>(c4row, c4col))
+				{
+					int total_area = (c3row - c1row + 1) * (c2col - c1col + 1);
+					int amount_under_threshold = 0;
+					for (int i = c1row; i <= c3row; ++i)
+					{
+						for (int j = c1col; j <= c2col; ++j)
+						{
+							if (initial_guess.at<uchar>(i, j))
+							{
+								++amount_under_threshold;
+							}
+						}
+					}
+					float ratio = (float)amount_under_threshold / (float)total_area;
+					filtered_image->at<uchar>(row, col) = ratio > area_threshold ? 255 : 0;
+				}
+				else
+				{
+					filtered_image->at<uchar>(row, col) = value;
+				}
+			}
+		}
+	});
+}
+
+vector<Mat> ReadMasks(const string& folder)
+{
+	vector<Mat> masks;
+	while (true)
+	{
+		Mat mask = imread(folder + to_string(masks.size() + 1) + ".jpg", IMREAD_GRAYSCALE);
+		if (mask.empty())
+		{
+			break;
+		}
+		// The same threshold as the trainer uses for its ground truths
+		threshold(mask, mask, 200, 255, THRESH_BINARY);
+		masks.push_back(mask);
+	}
+	return masks;
+}
+
+Mat AddNoise(const Mat& mask, double noise_level, mt19937* random)
+{
+	Mat noisy = mask.clone();
+	uniform_real_distribution<double> distribution(0.0, 1.0);
+	for (int row = 0; row < noisy.rows; ++row)
+	{
+		uchar* noisy_row = noisy.ptr<uchar>(row);
+		for (int col = 0; col < noisy.cols; ++col)
+		{
+			if (distribution(*random) < noise_level)
+			{
+				noisy_row[col] = noisy_row[col] ? 0 : 255;
+			}
+		}
+	}
+	return noisy;
+}
+
+double MillisecondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	string masks_folder = DEFAULT_MASKS_FOLDER;
+	int repeats = DEFAULT_REPEATS;
+	int radius = AREA_FILTER_DEFAULT_RADIUS;
+	unsigned int seed = DEFAULT_NOISE_SEED;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		string option = argv[i];
+		if (option == "--masks")
+		{
+			masks_folder = argv[i + 1];
+		}
+		else if (option == "--repeats")
+		{
+			repeats = max(1, atoi(argv[i + 1]));
+		}
+		else if (option == "--radius")
+		{
+			radius = max(0, atoi(argv[i + 1]));
+		}
+		else if (option == "--seed")
+		{
+			seed = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+
+	vector<Mat> masks = ReadMasks(masks_folder);
+	if (masks.empty())
+	{
+		cout << "Could not read the masks from " << masks_folder << endl;
+		return EXIT_FAILURE;
+	}
+	cout << masks.size() << " masks, " << 2 * radius + 1 << "x" << 2 * radius + 1 << " window, "
+		<< WorkStealingPool::Shared().WorkerCount() + 1 << " threads" << endl;
+
+	AreaFilter area_filter(radius);
+	Mat integral_image;
+	mt19937 random(seed);
+	bool has_mismatch = false;
+	cout << left << setw(10) << "noise" << setw(16) << "counting ms" << setw(16) << "integral ms" << setw(10)
+		<< "speedup" << "mismatches" << endl;
+	for (double noise_level : noise_levels)
+	{
+		double counting_ms = 0.0;
+		double integral_ms = 0.0;
+		int64_t mismatches = 0;
+		for (const Mat& mask : masks)
+		{
+			Mat noisy = AddNoise(mask, noise_level, &random);
+			Mat counted, integrated;
+			for (int r = 0; r < repeats; ++r)
+			{
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				FilterByCounting(noisy, &counted, radius, area_filter.AreaThreshold());
+				counting_ms += MillisecondsSince(start);
+
+				start = chrono::steady_clock::now();
+				area_filter.Apply(noisy, &integrated, &integral_image);
+				integral_ms += MillisecondsSince(start);
+			}
+			Mat difference;
+			compare(counted, integrated, difference, CMP_NE);
+			mismatches += countNonZero(difference);
+		}
+		double runs = (double)masks.size() * repeats;
+		cout << left << setw(10) << noise_level << fixed << setprecision(3) << setw(16) << counting_ms / runs
+			<< setw(16) << integral_ms / runs << setprecision(1) << setw(10) << counting_ms / integral_ms << mismatches
+			<< endl;
+		cout.unsetf(ios::fixed);
+		has_mismatch = has_mismatch || mismatches > 0;
+	}
+
+	return has_mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
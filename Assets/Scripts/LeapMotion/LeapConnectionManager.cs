@@ -16,6 +16,7 @@ using System.Text;
 #if !UNITY_EDITOR
 using System.IO;
 using System.Threading.Tasks;
+using Windows.Graphics.Imaging;
 using Windows.Networking;
 using Windows.Networking.Connectivity;
 using Windows.Networking.Sockets;
@@ -57,6 +58,7 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
     
     private Subject<Matrix4x4>              _leapToLocatableCamera;
     private ReactiveProperty<bool>          _calibrationStatus;
+    private ReactiveProperty<bool>          _framesCalibratedByClient;
     private Subject<LeapFrameData>          _frameStream;
 
     #region Control message strings
@@ -70,6 +72,21 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
     private const string                    _pauseStreamingString           = "Pause data streaming";
     private const string                    _resumeStreamingString          = "Resume data streaming";
     private const string                    _endStreamingString             = "End data streaming";
+    private const string                    _calibratedFramesString         = "Calibrated frames";
+    // Ends every control message sent to the Leap client, which splits the received bytes into messages on it
+    private const string                    _controlMessageDelimiter        = "\n";
+    #endregion
+
+    #region Calibration upload framing
+    private const byte                      _calibrationHeaderMessage       = 1;
+    private const byte                      _calibrationImageMessage        = 2;
+    private const uint                      _calibrationHeaderPayloadSize   = 36;
+    private const uint                      _calibrationImagePrefixSize     = 8;
+    private const int                       _calibrationFormatRawBgr        = 0;
+    private const int                       _calibrationFormatJpeg          = 1;
+    private const int                       _calibrationFormatPng           = 2;
+    // Compressed images take a fraction of the time of raw ones to upload over Wi-Fi
+    private const int                       _calibrationImageFormat         = _calibrationFormatJpeg;
     #endregion
 
     public LeapConnectionManager(
@@ -79,7 +96,8 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
         [Inject]                                    ILocatableCameraController  cameraController,
         [Inject(Id = "Leap to locatable camera")]   Subject<Matrix4x4>          leapToLocatableCamera,
         [Inject(Id = "Calibration status")]         ReactiveProperty<bool>      calibrationStatus,
-        [Inject(Id = "Frame stream")]               Subject<LeapFrameData>      frameStream)
+        [Inject(Id = "Frame stream")]               Subject<LeapFrameData>      frameStream,
+        [Inject(Id = "Frames calibrated by client")] ReactiveProperty<bool>     framesCalibratedByClient)
     {
         _infoText = infoText;
         _handAlignementCanvas = handAlignmentCanvas;
@@ -106,6 +124,7 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
         _leapToLocatableCamera = leapToLocatableCamera;
         _calibrationStatus = calibrationStatus;
         _frameStream = frameStream;
+        _framesCalibratedByClient = framesCalibratedByClient;
 
         _keywordRecognizer = new KeywordRecognizer(_keywords);
         _keywordRecognizer.OnPhraseRecognized += OnPhraseRecognized;
@@ -118,20 +137,28 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
     
     public async void ReceiveTakenPictureAsBytes(List<byte> imageData, int width, int height, Matrix4x4 calibrationMatrix)
     {
+        // The picture was taken just before this was called. The time from here to sending it is sent along, so that
+        // the Leap client can pair it with the Leap frame captured at the same time.
+        System.Diagnostics.Stopwatch captureAge = System.Diagnostics.Stopwatch.StartNew();
         _currentText.Value = "Image captured. Processing.";
 
         DataWriter writer = new DataWriter(_tcpSocket.OutputStream);
-        byte[] dataArray = BGRA2BGR(imageData);
+        writer.ByteOrder = ByteOrder.LittleEndian;
+        byte[] dataArray = _calibrationImageFormat == _calibrationFormatRawBgr ?
+            BGRA2BGR(imageData) :
+            await EncodeImage(imageData.ToArray(), width, height);
 
         // If this is the first image to be sent, first send message with necessary info
         if (_numberOfImagesSent == 0)
         {
-            string message = CreateCalibrationMessage(calibrationMatrix, width, height, dataArray.Length);
-            writer.WriteString(message);
+            WriteCalibrationHeader(writer, calibrationMatrix, width, height, width * height * 3);
             await writer.StoreAsync();
         }
 
-        // Send the current image
+        // Send the current image, prefixed with its length so that the Leap client can receive it in one piece
+        writer.WriteUInt32((uint)dataArray.Length + 1 + _calibrationImagePrefixSize);
+        writer.WriteByte(_calibrationImageMessage);
+        writer.WriteInt64(captureAge.ElapsedTicks * 1000000 / System.Diagnostics.Stopwatch.Frequency);
         writer.WriteBytes(dataArray);
         await writer.StoreAsync();
         _numberOfImagesSent++;
@@ -213,15 +240,11 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
                     Thread.Sleep(500);
                 }
 
-                DataWriter writer = new DataWriter(_tcpSocket.OutputStream);
-
                 if (_doCalibration.Value)
                 {
                     _currentText.Value = "Calibration chosen. Waiting for camera.";
                     // Tell Leap client that we're gonna do calibration
-                    writer.WriteString(_doCalibrationMessage);
-                    await writer.StoreAsync();
-                    writer.DetachStream();
+                    await SendControlMessage(_doCalibrationMessage);
 
                     // Request use of camera. Wait until we get it.
                     while (!_cameraController.RequestUsage(this))
@@ -236,13 +259,13 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
                     _currentText.Value = "Loading from file chosen. Loading now.";
                     // Load the latest result
                     Matrix4x4 transform = await ReadCalibrationFromFile();
+                    // The Leap client only calibrates the frames it streams when it did the calibration itself
+                    _framesCalibratedByClient.Value = false;
                     _leapToLocatableCamera.OnNext(transform);
                     _calibrationStatus.Value = true;
 
                     // Notify Leap client to not do calibration
-                    writer.WriteString(_skipCalibrationMessage);
-                    await writer.StoreAsync();
-                    writer.DetachStream();
+                    await SendControlMessage(_skipCalibrationMessage);
                 }
                 
             }
@@ -251,6 +274,7 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
                 _currentText.Value = "Calibration succesful.";
                 // Get the values and construct the Leap to camera transform
                 Matrix4x4 transform = ReadCalibrationFromMessage(message);
+                _framesCalibratedByClient.Value = IsCalibratedFramesMessage(message);
                 _leapToLocatableCamera.OnNext(transform);
                 _calibrationStatus.Value = true;
 
@@ -259,10 +283,7 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
 
                 // Send message to Leap client that everything is OK.
                 // TODO: Make it possible to redo calibration
-                DataWriter dw = new DataWriter(_tcpSocket.OutputStream);
-                dw.WriteString(_holoCalibrationSuccessString);
-                await dw.StoreAsync();
-                dw.DetachStream();
+                await SendControlMessage(_holoCalibrationSuccessString);
             }
             else if (message == _leapCalibrationFailureString)
             {
@@ -367,35 +388,71 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
     }
 
     /// <summary>
-    /// Creates a message which includes the needed calibration data, how many images will be sent, and how big each image is
+    /// Writes the framed header message which includes the needed calibration data, how many images will be sent, and how big each image is
     /// </summary>
+    /// <param name="writer">Writer of the TCP socket, set to little-endian</param>
     /// <param name="calibMatrix">The camera's calibration matrix</param>
     /// <param name="width">Width of each image in pixels</param>
     /// <param name="height">Height of image in pixels</param>
-    /// <param name="imgSize">The size of the whole image in bytes</param>
-    /// <returns></returns>
-    private string CreateCalibrationMessage(Matrix4x4 calibMatrix, int width, int height, int imgSize)
+    /// <param name="imgSize">The size of the whole decoded image in bytes</param>
+    private void WriteCalibrationHeader(DataWriter writer, Matrix4x4 calibMatrix, int width, int height, int imgSize)
     {
-        string message = "";
-
+        writer.WriteUInt32(_calibrationHeaderPayloadSize + 1);
+        writer.WriteByte(_calibrationHeaderMessage);
         // fx
-        message += (calibMatrix.m00 * width / 2).ToString();
+        writer.WriteSingle(calibMatrix.m00 * width / 2);
         // fy
-        message += ";" + (calibMatrix.m11 * height / 2).ToString();
+        writer.WriteSingle(calibMatrix.m11 * height / 2);
         // cx
-        message += ";" + ((calibMatrix.m02 + 1) / 2 * width).ToString();
+        writer.WriteSingle((calibMatrix.m02 + 1) / 2 * width);
         // cy
-        message += ";" + ((calibMatrix.m12 + 1) / 2 * height).ToString();
+        writer.WriteSingle((calibMatrix.m12 + 1) / 2 * height);
         // Image width
-        message += ";" + width.ToString();
+        writer.WriteInt32(width);
         // Image height
-        message += ";" + height.ToString();
+        writer.WriteInt32(height);
         // Number of images that will be sent
-        message += ";" + _numberOfImagesToSend.ToString();
+        writer.WriteInt32(_numberOfImagesToSend);
         // Image size
-        message += ";" + imgSize.ToString();
+        writer.WriteInt32(imgSize);
+        // Format of the image messages
+        writer.WriteInt32(_calibrationImageFormat);
+    }
 
-        return message;
+    /// <summary>
+    /// Sends a control message to the Leap client, terminated with the control message delimiter
+    /// </summary>
+    /// <param name="message">The message without the delimiter</param>
+    private async Task SendControlMessage(string message)
+    {
+        DataWriter writer = new DataWriter(_tcpSocket.OutputStream);
+        writer.WriteString(message + _controlMessageDelimiter);
+        await writer.StoreAsync();
+        writer.DetachStream();
+    }
+
+    /// <summary>
+    /// Compresses a BGRA image to the format given by _calibrationImageFormat
+    /// </summary>
+    /// <param name="bgra">Bytes of the BGRA image</param>
+    /// <param name="width">Width of the image in pixels</param>
+    /// <param name="height">Height of the image in pixels</param>
+    /// <returns>The encoded image file</returns>
+    private async Task<byte[]> EncodeImage(byte[] bgra, int width, int height)
+    {
+        Guid encoderId = _calibrationImageFormat == _calibrationFormatPng ? BitmapEncoder.PngEncoderId : BitmapEncoder.JpegEncoderId;
+        using (InMemoryRandomAccessStream stream = new InMemoryRandomAccessStream())
+        {
+            BitmapEncoder encoder = await BitmapEncoder.CreateAsync(encoderId, stream);
+            encoder.SetPixelData(BitmapPixelFormat.Bgra8, BitmapAlphaMode.Ignore, (uint)width, (uint)height, 96.0, 96.0, bgra);
+            await encoder.FlushAsync();
+
+            byte[] encoded = new byte[stream.Size];
+            DataReader reader = new DataReader(stream.GetInputStreamAt(0));
+            await reader.LoadAsync((uint)stream.Size);
+            reader.ReadBytes(encoded);
+            return encoded;
+        }
     }
 
     /// <summary>
@@ -453,6 +510,17 @@ public class LeapConnectionManager : ILeapConnectionManager, ICameraImageRequest
         return transform;
     }
 
+    /// <summary>
+    /// Checks whether the Leap client's calibration result says that it streams frames with the calibration already applied
+    /// </summary>
+    /// <param name="message">The Leap client's message</param>
+    /// <returns>True if the streamed frames are already in the camera's coordinate system</returns>
+    private bool IsCalibratedFramesMessage(string message)
+    {
+        string[] values = message.Split(';');
+        return values.Length > 13 && values[13] == _calibratedFramesString;
+    }
+
     /// <summary>
     /// Write the calibration matrix to file
     /// </summary>
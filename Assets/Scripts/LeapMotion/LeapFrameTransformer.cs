@@ -6,15 +6,18 @@ using Zenject;
 public class LeapFrameTransformer : ILeapFrameTransformer
 {
     private Matrix4x4               _leapToLocatableCamera;
+    private ReactiveProperty<bool>  _framesCalibratedByClient;
 
     private Subject<LeapFrameData>  _transformedFrameStream;
 
     LeapFrameTransformer(
         [Inject(Id ="Frame stream")]                Subject<LeapFrameData>  frameStream,
         [Inject(Id = "Transformed frame stream")]   Subject<LeapFrameData>  transformedFrameStream,
-        [Inject(Id = "Leap to locatable camera")]   Subject<Matrix4x4>      leapToLocatableCamera)
+        [Inject(Id = "Leap to locatable camera")]   Subject<Matrix4x4>      leapToLocatableCamera,
+        [Inject(Id = "Frames calibrated by client")] ReactiveProperty<bool> framesCalibratedByClient)
     {
         _transformedFrameStream = transformedFrameStream;
+        _framesCalibratedByClient = framesCalibratedByClient;
 
         leapToLocatableCamera.Subscribe(trans =>
         {
@@ -23,7 +26,12 @@ public class LeapFrameTransformer : ILeapFrameTransformer
 
         frameStream.ObserveOn(Scheduler.MainThread).SubscribeOn(Scheduler.MainThread).Subscribe(frame =>
         {
-            if (frame != null)
+            // Frames the Leap client has already transformed to the camera's coordinate system are passed on as they are
+            if (frame != null && _framesCalibratedByClient.Value)
+            {
+                _transformedFrameStream.OnNext(frame);
+            }
+            else if (frame != null)
             {
                 LeapArmData leftArm = frame.left_arm;
                 LeapArmData rightArm = frame.right_arm;
@@ -27,6 +27,7 @@ public class LeapMotionInstaller : MonoInstaller<LeapMotionInstaller>
         Container.BindInstance(new Subject<Matrix4x4>()).WithId("Leap to locatable camera");
         Container.BindInstance(new Subject<LeapFrameData>()).WithId("Frame stream");
         Container.BindInstance(new Subject<LeapFrameData>()).WithId("Transformed frame stream");
+        Container.BindInstance(new ReactiveProperty<bool>(false)).WithId("Frames calibrated by client");
 
         // Frame transformer
         Container.Bind(typeof(ILeapFrameTransformer)).To<LeapFrameTransformer>().AsSingle().NonLazy();
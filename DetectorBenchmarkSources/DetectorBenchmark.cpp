@@ -0,0 +1,449 @@
+// DetectorBenchmark.cpp : Measures what detecting the hands and fingertips of a calibration image allocates.
+//
+// Usage: DetectorBenchmark [--images DIR] [--repeats N] [--baseline FILE] [--write-baseline FILE]
+//
+// The images are the training images of the skin colour trainer, 1.jpg, 2.jpg and so on, and the skin model is read
+// from calibration_data.txt in the working directory, so the benchmark is run from LeapMotionClientSources. Every
+// image is detected with a new workspace, as each call allocated its own images before, and with one workspace kept
+// from image to image, as the calibration workers do. For both the benchmark reports milliseconds, image buffers,
+// full size image buffers and heap allocations per image, after a first pass over the images that sizes the kept
+// workspace. It exits with an error if the two find different fingertips. A baseline written with --write-baseline
+// can be passed back with --baseline, in which case the benchmark also exits with an error if either allocates more
+// per image than it did.
+//
+// The skin masks of SkinClassifier are then compared with those of the classification it replaced, which converted
+// the whole images with cvtColor and compared cv::Mahalanobis with the thresholds of every cluster. The benchmark
+// exits with an error if a single pixel of any image differs.
+
+#include "BenchmarkBaseline.h"
+#include "DetectorWorkspace.h"
+#include "FingertipDetector.h"
+#include "HandDetector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace std;
+using namespace cv;
+
+#define DEFAULT_IMAGES_FOLDER		"../SkinColorDetectionTrainerSources/training_images/"
+#define DEFAULT_REPEATS				3
+// Allocations per image a run may make over its baseline. The counts are averages, of which a few allocations made
+// once, e.g. by a thread of the pool on its first tile, are a fraction.
+#define BASELINE_TOLERANCE			0.1
+
+// Every heap allocation made by the process is counted, as is every image buffer, which OpenCV allocates outside of
+// operator new
+atomic<uint64_t> allocation_count(0);
+atomic<uint64_t> mat_allocation_count(0);
+atomic<uint64_t> frame_mat_allocation_count(0);
+// Image buffers of at least this many bytes are counted as full size
+size_t frame_bytes = 0;
+
+void* operator new(size_t size)
+{
+	allocation_count.fetch_add(1, memory_order_relaxed);
+	void* memory = malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+	{
+		throw bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+/// Counts the image buffers allocated and leaves the allocating to the standard allocator of OpenCV
+class CountingMatAllocator : public MatAllocator
+{
+public:
+
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+		UMatUsageFlags usage_flags) const override
+	{
+		if (data == nullptr)
+		{
+			size_t bytes = CV_ELEM_SIZE(type);
+			for (int i = 0; i < dims; ++i)
+			{
+				bytes *= sizes[i];
+			}
+			mat_allocation_count.fetch_add(1, memory_order_relaxed);
+			if (bytes >= frame_bytes)
+			{
+				frame_mat_allocation_count.fetch_add(1, memory_order_relaxed);
+			}
+		}
+		return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+	}
+
+	bool allocate(UMatData* data, int access_flags, UMatUsageFlags usage_flags) const override
+	{
+		return Mat::getStdAllocator()->allocate(data, access_flags, usage_flags);
+	}
+
+	void deallocate(UMatData* data) const override
+	{
+		Mat::getStdAllocator()->deallocate(data);
+	}
+};
+
+struct DetectionResult
+{
+	double							ms_per_image;
+	double							mat_allocations_per_image;
+	double							frame_mat_allocations_per_image;
+	double							allocations_per_image;
+	vector<vector<Point2f>>			fingertips;
+};
+
+/// The skin model as the detector read it before SkinModel, with a Mat for every mean and inverse covariance
+struct ReferenceSkinModel
+{
+	int								sample_dim;
+	vector<double>					upper_thresholds;
+	vector<Mat>						means;
+	vector<Mat>						inv_covars;
+};
+
+/// Reads the trainer's result file as the detector did before SkinModel. Returns false if it cannot be read.
+bool ReadReferenceSkinModel(const string& file_name, ReferenceSkinModel* model)
+{
+	ifstream result_file(file_name);
+	string line;
+	if (!getline(result_file, line))
+	{
+		return false;
+	}
+
+	stringstream ss(line);
+	string field;
+	try
+	{
+		getline(ss, field, ';');
+		model->sample_dim = stoi(field);
+		getline(ss, field, ';');
+		int cluster_count = stoi(field);
+		for (int i = 0; i < cluster_count; ++i)
+		{
+			string mah_mean_str, mah_std_dev_str, mean_str, inv_covar_str;
+			getline(ss, mah_mean_str, ';');
+			getline(ss, mah_std_dev_str, ';');
+			getline(ss, mean_str, ';');
+			getline(ss, inv_covar_str, ';');
+			model->upper_thresholds.push_back(stod(mah_mean_str) + SKIN_STD_DEV_MARGIN * stod(mah_std_dev_str));
+
+			Mat mean(Size(model->sample_dim, 1), CV_64F);
+			stringstream mean_ss(mean_str);
+			for (int j = 0; j < model->sample_dim; ++j)
+			{
+				getline(mean_ss, field, ',');
+				mean.at<double>(0, j) = stod(field);
+			}
+			model->means.push_back(mean);
+
+			Mat inv_covar(Size(model->sample_dim, model->sample_dim), CV_64F);
+			stringstream inv_covar_ss(inv_covar_str);
+			for (int row = 0; row < model->sample_dim; ++row)
+			{
+				for (int col = 0; col < model->sample_dim; ++col)
+				{
+					getline(inv_covar_ss, field, ',');
+					inv_covar.at<double>(row, col) = stod(field);
+				}
+			}
+			model->inv_covars.push_back(inv_covar);
+		}
+	}
+	catch (const logic_error&)
+	{
+		return false;
+	}
+	return model->sample_dim == SKIN_FEATURE_COUNT;
+}
+
+/// Writes the features of one colour, converted by cvtColor, as the detector did before SkinFeatureExtractor
+void WriteReferenceFeatures(const Vec3b& rgb_pixel, const Vec3b& ycrcb_pixel, const Vec3b& hsv_pixel,
+	const Vec3b& cielab_pixel, double* features)
+{
+	double rgb_sum = rgb_pixel[0] + rgb_pixel[1] + rgb_pixel[2];
+	double nr = rgb_sum > 0.0 ? ((double)rgb_pixel[2] / rgb_sum) * 255.0 : 0.0;
+	double ng = rgb_sum > 0.0 ? ((double)rgb_pixel[1] / rgb_sum) * 255.0 : 0.0;
+	int RG = rgb_pixel[2] - rgb_pixel[1];
+	int YB = (2 * rgb_pixel[0] - rgb_pixel[2] + rgb_pixel[1]) / 4;
+	double color_features[SKIN_COLOR_FEATURE_COUNT] =
+	{
+		(double)rgb_pixel[2], (double)rgb_pixel[1], (double)rgb_pixel[0],
+		nr, ng,
+		(double)RG, (double)YB,
+		(double)ycrcb_pixel[0], (double)ycrcb_pixel[1], (double)ycrcb_pixel[2],
+		(double)hsv_pixel[0], (double)hsv_pixel[1], (double)hsv_pixel[2],
+		(double)cielab_pixel[0], (double)cielab_pixel[1], (double)cielab_pixel[2]
+	};
+	copy(color_features, color_features + SKIN_COLOR_FEATURE_COUNT, features);
+}
+
+/// Returns the skin mask of the image as the detector computed it before SkinClassifier: the image and the average
+/// of its surroundings are converted whole with cvtColor, and a pixel is skin if its cv::Mahalanobis distance to a
+/// cluster is within the cluster's thresholds
+Mat ReferenceSkinMask(const Mat& image, const ReferenceSkinModel& model)
+{
+	Mat target = image.clone();
+	Mat YCrCb, HSV, CIELab;
+	Mat blurred_RGB, blurred_YCrCb, blurred_HSV, blurred_CIELab;
+	GaussianBlur(target, target, Size(5, 5), 0.0);
+	cvtColor(target, YCrCb, CV_BGR2YCrCb);
+	cvtColor(target, HSV, CV_BGR2HSV);
+	cvtColor(target, CIELab, CV_BGR2Lab);
+
+	Mat surround_average_kernel = getStructuringElement(MORPH_ELLIPSE, Size(AVERAGING_KERNEL_SIZE, AVERAGING_KERNEL_SIZE));
+	surround_average_kernel.at<uchar>(AVERAGING_KERNEL_SIZE / 2, AVERAGING_KERNEL_SIZE / 2) = 0;
+	int kernel_sum = countNonZero(surround_average_kernel);
+	surround_average_kernel.convertTo(surround_average_kernel, CV_32FC1);
+	surround_average_kernel = surround_average_kernel / (float)kernel_sum;
+	filter2D(target, blurred_RGB, -1, surround_average_kernel);
+	cvtColor(blurred_RGB, blurred_YCrCb, CV_BGR2YCrCb);
+	cvtColor(blurred_RGB, blurred_HSV, CV_BGR2HSV);
+	cvtColor(blurred_RGB, blurred_CIELab, CV_BGR2Lab);
+
+	Mat mask = Mat::zeros(target.size(), CV_8U);
+	WorkStealingPool::Shared().ParallelForTiles(target.rows, target.cols, [&](const ImageTile& tile)
+	{
+		double features[SKIN_FEATURE_COUNT];
+		// A header over the features, so that no pixel allocates
+		Mat transformed_pixel(Size(SKIN_FEATURE_COUNT, 1), CV_64F, features);
+		for (int row = tile.row_begin; row < tile.row_end; ++row)
+		{
+			for (int col = tile.col_begin; col < tile.col_end; ++col)
+			{
+				WriteReferenceFeatures(target.at<Vec3b>(row, col), YCrCb.at<Vec3b>(row, col), HSV.at<Vec3b>(row, col),
+					CIELab.at<Vec3b>(row, col), features);
+				WriteReferenceFeatures(blurred_RGB.at<Vec3b>(row, col), blurred_YCrCb.at<Vec3b>(row, col),
+					blurred_HSV.at<Vec3b>(row, col), blurred_CIELab.at<Vec3b>(row, col),
+					features + SKIN_COLOR_FEATURE_COUNT);
+				for (size_t i = 0; i < model.means.size() && mask.at<uchar>(row, col) != 255; ++i)
+				{
+					double mah_distance = Mahalanobis(transformed_pixel, model.means[i], model.inv_covars[i]);
+					if (mah_distance >= 0.0 && mah_distance <= model.upper_thresholds[i])
+					{
+						mask.at<uchar>(row, col) = 255;
+					}
+				}
+			}
+		}
+	});
+	return mask;
+}
+
+/// Returns the number of pixels of all images whose skin mask from SkinClassifier differs from the reference mask
+uint64_t CountClassifierDifferences(const vector<Mat>& images, const ReferenceSkinModel& model,
+	HandDetector* hand_detector, DetectorWorkspace* workspace)
+{
+	uint64_t different_pixels = 0;
+	Mat input;
+	Mat difference;
+	for (const Mat& image : images)
+	{
+		image.copyTo(input);
+		Mat mask = hand_detector->DetectHands(&input, false, workspace);
+		absdiff(mask, ReferenceSkinMask(image, model), difference);
+		different_pixels += countNonZero(difference);
+	}
+	return different_pixels;
+}
+
+vector<Mat> ReadImages(const string& folder)
+{
+	vector<Mat> images;
+	while (true)
+	{
+		// Decoded as the calibration worker decodes the received images
+		Mat image = imread(folder + to_string(images.size() + 1) + ".jpg", IMREAD_COLOR);
+		if (image.empty())
+		{
+			break;
+		}
+		images.push_back(image);
+	}
+	return images;
+}
+
+/// Detects the hands and fingertips of every image repeats times, with a new workspace for every image or with the
+/// one given. Only the detection is timed and counted.
+DetectionResult Detect(const vector<Mat>& images, int repeats, HandDetector* hand_detector,
+	FingertipDetector* fingertip_detector, DetectorWorkspace* kept_workspace)
+{
+	DetectionResult result;
+	result.fingertips.resize(images.size());
+	for (vector<Point2f>& tips : result.fingertips)
+	{
+		tips.reserve(10);
+	}
+	// The image is blurred in place, so each one is copied into the same buffer first
+	Mat input;
+	chrono::steady_clock::duration time(0);
+	uint64_t mat_allocations = 0;
+	uint64_t frame_mat_allocations = 0;
+	uint64_t allocations = 0;
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (size_t i = 0; i < images.size(); ++i)
+		{
+			images[i].copyTo(input);
+			vector<Point2f>* tips = &result.fingertips[i];
+			tips->clear();
+
+			uint64_t mat_allocations_before = mat_allocation_count.load();
+			uint64_t frame_mat_allocations_before = frame_mat_allocation_count.load();
+			uint64_t allocations_before = allocation_count.load();
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			if (kept_workspace != nullptr)
+			{
+				Mat hands = hand_detector->DetectHands(&input, true, kept_workspace);
+				fingertip_detector->FindFingertips(&hands, tips, kept_workspace);
+			}
+			else
+			{
+				DetectorWorkspace workspace;
+				Mat hands = hand_detector->DetectHands(&input, true, &workspace);
+				fingertip_detector->FindFingertips(&hands, tips, &workspace);
+			}
+			time += chrono::steady_clock::now() - start;
+			mat_allocations += mat_allocation_count.load() - mat_allocations_before;
+			frame_mat_allocations += frame_mat_allocation_count.load() - frame_mat_allocations_before;
+			allocations += allocation_count.load() - allocations_before;
+		}
+	}
+
+	double runs = (double)images.size() * repeats;
+	result.ms_per_image = chrono::duration<double, milli>(time).count() / runs;
+	result.mat_allocations_per_image = mat_allocations / runs;
+	result.frame_mat_allocations_per_image = frame_mat_allocations / runs;
+	result.allocations_per_image = allocations / runs;
+	return result;
+}
+
+void PrintResult(const string& name, const DetectionResult& result)
+{
+	cout << left << setw(20) << name << fixed << setprecision(3) << setw(12) << result.ms_per_image << setprecision(1)
+		<< setw(14) << result.mat_allocations_per_image << setw(20) << result.frame_mat_allocations_per_image
+		<< setw(14) << result.allocations_per_image;
+	cout.unsetf(ios::fixed);
+}
+
+/// Prints the result, writes it to the output baseline if there is one and checks it against the baseline. Returns
+/// true if it allocates more per image than its baseline.
+bool ReportResult(const string& name, const string& key, const DetectionResult& result, BenchmarkBaseline* baseline)
+{
+	PrintResult(name, result);
+	// Only the allocations are checked, as the time depends on the machine
+	BaselineTolerance tolerances[] = { BaselineTolerance::Unchecked(), { 0.0, BASELINE_TOLERANCE },
+		{ 0.0, BASELINE_TOLERANCE }, { 0.0, BASELINE_TOLERANCE } };
+	bool allocates_more = baseline->Check(key, { result.ms_per_image, result.mat_allocations_per_image,
+		result.frame_mat_allocations_per_image, result.allocations_per_image }, tolerances);
+	if (allocates_more)
+	{
+		cout << "REGRESSION";
+	}
+	cout << endl;
+	return allocates_more;
+}
+
+int main(int argc, char* argv[])
+{
+	string images_folder = DEFAULT_IMAGES_FOLDER;
+	int repeats = DEFAULT_REPEATS;
+	string baseline_path;
+	string write_baseline_path;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		string option = argv[i];
+		if (option == "--images")
+		{
+			images_folder = argv[i + 1];
+		}
+		else if (option == "--repeats")
+		{
+			repeats = max(1, atoi(argv[i + 1]));
+		}
+		else if (option == "--baseline")
+		{
+			baseline_path = argv[i + 1];
+		}
+		else if (option == "--write-baseline")
+		{
+			write_baseline_path = argv[i + 1];
+		}
+	}
+
+	BenchmarkBaseline baseline(baseline_path, write_baseline_path);
+
+	vector<Mat> images = ReadImages(images_folder);
+	if (images.empty())
+	{
+		cout << "Could not read the images from " << images_folder << endl;
+		return EXIT_FAILURE;
+	}
+	frame_bytes = images[0].total();
+	cout << images.size() << " images of " << images[0].cols << "x" << images[0].rows << ", "
+		<< WorkStealingPool::Shared().WorkerCount() + 1 << " threads" << endl;
+
+	CountingMatAllocator mat_allocator;
+	Mat::setDefaultAllocator(&mat_allocator);
+	HandDetector hand_detector;
+	FingertipDetector fingertip_detector;
+
+	DetectorWorkspace workspace;
+	Detect(images, 1, &hand_detector, &fingertip_detector, &workspace);
+	DetectionResult fresh = Detect(images, repeats, &hand_detector, &fingertip_detector, nullptr);
+	DetectionResult kept = Detect(images, repeats, &hand_detector, &fingertip_detector, &workspace);
+
+	cout << left << setw(20) << "workspace" << setw(12) << "ms" << setw(14) << "Mats" << setw(20) << "full size Mats"
+		<< "heap allocs" << endl;
+	bool has_regression = ReportResult("new per image", "new", fresh, &baseline);
+	has_regression = ReportResult("kept", "kept", kept, &baseline) || has_regression;
+	// What the kept workspace still allocates is allocated inside OpenCV, e.g. the bordered copy findContours traces
+	bool has_mismatch = fresh.fingertips != kept.fingertips;
+	if (has_mismatch)
+	{
+		cout << "The fingertips found with a kept workspace differ from those found with a new one" << endl;
+	}
+
+	Mat::setDefaultAllocator(nullptr);
+
+	ReferenceSkinModel reference_model;
+	if (!ReadReferenceSkinModel(string(RESULT_FILE_NAME_BASE) + ".txt", &reference_model))
+	{
+		cout << "Could not read the skin model to check the classifier against" << endl;
+		return EXIT_FAILURE;
+	}
+	uint64_t different_pixels = CountClassifierDifferences(images, reference_model, &hand_detector, &workspace);
+	cout << "Skin mask pixels that differ from cv::Mahalanobis: " << different_pixels << endl;
+	if (different_pixels > 0)
+	{
+		has_mismatch = true;
+	}
+
+	return has_mismatch || has_regression ? EXIT_FAILURE : EXIT_SUCCESS;
+}
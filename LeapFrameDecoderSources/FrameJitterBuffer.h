@@ -0,0 +1,253 @@
+#pragma once
+
+#include "FrameData.h"
+#include "DatagramStamp.h"
+#include "FrameHistory.h"
+
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// About 130 ms of frames at the Leap's highest frame rate, more than any delay worth waiting for
+#define JITTER_BUFFER_CAPACITY			16
+#define JITTER_BUFFER_DEFAULT_DELAY_US	20000
+// A sequence this far from the newest frame means the client was restarted, so the buffer starts over
+#define JITTER_BUFFER_RESET_GAP			1000
+
+enum class JitterInsertResult
+{
+	INSERTED,
+	DUPLICATE,
+	LATE
+};
+
+enum class JitterFindResult
+{
+	EMPTY,
+	// The frame was interpolated between the two frames captured around the requested time, or is one of them
+	INTERPOLATED,
+	// Every buffered frame was captured after the requested time
+	OLDEST,
+	// Every buffered frame was captured before the requested time, i.e. the stream is late or has stopped
+	NEWEST
+};
+
+struct JitterBufferStats
+{
+	uint64_t	inserted;
+	uint64_t	duplicates;
+	uint64_t	late;
+	uint64_t	reordered;
+};
+
+/// Returns true if sequence a comes before b. Sequence numbers wrap around at 2^32.
+inline bool SequenceBefore(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+/// Holds the last few received frames in sequence order and picks the frame to show at a given render time.
+///
+/// The sender's capture clock is mapped to the receiver's clock with the smallest difference between the arrival time
+/// and the capture time among the buffered frames, which is the offset of a frame that arrived without queuing
+/// anywhere. Each frame is then shown delay microseconds after that, so a frame that is held up by at most delay still
+/// arrives in time, and frames that arrive out of order are put back in order. Storage is allocated once; the buffer
+/// is small enough for the order to be kept by insertion. Not thread-safe.
+class FrameJitterBuffer
+{
+public:
+
+	FrameJitterBuffer(size_t capacity = JITTER_BUFFER_CAPACITY, int64_t delay_us = JITTER_BUFFER_DEFAULT_DELAY_US) :
+		entries(capacity), order(capacity)
+	{
+		delay = delay_us;
+		Clear();
+	}
+
+	/// Adds a frame received at receive_time, in the receiver's clock in microseconds, in the order of its stamp's
+	/// sequence
+	JitterInsertResult Insert(const DatagramStamp& stamp, int64_t receive_time, const FrameData& frame)
+	{
+		uint32_t sequence = stamp.sequence;
+		if (count > 0)
+		{
+			uint32_t gap = sequence - entries[order[count - 1]].stamp.sequence;
+			if (gap > JITTER_BUFFER_RESET_GAP && gap < 0u - JITTER_BUFFER_RESET_GAP)
+			{
+				Clear();
+			}
+		}
+		if (has_evicted && !SequenceBefore(evicted_sequence, sequence))
+		{
+			++stats.late;
+			return JitterInsertResult::LATE;
+		}
+
+		// Position in the order, searched from the newest end where frames normally go
+		size_t position = count;
+		while (position > 0 && SequenceBefore(sequence, entries[order[position - 1]].stamp.sequence))
+		{
+			--position;
+		}
+		if (position > 0 && entries[order[position - 1]].stamp.sequence == sequence)
+		{
+			++stats.duplicates;
+			return JitterInsertResult::DUPLICATE;
+		}
+
+		// When full the oldest frame makes room, unless the new frame would itself be the oldest
+		size_t slot;
+		if (count == entries.size())
+		{
+			if (position == 0)
+			{
+				++stats.late;
+				return JitterInsertResult::LATE;
+			}
+			slot = order[0];
+			evicted_sequence = entries[slot].stamp.sequence;
+			has_evicted = true;
+			for (size_t i = 1; i < count; ++i)
+			{
+				order[i - 1] = order[i];
+			}
+			--count;
+			--position;
+		}
+		else
+		{
+			slot = FreeSlot();
+		}
+
+		for (size_t i = count; i > position; --i)
+		{
+			order[i] = order[i - 1];
+		}
+		order[position] = slot;
+		++count;
+		if (position < count - 1)
+		{
+			++stats.reordered;
+		}
+		++stats.inserted;
+
+		Entry* entry = &entries[slot];
+		entry->stamp = stamp;
+		entry->arrival_offset = receive_time - frame.capture_timestamp;
+		entry->frame = frame;
+		return JitterInsertResult::INSERTED;
+	}
+
+	/// Finds the frame to show at render_time, in the same clock as the receive times. With interpolation the frame is
+	/// interpolated between the two frames around the requested time, otherwise it is the closest of them. The stamp
+	/// is that of the closest frame.
+	JitterFindResult Find(int64_t render_time, bool is_interpolating, FrameData* frame, DatagramStamp* stamp) const
+	{
+		if (count == 0)
+		{
+			return JitterFindResult::EMPTY;
+		}
+
+		int64_t offset = entries[order[0]].arrival_offset;
+		for (size_t i = 1; i < count; ++i)
+		{
+			offset = entries[order[i]].arrival_offset < offset ? entries[order[i]].arrival_offset : offset;
+		}
+		int64_t target = render_time - delay - offset;
+
+		// First frame captured at or after the target. Capture times follow the sequence unless a recording loops.
+		size_t after = 0;
+		while (after < count && entries[order[after]].frame.capture_timestamp < target)
+		{
+			++after;
+		}
+		if (after == 0 || after == count)
+		{
+			const Entry* entry = &entries[order[after == 0 ? 0 : count - 1]];
+			*frame = entry->frame;
+			*stamp = entry->stamp;
+			return after == 0 ? JitterFindResult::OLDEST : JitterFindResult::NEWEST;
+		}
+
+		const Entry* entry_a = &entries[order[after - 1]];
+		const Entry* entry_b = &entries[order[after]];
+		const FrameData* a = &entry_a->frame;
+		const FrameData* b = &entry_b->frame;
+		float t = b->capture_timestamp > a->capture_timestamp ?
+			(float)(target - a->capture_timestamp) / (float)(b->capture_timestamp - a->capture_timestamp) : 0.0f;
+		if (is_interpolating)
+		{
+			InterpolateFrames(a, b, t, frame);
+		}
+		else
+		{
+			*frame = t < 0.5f ? *a : *b;
+		}
+		*stamp = t < 0.5f ? entry_a->stamp : entry_b->stamp;
+		return JitterFindResult::INTERPOLATED;
+	}
+
+	/// Time in microseconds between the earliest arrival of a frame and showing it
+	void SetDelay(int64_t delay_us)
+	{
+		delay = delay_us;
+	}
+
+	int64_t Delay() const
+	{
+		return delay;
+	}
+
+	void Clear()
+	{
+		count = 0;
+		has_evicted = false;
+	}
+
+	size_t Count() const
+	{
+		return count;
+	}
+
+	const JitterBufferStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+
+	struct Entry
+	{
+		DatagramStamp	stamp;
+		// Receive time minus capture time
+		int64_t			arrival_offset;
+		FrameData		frame;
+	};
+
+	vector<Entry>		entries;
+	// Slots of the buffered frames, oldest sequence first
+	vector<size_t>		order;
+	size_t				count				= 0;
+	int64_t				delay				= JITTER_BUFFER_DEFAULT_DELAY_US;
+	bool				has_evicted			= false;
+	uint32_t			evicted_sequence	= 0;
+	JitterBufferStats	stats				= {};
+
+	size_t FreeSlot() const
+	{
+		for (size_t slot = 0; slot < entries.size(); ++slot)
+		{
+			bool is_used = false;
+			for (size_t i = 0; i < count && !is_used; ++i)
+			{
+				is_used = order[i] == slot;
+			}
+			if (!is_used)
+			{
+				return slot;
+			}
+		}
+		return 0;
+	}
+};
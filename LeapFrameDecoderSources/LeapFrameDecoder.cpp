@@ -0,0 +1,244 @@
+// LeapFrameDecoder.cpp : Implements the C interface of the frame decoder library declared in LeapFrameDecoder.h.
+//
+// The decoding is done by the same code that the Leap Motion client uses to encode, so the two cannot disagree on the
+// format.
+
+#include "LeapFrameDecoder.h"
+#include "FrameData.h"
+#include "DatagramStamp.h"
+#include "BinaryFrameEncoding.h"
+#include "DeltaFrameEncoding.h"
+#include "JsonFrameReader.h"
+#include "FrameJitterBuffer.h"
+
+#include <mutex>
+#include <new>
+#include <string.h>
+
+using namespace std;
+
+struct LeapFrameDecoder
+{
+	LeapFrameDecoder(size_t capacity, int64_t delay_us) : jitter_buffer(capacity, delay_us) {}
+
+	mutex				decoder_mutex;
+	DeltaFrameDecoder	delta_decoder;
+	JsonFrameReader		json_reader;
+	FrameJitterBuffer	jitter_buffer;
+	bool				is_interpolating	= true;
+	LeapDecoderStats	stats				= {};
+	// Scratch frames, kept here so that pushing and taking frames never allocates
+	FrameData			decoded_frame;
+	FrameData			found_frame;
+};
+
+static void CopyFloat3(const Float3* source, float* destination)
+{
+	destination[0] = source->x;
+	destination[1] = source->y;
+	destination[2] = source->z;
+}
+
+static void CopyDecodedFrame(const FrameData* source, const DatagramStamp* stamp, LeapDecodedFrame* destination)
+{
+	memset(destination, 0, sizeof(LeapDecodedFrame));
+	destination->frame_id = source->id;
+	destination->capture_timestamp = source->capture_timestamp;
+	destination->send_timestamp = stamp->send_timestamp;
+	destination->sequence = stamp->sequence;
+	destination->hand_mask = source->hand_mask;
+	for (int h = 0; h < MAX_HANDS_PER_FRAME; ++h)
+	{
+		if (!HasHand(source, h))
+		{
+			continue;
+		}
+		const HandData* hand = &source->hands[h];
+		LeapDecodedHand* decoded_hand = &destination->hands[h];
+		CopyFloat3(&hand->palm, decoded_hand->palm);
+		CopyFloat3(&hand->stabilized_palm, decoded_hand->stabilized_palm);
+		CopyFloat3(&hand->palm_normal, decoded_hand->palm_normal);
+		CopyFloat3(&hand->palm_velocity, decoded_hand->palm_velocity);
+		CopyFloat3(&hand->palm_to_fingers, decoded_hand->palm_to_fingers);
+		decoded_hand->grab_angle = hand->grab_angle;
+		decoded_hand->pinch_distance = hand->pinch_distance;
+		decoded_hand->forearm_valid = hand->forearm.is_valid ? 1 : 0;
+		if (hand->forearm.is_valid)
+		{
+			CopyFloat3(&hand->forearm.wrist, decoded_hand->wrist);
+			CopyFloat3(&hand->forearm.direction, decoded_hand->forearm_direction);
+			CopyFloat3(&hand->forearm.elbow, decoded_hand->elbow);
+		}
+		decoded_hand->finger_count = hand->finger_count;
+		for (int f = 0; f < hand->finger_count; ++f)
+		{
+			const FingerData* finger = &hand->fingers[f];
+			LeapDecodedFinger* decoded_finger = &decoded_hand->fingers[f];
+			decoded_finger->type = finger->type;
+			decoded_finger->is_extended = finger->is_extended ? 1 : 0;
+			CopyFloat3(&finger->direction, decoded_finger->direction);
+			CopyFloat3(&finger->tip, decoded_finger->tip);
+			CopyFloat3(&finger->stabilized_tip, decoded_finger->stabilized_tip);
+			CopyFloat3(&finger->tip_velocity, decoded_finger->tip_velocity);
+		}
+	}
+}
+
+/// Decodes a datagram of any of the client's encodings, telling them apart by their first bytes
+static int32_t DecodeDatagram(LeapFrameDecoder* decoder, const char* datagram, size_t length, FrameData* frame,
+	DatagramStamp* stamp)
+{
+	++decoder->stats.datagrams;
+	bool is_decoded = false;
+	if (length >= 2 && datagram[0] == BINARY_FRAME_MAGIC_0 && datagram[1] == BINARY_FRAME_MAGIC_1)
+	{
+		is_decoded = ReadBinaryFrameStamp(datagram, length, stamp) && DecodeBinaryFrame(datagram, length, frame);
+	}
+	else if (length >= 2 && datagram[0] == DELTA_FRAME_MAGIC_0 && datagram[1] == DELTA_FRAME_MAGIC_1)
+	{
+		if (!ReadDeltaFrameStamp(datagram, length, stamp))
+		{
+			++decoder->stats.invalid;
+			return LEAP_DECODER_INVALID;
+		}
+		DeltaDecodeResult result = decoder->delta_decoder.Decode(datagram, length, frame);
+		if (result == DeltaDecodeResult::NEED_KEYFRAME)
+		{
+			++decoder->stats.keyframes_needed;
+			return LEAP_DECODER_NEED_KEYFRAME;
+		}
+		is_decoded = result == DeltaDecodeResult::FRAME;
+	}
+	else
+	{
+		is_decoded = decoder->json_reader.ReadFrame(datagram, length, frame, stamp);
+	}
+
+	if (!is_decoded)
+	{
+		++decoder->stats.invalid;
+		return LEAP_DECODER_INVALID;
+	}
+	return LEAP_DECODER_OK;
+}
+
+extern "C" {
+
+LEAP_DECODER_API int32_t LeapDecoderFrameSize(void)
+{
+	return (int32_t)sizeof(LeapDecodedFrame);
+}
+
+LEAP_DECODER_API LeapFrameDecoder* LeapDecoderCreate(int32_t capacity, int64_t delay_us)
+{
+	return new (nothrow) LeapFrameDecoder(capacity > 0 ? (size_t)capacity : JITTER_BUFFER_CAPACITY, delay_us);
+}
+
+LEAP_DECODER_API void LeapDecoderDestroy(LeapFrameDecoder* decoder)
+{
+	delete decoder;
+}
+
+LEAP_DECODER_API int32_t LeapDecoderPush(LeapFrameDecoder* decoder, const uint8_t* datagram, int32_t length,
+	int64_t receive_time)
+{
+	if (decoder == nullptr || datagram == nullptr || length <= 0)
+	{
+		return LEAP_DECODER_INVALID;
+	}
+	lock_guard<mutex> lock(decoder->decoder_mutex);
+	DatagramStamp stamp;
+	int32_t result = DecodeDatagram(decoder, (const char*)datagram, (size_t)length, &decoder->decoded_frame, &stamp);
+	if (result != LEAP_DECODER_OK)
+	{
+		return result;
+	}
+	JitterInsertResult insert_result = decoder->jitter_buffer.Insert(stamp, receive_time, decoder->decoded_frame);
+	return insert_result == JitterInsertResult::INSERTED ? LEAP_DECODER_OK :
+		insert_result == JitterInsertResult::DUPLICATE ? LEAP_DECODER_DUPLICATE : LEAP_DECODER_LATE;
+}
+
+LEAP_DECODER_API int32_t LeapDecoderDecode(LeapFrameDecoder* decoder, const uint8_t* datagram, int32_t length,
+	LeapDecodedFrame* frame)
+{
+	if (decoder == nullptr || datagram == nullptr || length <= 0 || frame == nullptr)
+	{
+		return LEAP_DECODER_INVALID;
+	}
+	lock_guard<mutex> lock(decoder->decoder_mutex);
+	DatagramStamp stamp;
+	int32_t result = DecodeDatagram(decoder, (const char*)datagram, (size_t)length, &decoder->decoded_frame, &stamp);
+	if (result == LEAP_DECODER_OK)
+	{
+		CopyDecodedFrame(&decoder->decoded_frame, &stamp, frame);
+	}
+	return result;
+}
+
+LEAP_DECODER_API int32_t LeapDecoderGetFrame(LeapFrameDecoder* decoder, int64_t render_time, LeapDecodedFrame* frame)
+{
+	if (decoder == nullptr || frame == nullptr)
+	{
+		return LEAP_FRAME_NONE;
+	}
+	lock_guard<mutex> lock(decoder->decoder_mutex);
+	DatagramStamp stamp;
+	JitterFindResult result = decoder->jitter_buffer.Find(render_time, decoder->is_interpolating,
+		&decoder->found_frame, &stamp);
+	if (result == JitterFindResult::EMPTY)
+	{
+		return LEAP_FRAME_NONE;
+	}
+	if (result == JitterFindResult::NEWEST)
+	{
+		++decoder->stats.underruns;
+	}
+	CopyDecodedFrame(&decoder->found_frame, &stamp, frame);
+	return result == JitterFindResult::INTERPOLATED ? LEAP_FRAME_INTERPOLATED :
+		result == JitterFindResult::OLDEST ? LEAP_FRAME_OLDEST : LEAP_FRAME_NEWEST;
+}
+
+LEAP_DECODER_API void LeapDecoderSetDelay(LeapFrameDecoder* decoder, int64_t delay_us)
+{
+	if (decoder != nullptr)
+	{
+		lock_guard<mutex> lock(decoder->decoder_mutex);
+		decoder->jitter_buffer.SetDelay(delay_us);
+	}
+}
+
+LEAP_DECODER_API void LeapDecoderSetInterpolation(LeapFrameDecoder* decoder, int32_t is_interpolating)
+{
+	if (decoder != nullptr)
+	{
+		lock_guard<mutex> lock(decoder->decoder_mutex);
+		decoder->is_interpolating = is_interpolating != 0;
+	}
+}
+
+LEAP_DECODER_API void LeapDecoderReset(LeapFrameDecoder* decoder)
+{
+	if (decoder != nullptr)
+	{
+		lock_guard<mutex> lock(decoder->decoder_mutex);
+		decoder->jitter_buffer.Clear();
+		decoder->delta_decoder = DeltaFrameDecoder();
+	}
+}
+
+LEAP_DECODER_API void LeapDecoderGetStats(LeapFrameDecoder* decoder, LeapDecoderStats* stats)
+{
+	if (decoder == nullptr || stats == nullptr)
+	{
+		return;
+	}
+	lock_guard<mutex> lock(decoder->decoder_mutex);
+	*stats = decoder->stats;
+	const JitterBufferStats& buffer_stats = decoder->jitter_buffer.Stats();
+	stats->inserted = buffer_stats.inserted;
+	stats->duplicates = buffer_stats.duplicates;
+	stats->late = buffer_stats.late;
+	stats->reordered = buffer_stats.reordered;
+}
+
+}
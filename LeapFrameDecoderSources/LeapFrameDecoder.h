@@ -0,0 +1,128 @@
+#pragma once
+
+// Plain C interface of the frame decoder library, for use as a native plugin. The decoder turns the datagrams streamed
+// by the Leap Motion client, in any of its encodings, into flat structs owned by the caller, and keeps the last few
+// frames in a jitter buffer from which the frame to render at a given time is picked.
+//
+// All structs only contain 32 and 64 bit integers and floats, so that they are blittable and can be passed to
+// P/Invoke as they are. Times are microseconds in a clock of the caller's choosing, which must be the same for the
+// receive and render times. A decoder may be fed from one thread while frames are taken on another.
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#define LEAP_DECODER_API				__declspec(dllexport)
+#else
+#define LEAP_DECODER_API				__attribute__((visibility("default")))
+#endif
+
+#define LEAP_DECODER_MAX_HANDS			2
+#define LEAP_DECODER_MAX_FINGERS		5
+
+// Results of LeapDecoderPush and LeapDecoderDecode
+#define LEAP_DECODER_OK					0
+#define LEAP_DECODER_DUPLICATE			1
+// The frame arrived after newer frames had already pushed it out of the jitter buffer
+#define LEAP_DECODER_LATE				2
+// A delta was received before its keyframe, the client should be sent "Request keyframe"
+#define LEAP_DECODER_NEED_KEYFRAME		3
+#define LEAP_DECODER_INVALID			-1
+
+// Results of LeapDecoderGetFrame, see JitterFindResult
+#define LEAP_FRAME_NONE					0
+#define LEAP_FRAME_INTERPOLATED			1
+#define LEAP_FRAME_OLDEST				2
+#define LEAP_FRAME_NEWEST				3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LeapDecodedFinger
+{
+	int32_t		type;
+	int32_t		is_extended;
+	float		direction[3];
+	float		tip[3];
+	float		stabilized_tip[3];
+	float		tip_velocity[3];
+} LeapDecodedFinger;
+
+typedef struct LeapDecodedHand
+{
+	float				palm[3];
+	float				stabilized_palm[3];
+	float				palm_normal[3];
+	float				palm_velocity[3];
+	float				palm_to_fingers[3];
+	float				grab_angle;
+	float				pinch_distance;
+	int32_t				forearm_valid;
+	float				wrist[3];
+	float				forearm_direction[3];
+	float				elbow[3];
+	int32_t				finger_count;
+	LeapDecodedFinger	fingers[LEAP_DECODER_MAX_FINGERS];
+} LeapDecodedHand;
+
+/// A frame as streamed. Hands are indexed left then right and only valid if their bit is set in hand_mask; fingers
+/// past finger_count and the forearm of a hand without one are zeros.
+typedef struct LeapDecodedFrame
+{
+	int64_t			frame_id;
+	int64_t			capture_timestamp;
+	int64_t			send_timestamp;
+	uint32_t		sequence;
+	int32_t			hand_mask;
+	LeapDecodedHand	hands[LEAP_DECODER_MAX_HANDS];
+} LeapDecodedFrame;
+
+typedef struct LeapDecoderStats
+{
+	uint64_t	datagrams;
+	uint64_t	invalid;
+	uint64_t	keyframes_needed;
+	uint64_t	inserted;
+	uint64_t	duplicates;
+	uint64_t	late;
+	uint64_t	reordered;
+	// Frames taken while every buffered frame was older than the render time
+	uint64_t	underruns;
+} LeapDecoderStats;
+
+typedef struct LeapFrameDecoder LeapFrameDecoder;
+
+/// Size of LeapDecodedFrame, for the caller to check its own definition against
+LEAP_DECODER_API int32_t LeapDecoderFrameSize(void);
+
+/// Creates a decoder whose jitter buffer holds capacity frames, 0 for the default, and shows each frame delay_us
+/// after its earliest arrival. Returns null if out of memory.
+LEAP_DECODER_API LeapFrameDecoder* LeapDecoderCreate(int32_t capacity, int64_t delay_us);
+
+LEAP_DECODER_API void LeapDecoderDestroy(LeapFrameDecoder* decoder);
+
+/// Decodes a datagram received at receive_time and adds its frame to the jitter buffer
+LEAP_DECODER_API int32_t LeapDecoderPush(LeapFrameDecoder* decoder, const uint8_t* datagram, int32_t length,
+	int64_t receive_time);
+
+/// Decodes a datagram into frame without buffering it. Deltas still update the decoder's keyframe.
+LEAP_DECODER_API int32_t LeapDecoderDecode(LeapFrameDecoder* decoder, const uint8_t* datagram, int32_t length,
+	LeapDecodedFrame* frame);
+
+/// Copies the frame to render at render_time into frame. Returns LEAP_FRAME_NONE, and leaves frame as it is, if no
+/// frame has been pushed.
+LEAP_DECODER_API int32_t LeapDecoderGetFrame(LeapFrameDecoder* decoder, int64_t render_time, LeapDecodedFrame* frame);
+
+LEAP_DECODER_API void LeapDecoderSetDelay(LeapFrameDecoder* decoder, int64_t delay_us);
+
+/// Interpolate between the two frames around the render time, on by default, or take the closer one
+LEAP_DECODER_API void LeapDecoderSetInterpolation(LeapFrameDecoder* decoder, int32_t is_interpolating);
+
+/// Empties the jitter buffer and forgets the keyframe, e.g. when the connection is made again
+LEAP_DECODER_API void LeapDecoderReset(LeapFrameDecoder* decoder);
+
+LEAP_DECODER_API void LeapDecoderGetStats(LeapFrameDecoder* decoder, LeapDecoderStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,454 @@
+// LeapFrameDecoderTest.cpp : Checks the frame decoder library against datagrams made by the client's own encoders.
+//
+// Usage: LeapFrameDecoderTest
+//
+// Frames from MakeSyntheticFrame are encoded and stamped as ConnectionManager sends them, in every encoding, and
+// decoded through the C interface of the library. The binary and JSON encodings of a frame must hold the same values.
+// The jitter buffer is fed reordered, duplicate and late frames and sequence numbers that wrap around. Every failed
+// check is printed and the test exits with an error if there was one.
+
+#include "LeapFrameDecoder.h"
+#include "FrameJitterBuffer.h"
+#include "FrameData.h"
+#include "BinaryFrameEncoding.h"
+#include "DeltaFrameEncoding.h"
+#include "JsonFrameWriter.h"
+#include "SyntheticFrameSource.h"
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Deltas are quantized, so they may be off by up to half of the largest quantum
+#define DELTA_TOLERANCE				VELOCITY_QUANTUM
+// Enough frames for the 16 bit sequence numbers of the delta stream to wrap around, and one lost after the wrap
+#define DELTA_WRAPAROUND_FRAMES		70000
+#define DELTA_LOST_FRAME			65540
+#define TEST_FRAME_INTERVAL_US		10000
+#define TEST_SEND_TIMESTAMP			1234567
+
+int failed_checks = 0;
+
+void Check(bool is_passed, const string& description)
+{
+	if (!is_passed)
+	{
+		cout << "FAILED: " << description << endl;
+		++failed_checks;
+	}
+}
+
+bool IsClose(float a, float b, float tolerance)
+{
+	return fabsf(a - b) <= tolerance;
+}
+
+bool IsClose3(const Float3* a, const float* b, float tolerance)
+{
+	return IsClose(a->x, b[0], tolerance) && IsClose(a->y, b[1], tolerance) && IsClose(a->z, b[2], tolerance);
+}
+
+/// Returns true if the decoded frame holds the frame, every value within tolerance of it
+bool MatchesFrame(const FrameData* expected, const LeapDecodedFrame* decoded, float tolerance)
+{
+	if (decoded->frame_id != expected->id || decoded->capture_timestamp != expected->capture_timestamp ||
+		decoded->hand_mask != expected->hand_mask)
+	{
+		return false;
+	}
+	for (int h = 0; h < MAX_HANDS_PER_FRAME; ++h)
+	{
+		if (!HasHand(expected, h))
+		{
+			continue;
+		}
+		const HandData* hand = &expected->hands[h];
+		const LeapDecodedHand* decoded_hand = &decoded->hands[h];
+		bool is_hand_match = IsClose3(&hand->palm, decoded_hand->palm, tolerance) &&
+			IsClose3(&hand->stabilized_palm, decoded_hand->stabilized_palm, tolerance) &&
+			IsClose3(&hand->palm_normal, decoded_hand->palm_normal, tolerance) &&
+			IsClose3(&hand->palm_velocity, decoded_hand->palm_velocity, tolerance) &&
+			IsClose3(&hand->palm_to_fingers, decoded_hand->palm_to_fingers, tolerance) &&
+			IsClose(hand->grab_angle, decoded_hand->grab_angle, tolerance) &&
+			IsClose(hand->pinch_distance, decoded_hand->pinch_distance, tolerance) &&
+			decoded_hand->forearm_valid == (hand->forearm.is_valid ? 1 : 0) &&
+			IsClose3(&hand->forearm.wrist, decoded_hand->wrist, tolerance) &&
+			IsClose3(&hand->forearm.direction, decoded_hand->forearm_direction, tolerance) &&
+			IsClose3(&hand->forearm.elbow, decoded_hand->elbow, tolerance) &&
+			decoded_hand->finger_count == hand->finger_count;
+		if (!is_hand_match)
+		{
+			return false;
+		}
+		for (int f = 0; f < hand->finger_count; ++f)
+		{
+			const FingerData* finger = &hand->fingers[f];
+			const LeapDecodedFinger* decoded_finger = &decoded_hand->fingers[f];
+			bool is_finger_match = decoded_finger->type == finger->type &&
+				decoded_finger->is_extended == (finger->is_extended ? 1 : 0) &&
+				IsClose3(&finger->direction, decoded_finger->direction, tolerance) &&
+				IsClose3(&finger->tip, decoded_finger->tip, tolerance) &&
+				IsClose3(&finger->stabilized_tip, decoded_finger->stabilized_tip, tolerance) &&
+				IsClose3(&finger->tip_velocity, decoded_finger->tip_velocity, tolerance);
+			if (!is_finger_match)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void MakeTestFrame(int hand_count, int64_t index, FrameData* frame)
+{
+	MakeSyntheticFrame(hand_count, index / SYNTHETIC_FRAME_RATE, frame);
+	frame->id = index + 1;
+}
+
+/// Encodes and stamps frames the way ConnectionManager sends them
+class TestEncoder
+{
+public:
+
+	TestEncoder(int keyframe_interval = DEFAULT_KEYFRAME_INTERVAL) : delta_encoder(keyframe_interval) {}
+
+	vector<uint8_t> EncodeJson(const FrameData* frame, uint32_t sequence)
+	{
+		json_writer.WriteFrame(frame);
+		vector<uint8_t> datagram(json_writer.Data(), json_writer.Data() + json_writer.Size());
+		StampJsonFrame((char*)datagram.data(), datagram.size(), sequence, TEST_SEND_TIMESTAMP);
+		return datagram;
+	}
+
+	vector<uint8_t> EncodeBinary(const FrameData* frame, uint32_t sequence)
+	{
+		size_t length = EncodeBinaryFrame(frame, buffer, sizeof(buffer));
+		StampBinaryFrame(buffer, length, sequence, TEST_SEND_TIMESTAMP);
+		return vector<uint8_t>(buffer, buffer + length);
+	}
+
+	vector<uint8_t> EncodeDelta(const FrameData* frame, uint32_t sequence)
+	{
+		size_t length = delta_encoder.EncodeFrame(frame, buffer, sizeof(buffer));
+		StampDeltaFrame(buffer, length, sequence, TEST_SEND_TIMESTAMP);
+		return vector<uint8_t>(buffer, buffer + length);
+	}
+
+	void RequestKeyframe()
+	{
+		delta_encoder.RequestKeyframe();
+	}
+
+private:
+
+	JsonFrameWriter		json_writer;
+	DeltaFrameEncoder	delta_encoder;
+	char				buffer[DELTA_FRAME_MAX_SIZE];
+};
+
+int32_t Decode(LeapFrameDecoder* decoder, const vector<uint8_t>& datagram, LeapDecodedFrame* frame)
+{
+	return LeapDecoderDecode(decoder, datagram.data(), (int32_t)datagram.size(), frame);
+}
+
+bool IsKeyframe(const vector<uint8_t>& datagram)
+{
+	return datagram.size() > 3 && datagram[3] == DELTA_KIND_KEYFRAME;
+}
+
+/// Decodes the datagram and returns true if it holds the frame with the given sequence
+bool IsRoundTrip(LeapFrameDecoder* decoder, const vector<uint8_t>& datagram, const FrameData* frame, uint32_t sequence,
+	float tolerance)
+{
+	LeapDecodedFrame decoded;
+	return Decode(decoder, datagram, &decoded) == LEAP_DECODER_OK && MatchesFrame(frame, &decoded, tolerance) &&
+		decoded.sequence == sequence && decoded.send_timestamp == TEST_SEND_TIMESTAMP;
+}
+
+void TestRoundTrips()
+{
+	for (int hand_count = 0; hand_count <= MAX_HANDS_PER_FRAME; ++hand_count)
+	{
+		LeapFrameDecoder* decoder = LeapDecoderCreate(0, 0);
+		TestEncoder encoder;
+		int json_failures = 0;
+		int binary_failures = 0;
+		int delta_failures = 0;
+		for (int i = 0; i < 3 * DEFAULT_KEYFRAME_INTERVAL; ++i)
+		{
+			FrameData frame;
+			MakeTestFrame(hand_count, i, &frame);
+			uint32_t sequence = (uint32_t)i;
+			json_failures += !IsRoundTrip(decoder, encoder.EncodeJson(&frame, sequence), &frame, sequence, 0.0f);
+			binary_failures += !IsRoundTrip(decoder, encoder.EncodeBinary(&frame, sequence), &frame, sequence, 0.0f);
+			delta_failures += !IsRoundTrip(decoder, encoder.EncodeDelta(&frame, sequence), &frame, sequence,
+				DELTA_TOLERANCE);
+		}
+		string hands = " with " + to_string(hand_count) + " hands";
+		Check(json_failures == 0, "JSON round trip" + hands + ", " + to_string(json_failures) + " failed");
+		Check(binary_failures == 0, "binary round trip" + hands + ", " + to_string(binary_failures) + " failed");
+		Check(delta_failures == 0, "delta round trip" + hands + ", " + to_string(delta_failures) + " failed");
+		LeapDecoderDestroy(decoder);
+	}
+}
+
+/// Checks that a frame decoded from the binary encoding writes the same JSON as the frame, and that the decoder reads
+/// the same frame from both encodings
+void TestBinaryJsonEquivalence()
+{
+	for (int hand_count = 0; hand_count <= MAX_HANDS_PER_FRAME; ++hand_count)
+	{
+		LeapFrameDecoder* decoder = LeapDecoderCreate(0, 0);
+		TestEncoder encoder;
+		JsonFrameWriter json_writer;
+		int json_failures = 0;
+		int decoder_failures = 0;
+		for (int i = 0; i < 3 * DEFAULT_KEYFRAME_INTERVAL; ++i)
+		{
+			FrameData frame;
+			MakeTestFrame(hand_count, i, &frame);
+			json_writer.WriteFrame(&frame);
+			string json(json_writer.Data(), json_writer.Size());
+
+			vector<uint8_t> binary = encoder.EncodeBinary(&frame, (uint32_t)i);
+			FrameData binary_frame;
+			if (!DecodeBinaryFrame((const char*)binary.data(), binary.size(), &binary_frame))
+			{
+				++json_failures;
+				++decoder_failures;
+				continue;
+			}
+			json_writer.WriteFrame(&binary_frame);
+			json_failures += json != string(json_writer.Data(), json_writer.Size());
+
+			LeapDecodedFrame decoded_json;
+			bool is_json_decoded = Decode(decoder, encoder.EncodeJson(&frame, (uint32_t)i), &decoded_json) ==
+				LEAP_DECODER_OK;
+			decoder_failures += !is_json_decoded || !MatchesFrame(&binary_frame, &decoded_json, 0.0f);
+		}
+		string hands = " with " + to_string(hand_count) + " hands";
+		Check(json_failures == 0, "binary frame writes the JSON of the frame" + hands + ", " +
+			to_string(json_failures) + " failed");
+		Check(decoder_failures == 0, "binary and JSON frames decode to the same frame" + hands + ", " +
+			to_string(decoder_failures) + " failed");
+		LeapDecoderDestroy(decoder);
+	}
+}
+
+void TestLostKeyframe()
+{
+	LeapFrameDecoder* decoder = LeapDecoderCreate(0, 0);
+	TestEncoder encoder;
+	FrameData frame;
+	LeapDecodedFrame decoded;
+
+	// The first keyframe is lost, so the deltas after it cannot be decoded until a new keyframe arrives
+	MakeTestFrame(2, 0, &frame);
+	Check(IsKeyframe(encoder.EncodeDelta(&frame, 0)), "first delta frame is a keyframe");
+	MakeTestFrame(2, 1, &frame);
+	vector<uint8_t> delta = encoder.EncodeDelta(&frame, 1);
+	Check(!IsKeyframe(delta), "second delta frame is a delta");
+	Check(LeapDecoderPush(decoder, delta.data(), (int32_t)delta.size(), 0) == LEAP_DECODER_NEED_KEYFRAME,
+		"delta without its keyframe needs a keyframe");
+	LeapDecoderStats stats;
+	LeapDecoderGetStats(decoder, &stats);
+	Check(stats.keyframes_needed == 1 && stats.inserted == 0, "needed keyframe is counted and nothing is buffered");
+
+	encoder.RequestKeyframe();
+	MakeTestFrame(2, 2, &frame);
+	vector<uint8_t> keyframe = encoder.EncodeDelta(&frame, 2);
+	Check(IsKeyframe(keyframe), "requested keyframe is sent");
+	Check(Decode(decoder, keyframe, &decoded) == LEAP_DECODER_OK && MatchesFrame(&frame, &decoded, 0.0f),
+		"requested keyframe decodes");
+	MakeTestFrame(2, 3, &frame);
+	Check(Decode(decoder, encoder.EncodeDelta(&frame, 3), &decoded) == LEAP_DECODER_OK &&
+		MatchesFrame(&frame, &decoded, DELTA_TOLERANCE), "delta after the requested keyframe decodes");
+
+	// A later keyframe is lost, and the deltas relative to it must not be decoded against the one before
+	encoder.RequestKeyframe();
+	MakeTestFrame(2, 4, &frame);
+	encoder.EncodeDelta(&frame, 4);
+	MakeTestFrame(2, 5, &frame);
+	Check(Decode(decoder, encoder.EncodeDelta(&frame, 5), &decoded) == LEAP_DECODER_NEED_KEYFRAME,
+		"delta relative to a lost later keyframe needs a keyframe");
+	LeapDecoderDestroy(decoder);
+}
+
+void TestDeltaSequenceWraparound()
+{
+	LeapFrameDecoder* decoder = LeapDecoderCreate(0, 0);
+	// Fed the same datagrams but one, to check that the lost one is counted once across the wraparound
+	DeltaFrameDecoder lossy_decoder;
+	TestEncoder encoder;
+	int failures = 0;
+	for (int i = 0; i < DELTA_WRAPAROUND_FRAMES; ++i)
+	{
+		FrameData frame;
+		MakeTestFrame(1, i, &frame);
+		vector<uint8_t> datagram = encoder.EncodeDelta(&frame, (uint32_t)i);
+		LeapDecodedFrame decoded;
+		if (Decode(decoder, datagram, &decoded) != LEAP_DECODER_OK || !MatchesFrame(&frame, &decoded, DELTA_TOLERANCE))
+		{
+			++failures;
+		}
+		if (i != DELTA_LOST_FRAME)
+		{
+			FrameData lossy_frame;
+			lossy_decoder.Decode((const char*)datagram.data(), datagram.size(), &lossy_frame);
+		}
+	}
+	Check(failures == 0, "delta frames decode across the 16 bit sequence wraparound, " + to_string(failures) +
+		" failed");
+	Check(lossy_decoder.LostMessages() == 1, "one lost delta frame is counted once across the sequence wraparound, " +
+		to_string(lossy_decoder.LostMessages()) + " counted");
+	LeapDecoderDestroy(decoder);
+}
+
+DatagramStamp MakeStamp(uint32_t sequence, const FrameData* frame)
+{
+	DatagramStamp stamp = { sequence, TEST_SEND_TIMESTAMP, frame->id, frame->capture_timestamp };
+	return stamp;
+}
+
+/// Frame index captured at index * TEST_FRAME_INTERVAL_US, with one hand
+void MakeBufferFrame(int64_t index, FrameData* frame)
+{
+	MakeTestFrame(1, index, frame);
+	frame->capture_timestamp = index * TEST_FRAME_INTERVAL_US;
+}
+
+/// Inserts the frame with the given index and sequence, received a millisecond after its capture plus extra_delay
+JitterInsertResult InsertBufferFrame(FrameJitterBuffer* buffer, int64_t index, uint32_t sequence,
+	int64_t extra_delay = 0)
+{
+	FrameData frame;
+	MakeBufferFrame(index, &frame);
+	return buffer->Insert(MakeStamp(sequence, &frame), frame.capture_timestamp + 1000 + extra_delay, frame);
+}
+
+/// Sequence of the frame the buffer shows, without interpolation, when the frame with the given index is due
+uint32_t SequenceShownAt(const FrameJitterBuffer& buffer, int64_t index)
+{
+	FrameData frame;
+	DatagramStamp stamp;
+	buffer.Find(index * TEST_FRAME_INTERVAL_US + 1000 + buffer.Delay(), false, &frame, &stamp);
+	return stamp.sequence;
+}
+
+void TestJitterBufferOrder()
+{
+	FrameJitterBuffer buffer(8, 0);
+	Check(InsertBufferFrame(&buffer, 1, 1) == JitterInsertResult::INSERTED, "first frame is inserted");
+	Check(InsertBufferFrame(&buffer, 3, 3) == JitterInsertResult::INSERTED, "frame after a gap is inserted");
+	Check(InsertBufferFrame(&buffer, 2, 2, 15000) == JitterInsertResult::INSERTED, "reordered frame is inserted");
+	Check(buffer.Stats().reordered == 1, "reordered frame is counted");
+	Check(SequenceShownAt(buffer, 1) == 1 && SequenceShownAt(buffer, 2) == 2 && SequenceShownAt(buffer, 3) == 3,
+		"reordered frames are shown in sequence order");
+
+	Check(InsertBufferFrame(&buffer, 2, 2) == JitterInsertResult::DUPLICATE, "duplicate frame is rejected");
+	Check(InsertBufferFrame(&buffer, 3, 3) == JitterInsertResult::DUPLICATE, "duplicate newest frame is rejected");
+	Check(buffer.Stats().duplicates == 2 && buffer.Count() == 3, "duplicates are counted and not buffered");
+}
+
+void TestJitterBufferLate()
+{
+	FrameJitterBuffer buffer(4, 0);
+	for (int i = 1; i <= 6; ++i)
+	{
+		InsertBufferFrame(&buffer, i, (uint32_t)i);
+	}
+	Check(buffer.Count() == 4, "full buffer keeps its capacity");
+	Check(InsertBufferFrame(&buffer, 2, 2, 50000) == JitterInsertResult::LATE, "frame pushed out is late");
+	Check(InsertBufferFrame(&buffer, 1, 1, 60000) == JitterInsertResult::LATE, "frame older than any pushed out is late");
+	Check(buffer.Stats().late == 2 && buffer.Count() == 4, "late frames are counted and not buffered");
+	Check(SequenceShownAt(buffer, 3) == 3, "late frames do not replace buffered ones");
+
+	// A frame missing from a full buffer that would be its oldest is late too, even if nothing newer was pushed out
+	FrameJitterBuffer full_buffer(3, 0);
+	for (int i = 2; i <= 4; ++i)
+	{
+		InsertBufferFrame(&full_buffer, i, (uint32_t)i);
+	}
+	Check(InsertBufferFrame(&full_buffer, 1, 1, 40000) == JitterInsertResult::LATE,
+		"frame older than a full buffer is late");
+}
+
+void TestJitterBufferInterpolation()
+{
+	FrameJitterBuffer buffer(8, 0);
+	FrameData a, b;
+	MakeBufferFrame(10, &a);
+	MakeBufferFrame(11, &b);
+	buffer.Insert(MakeStamp(10, &a), a.capture_timestamp + 1000, a);
+	buffer.Insert(MakeStamp(11, &b), b.capture_timestamp + 1000, b);
+
+	FrameData frame;
+	DatagramStamp stamp;
+	int64_t halfway = a.capture_timestamp + TEST_FRAME_INTERVAL_US / 2 + 1000;
+	JitterFindResult result = buffer.Find(halfway, true, &frame, &stamp);
+	float expected_x = a.hands[0].palm.x + (b.hands[0].palm.x - a.hands[0].palm.x) * 0.5f;
+	Check(result == JitterFindResult::INTERPOLATED && IsClose(frame.hands[0].palm.x, expected_x, 1e-6f) &&
+		frame.capture_timestamp > a.capture_timestamp && frame.capture_timestamp < b.capture_timestamp,
+		"frame halfway between two frames is interpolated");
+
+	result = buffer.Find(halfway + TEST_FRAME_INTERVAL_US / 4, false, &frame, &stamp);
+	Check(result == JitterFindResult::INTERPOLATED && stamp.sequence == 11 &&
+		frame.hands[0].palm.x == b.hands[0].palm.x, "without interpolation the closer frame is shown");
+
+	Check(buffer.Find(a.capture_timestamp, true, &frame, &stamp) == JitterFindResult::OLDEST && stamp.sequence == 10,
+		"before every frame the oldest is shown");
+	Check(buffer.Find(b.capture_timestamp + 50000, true, &frame, &stamp) == JitterFindResult::NEWEST &&
+		stamp.sequence == 11, "after every frame the newest is shown");
+
+	// The same through the C interface, with the delay of the decoder
+	LeapFrameDecoder* decoder = LeapDecoderCreate(0, 20000);
+	TestEncoder encoder;
+	vector<uint8_t> datagram_a = encoder.EncodeBinary(&a, 10);
+	vector<uint8_t> datagram_b = encoder.EncodeBinary(&b, 11);
+	LeapDecoderPush(decoder, datagram_a.data(), (int32_t)datagram_a.size(), a.capture_timestamp + 1000);
+	LeapDecoderPush(decoder, datagram_b.data(), (int32_t)datagram_b.size(), b.capture_timestamp + 1000);
+	LeapDecodedFrame decoded;
+	Check(LeapDecoderGetFrame(decoder, halfway + 20000, &decoded) == LEAP_FRAME_INTERPOLATED &&
+		IsClose(decoded.hands[0].palm[0], expected_x, 1e-6f), "decoder interpolates after its delay");
+	LeapDecoderDestroy(decoder);
+}
+
+void TestJitterBufferSequenceWraparound()
+{
+	FrameJitterBuffer buffer(8, 0);
+	uint32_t first = 0xFFFFFFFEu;
+	Check(InsertBufferFrame(&buffer, 0, first) == JitterInsertResult::INSERTED &&
+		InsertBufferFrame(&buffer, 2, first + 2, 15000) == JitterInsertResult::INSERTED &&
+		InsertBufferFrame(&buffer, 1, first + 1) == JitterInsertResult::INSERTED &&
+		InsertBufferFrame(&buffer, 3, first + 3) == JitterInsertResult::INSERTED,
+		"frames around the sequence wraparound are inserted");
+	Check(SequenceShownAt(buffer, 0) == first && SequenceShownAt(buffer, 1) == first + 1 &&
+		SequenceShownAt(buffer, 2) == 0 && SequenceShownAt(buffer, 3) == 1,
+		"frames around the sequence wraparound are shown in order");
+	Check(InsertBufferFrame(&buffer, 1, first + 1) == JitterInsertResult::DUPLICATE,
+		"duplicate across the sequence wraparound is rejected");
+}
+
+int main()
+{
+	TestRoundTrips();
+	TestBinaryJsonEquivalence();
+	TestLostKeyframe();
+	TestDeltaSequenceWraparound();
+	TestJitterBufferOrder();
+	TestJitterBufferLate();
+	TestJitterBufferInterpolation();
+	TestJitterBufferSequenceWraparound();
+
+	if (failed_checks > 0)
+	{
+		cout << failed_checks << " checks failed" << endl;
+		return EXIT_FAILURE;
+	}
+	cout << "All checks passed" << endl;
+	return EXIT_SUCCESS;
+}
@@ -13,6 +13,12 @@
 #define RETRY_SOCKET_BIND_STRING			"Do you want to retry binding the sockets? (y/n)"
 #define CLOSE_SOCKET_FAIL_STRING			"Error when trying to close socket: "
 #define CONNECT_ERROR_STRING				"Error connecting to Hololens: "
+#define CONTROL_POLL_FAIL_STRING			"Error when waiting for control messages: "
+#define CONTROL_CONNECTION_CLOSED_STRING	"The control connection to the Hololens was closed."
+#define ADD_SUBSCRIBER_STRING				"Do you want to stream to another receiver, e.g. a multicast group? (y/n)"
+#define ENTER_ENCODING_STRING				"Please enter the frame encoding to use: j for JSON, b for binary, d for delta."
+#define ENTER_MAX_RATE_STRING				"Please enter the maximum frame rate, or 0 for every frame."
+#define TOO_MANY_SUBSCRIBERS_STRING			"The maximum number of receivers has been reached."
 #define RETRY_CONNECT_STRING				"Do you wish to retry connecting to the Hololens? (y/n)"
 #define LEAP_RUNNING_MESSAGE_STRING			"Leap Motion is running and ready for calibration\n"
 #define LEAP_RUNNING_MESSAGE_SENT_STRING	"Sent message that Leap is running. Number of bytes sent: "
@@ -20,8 +26,12 @@
 #define SKIP_CALIBRATION_STRING				"Skip calibration"
 #define LEAP_CALIBRATION_SUCCESS_STRING		"Calibration successfull;"
 #define LEAP_CALIBRATION_FAIL_STRING		"Calibration failed"
+#define CALIBRATION_UPLOAD_FAIL_STRING		"Receiving the calibration images failed: "
+#define SKIN_MODEL_LOAD_FAIL_STRING			"Could not read the skin colour model from "
+#define CALIBRATED_FRAMES_STRING			"Calibrated frames"
 #define HOLO_CALIBRATION_SUCCESS_STRING		"Hololens calibration success"
 #define HOLO_CALIBRATION_FAIL_STRING		"Hololens calibration fail. Redo calibration"
 #define PAUSE_STREAMING_STRING				"Pause data streaming"
 #define RESUME_STREAMING_STRING				"Resume data streaming"
-#define END_STREAMING_STRING				"End data streaming"
\ No newline at end of file
+#define END_STREAMING_STRING				"End data streaming"
+#define REQUEST_KEYFRAME_STRING				"Request keyframe"
\ No newline at end of file
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "WorkStealingPool.h"
+
+#include <string.h>
+#include <vector>
+#include "opencv2/core.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Half the width of the window around each pixel, so that the default window is 9x9
+#define AREA_FILTER_DEFAULT_RADIUS			4
+// Pixels whose window has more than this share of skin pixels become skin
+#define AREA_FILTER_DEFAULT_THRESHOLD		0.6f
+// Rows of the strips the integral image is built in are at least this many pixels, so that a strip is worth a task
+#define AREA_FILTER_MIN_STRIP_PIXELS		16384
+
+/// Smooths a skin mask. A pixel whose value differs from any corner of the window around it is set by the share of
+/// skin pixels in the window, clipped to the image; other pixels keep their value. The windows are counted from an
+/// integral image in constant time, with the same result as counting every pixel of them.
+class AreaFilter
+{
+public:
+
+	AreaFilter(int window_radius = AREA_FILTER_DEFAULT_RADIUS, float area_threshold = AREA_FILTER_DEFAULT_THRESHOLD) :
+		radius(window_radius), threshold(area_threshold)
+	{
+		// The share is compared as the float ratio it always was, once per area here rather than once per pixel
+		int max_area = (2 * radius + 1) * (2 * radius + 1);
+		min_skin_areas.resize(max_area + 1, 0);
+		for (int area = 1; area <= max_area; ++area)
+		{
+			int skin_area = 0;
+			while (skin_area <= area && !((float)skin_area / (float)area > threshold))
+			{
+				++skin_area;
+			}
+			min_skin_areas[area] = skin_area;
+		}
+	}
+
+	int WindowRadius() const
+	{
+		return radius;
+	}
+
+	float AreaThreshold() const
+	{
+		return threshold;
+	}
+
+	/// Filters a CV_8U mask of 0 and 255 into filtered, which must not be the mask. The integral image is built in
+	/// integral_image, so that its buffer can be kept for the next mask.
+	void Apply(const Mat& mask, Mat* filtered, Mat* integral_image,
+		WorkStealingPool* pool = &WorkStealingPool::Shared()) const
+	{
+		int rows = mask.rows;
+		int cols = mask.cols;
+		filtered->create(mask.size(), CV_8U);
+		BuildIntegralImage(mask, integral_image, pool);
+
+		int window_radius = radius;
+		const int* min_skin_area = min_skin_areas.data();
+		pool->ParallelForTiles(rows, cols, [&](const ImageTile& tile)
+		{
+			for (int row = tile.row_begin; row < tile.row_end; ++row)
+			{
+				int top = max(row - window_radius, 0);
+				int bottom = min(row + window_radius, rows - 1);
+				int window_rows = bottom - top + 1;
+				const uchar* mask_row = mask.ptr<uchar>(row);
+				const uchar* top_row = mask.ptr<uchar>(top);
+				const uchar* bottom_row = mask.ptr<uchar>(bottom);
+				const int* integral_top = integral_image->ptr<int>(top);
+				const int* integral_bottom = integral_image->ptr<int>(bottom + 1);
+				uchar* filtered_row = filtered->ptr<uchar>(row);
+				for (int col = tile.col_begin; col < tile.col_end; ++col)
+				{
+					int left = max(col - window_radius, 0);
+					int right = min(col + window_radius, cols - 1);
+					uchar value = mask_row[col];
+					bool is_uniform = (value == top_row[left]) & (value == top_row[right]) & (value == bottom_row[right]) &
+						(value == bottom_row[left]);
+					// Counted for every pixel, as on noisy masks choosing the pixels to count costs more than counting
+					int total_area = window_rows * (right - left + 1);
+					int skin_area = integral_bottom[right + 1] - integral_top[right + 1] - integral_bottom[left] +
+						integral_top[left];
+					uchar filtered_value = skin_area >= min_skin_area[total_area] ? 255 : 0;
+					filtered_row[col] = is_uniform ? value : filtered_value;
+				}
+			}
+		});
+	}
+
+	/// Builds the (rows + 1) x (cols + 1) CV_32S integral image of the nonzero pixels of a CV_8U mask, so that
+	/// integral(r, c) is the number of them above row r and left of column c. Each row strip is summed on its own, and
+	/// the sums of the strips above it are added afterwards from the last rows of the strips.
+	static void BuildIntegralImage(const Mat& mask, Mat* integral_image, WorkStealingPool* pool)
+	{
+		int rows = mask.rows;
+		int cols = mask.cols;
+		integral_image->create(rows + 1, cols + 1, CV_32S);
+		memset(integral_image->ptr<int>(0), 0, (cols + 1) * sizeof(int));
+		if (rows == 0)
+		{
+			return;
+		}
+
+		int thread_count = pool->WorkerCount() + 1;
+		int strip_rows = max((rows + thread_count * POOL_TILES_PER_THREAD - 1) / (thread_count * POOL_TILES_PER_THREAD),
+			(AREA_FILTER_MIN_STRIP_PIXELS + cols) / (cols + 1));
+		int strip_count = (rows + strip_rows - 1) / strip_rows;
+
+		// Sums within each strip
+		pool->ParallelForTiles(rows, 1, [&](const ImageTile& strip)
+		{
+			for (int row = strip.row_begin; row < strip.row_end; ++row)
+			{
+				const uchar* mask_row = mask.ptr<uchar>(row);
+				const int* above = integral_image->ptr<int>(row);
+				int* sums = integral_image->ptr<int>(row + 1);
+				bool is_first_row = row == strip.row_begin;
+				int row_sum = 0;
+				sums[0] = 0;
+				for (int col = 0; col < cols; ++col)
+				{
+					row_sum += mask_row[col] != 0;
+					sums[col + 1] = is_first_row ? row_sum : above[col + 1] + row_sum;
+				}
+			}
+		}, strip_rows, 1);
+		if (strip_count == 1)
+		{
+			return;
+		}
+
+		// The last row of each strip gets the sums of the strips above it, one strip after another
+		for (int strip = 1; strip < strip_count; ++strip)
+		{
+			const int* previous_last_row = integral_image->ptr<int>(strip * strip_rows);
+			int* last_row = integral_image->ptr<int>(min((strip + 1) * strip_rows, rows));
+			for (int col = 0; col <= cols; ++col)
+			{
+				last_row[col] += previous_last_row[col];
+			}
+		}
+
+		// Then the other rows of the strip, from the last row of the strip before
+		pool->ParallelForTiles(rows, 1, [&](const ImageTile& strip)
+		{
+			if (strip.row_begin == 0)
+			{
+				return;
+			}
+			const int* carry = integral_image->ptr<int>(strip.row_begin);
+			for (int row = strip.row_begin; row < strip.row_end - 1; ++row)
+			{
+				int* sums = integral_image->ptr<int>(row + 1);
+				for (int col = 0; col <= cols; ++col)
+				{
+					sums[col] += carry[col];
+				}
+			}
+		}, strip_rows, 1);
+	}
+
+private:
+
+	int				radius;
+	float			threshold;
+	// Smallest number of skin pixels in a window of each area for which the pixel becomes skin
+	vector<int>		min_skin_areas;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/// How much a measurement may exceed its baseline value before it is a regression
+struct BaselineTolerance
+{
+	double	relative;
+	double	absolute;
+
+	/// A measurement that is written to the baseline but never checked
+	static BaselineTolerance Unchecked()
+	{
+		return { 0.0, numeric_limits<double>::infinity() };
+	}
+};
+
+/// Measurements of the benchmarks, kept in a file to check later runs against. Each line of the file is the key of
+/// a result followed by its measurements, in the order the benchmark passes them to Check.
+class BenchmarkBaseline
+{
+public:
+
+	/// Reads the baseline from path and writes the results of this run to output_path. Either may be empty.
+	BenchmarkBaseline(const string& path, const string& output_path)
+	{
+		if (!path.empty())
+		{
+			Read(path);
+		}
+		if (!output_path.empty())
+		{
+			output.open(output_path);
+		}
+	}
+
+	/// Writes the measurements of a result to the output baseline and checks them against the baseline. Returns true
+	/// if any measurement exceeds its baseline value by more than its tolerance, which the result for the key in the
+	/// baseline then also has a measurement for.
+	template<size_t Count>
+	bool Check(const string& key, const double (&measurements)[Count], const BaselineTolerance (&tolerances)[Count])
+	{
+		if (output.is_open())
+		{
+			output << key;
+			for (double measurement : measurements)
+			{
+				output << " " << measurement;
+			}
+			output << "\n";
+		}
+
+		auto expected = results.find(key);
+		if (expected == results.end())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < Count && i < expected->second.size(); ++i)
+		{
+			double limit = expected->second[i] * (1.0 + tolerances[i].relative) + tolerances[i].absolute;
+			if (measurements[i] > limit)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+
+	map<string, vector<double>>		results;
+	ofstream						output;
+
+	void Read(const string& path)
+	{
+		ifstream input(path);
+		string line;
+		while (getline(input, line))
+		{
+			istringstream fields(line);
+			string key;
+			if (!(fields >> key))
+			{
+				continue;
+			}
+			vector<double>& measurements = results[key];
+			double measurement;
+			while (fields >> measurement)
+			{
+				measurements.push_back(measurement);
+			}
+		}
+	}
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "FrameData.h"
+#include "DatagramStamp.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Binary frame layout, all values little-endian:
+//
+// Header (32 bytes)
+//   uint8 magic[2]				'L', 'F'
+//   uint8 version				BINARY_FRAME_VERSION
+//   uint8 hand_mask			LEFT_HAND_BIT | RIGHT_HAND_BIT
+//   datagram stamp				see DatagramStamp.h, the send fields are left as zeros by the encoder
+// One hand block (BINARY_HAND_BLOCK_SIZE bytes) per present hand, left hand first
+//   uint8 finger_count
+//   uint8 forearm_valid
+//   uint8 extended_mask		bit i set if finger i is extended
+//   uint8 finger_types[5]
+//   float palm[3], stabilized_palm[3], palm_normal[3], palm_velocity[3], palm_to_fingers[3]
+//   float grab_angle, pinch_distance
+//   float wrist[3], forearm_direction[3], elbow[3]
+//   5 x finger: float direction[3], tip[3], stabilized_tip[3], tip_velocity[3]
+//
+// Finger slots past finger_count and the forearm of an invalid arm are written as zeros so that every hand block has
+// the same size and every field sits at a fixed offset.
+
+#define BINARY_FRAME_MAGIC_0			'L'
+#define BINARY_FRAME_MAGIC_1			'F'
+#define BINARY_FRAME_VERSION			2
+#define BINARY_FRAME_STAMP_OFFSET		4
+#define BINARY_FRAME_HEADER_SIZE		(BINARY_FRAME_STAMP_OFFSET + DATAGRAM_STAMP_SIZE)
+#define BINARY_HAND_HEADER_SIZE			8
+#define BINARY_HAND_FLOAT_COUNT			17
+#define BINARY_FOREARM_FLOAT_COUNT		9
+#define BINARY_FINGER_FLOAT_COUNT		12
+#define BINARY_HAND_BLOCK_SIZE			(BINARY_HAND_HEADER_SIZE + \
+										(BINARY_HAND_FLOAT_COUNT + BINARY_FOREARM_FLOAT_COUNT + \
+										MAX_FINGERS_PER_HAND * BINARY_FINGER_FLOAT_COUNT) * sizeof(float))
+#define BINARY_FRAME_MAX_SIZE			(BINARY_FRAME_HEADER_SIZE + MAX_HANDS_PER_FRAME * BINARY_HAND_BLOCK_SIZE)
+
+/// Returns the encoded size of a frame with the given hand presence mask
+inline size_t BinaryFrameSize(uint8_t hand_mask)
+{
+	size_t hand_count = ((hand_mask & LEFT_HAND_BIT) ? 1 : 0) + ((hand_mask & RIGHT_HAND_BIT) ? 1 : 0);
+	return BINARY_FRAME_HEADER_SIZE + hand_count * BINARY_HAND_BLOCK_SIZE;
+}
+
+inline void WriteBinaryFloat(char** cursor, float value)
+{
+	memcpy(*cursor, &value, sizeof(float));
+	*cursor += sizeof(float);
+}
+
+inline void WriteBinaryFloat3(char** cursor, const Float3* value)
+{
+	WriteBinaryFloat(cursor, value->x);
+	WriteBinaryFloat(cursor, value->y);
+	WriteBinaryFloat(cursor, value->z);
+}
+
+inline float ReadBinaryFloat(const char** cursor)
+{
+	float value;
+	memcpy(&value, *cursor, sizeof(float));
+	*cursor += sizeof(float);
+	return value;
+}
+
+inline void ReadBinaryFloat3(const char** cursor, Float3* value)
+{
+	value->x = ReadBinaryFloat(cursor);
+	value->y = ReadBinaryFloat(cursor);
+	value->z = ReadBinaryFloat(cursor);
+}
+
+/// Writes a single hand block to the cursor and advances it by BINARY_HAND_BLOCK_SIZE
+inline void EncodeBinaryHand(const HandData* hand, char** cursor)
+{
+	const Float3 zero = { 0.0f, 0.0f, 0.0f };
+	int finger_count = hand->finger_count < MAX_FINGERS_PER_HAND ? hand->finger_count : MAX_FINGERS_PER_HAND;
+
+	// Hand header
+	uint8_t extended_mask = 0;
+	for (int i = 0; i < finger_count; ++i)
+	{
+		if (hand->fingers[i].is_extended)
+		{
+			extended_mask |= (uint8_t)(1 << i);
+		}
+	}
+	char* header = *cursor;
+	header[0] = (char)finger_count;
+	header[1] = (char)(hand->forearm.is_valid ? 1 : 0);
+	header[2] = (char)extended_mask;
+	for (int i = 0; i < MAX_FINGERS_PER_HAND; ++i)
+	{
+		header[3 + i] = (char)(i < finger_count ? hand->fingers[i].type : 0);
+	}
+	*cursor += BINARY_HAND_HEADER_SIZE;
+
+	// Palm
+	WriteBinaryFloat3(cursor, &hand->palm);
+	WriteBinaryFloat3(cursor, &hand->stabilized_palm);
+	WriteBinaryFloat3(cursor, &hand->palm_normal);
+	WriteBinaryFloat3(cursor, &hand->palm_velocity);
+	WriteBinaryFloat3(cursor, &hand->palm_to_fingers);
+	WriteBinaryFloat(cursor, hand->grab_angle);
+	WriteBinaryFloat(cursor, hand->pinch_distance);
+
+	// Forearm
+	bool forearm_valid = hand->forearm.is_valid;
+	WriteBinaryFloat3(cursor, forearm_valid ? &hand->forearm.wrist : &zero);
+	WriteBinaryFloat3(cursor, forearm_valid ? &hand->forearm.direction : &zero);
+	WriteBinaryFloat3(cursor, forearm_valid ? &hand->forearm.elbow : &zero);
+
+	// Fingers
+	for (int i = 0; i < MAX_FINGERS_PER_HAND; ++i)
+	{
+		const FingerData* finger = &hand->fingers[i];
+		bool finger_valid = i < finger_count;
+		WriteBinaryFloat3(cursor, finger_valid ? &finger->direction : &zero);
+		WriteBinaryFloat3(cursor, finger_valid ? &finger->tip : &zero);
+		WriteBinaryFloat3(cursor, finger_valid ? &finger->stabilized_tip : &zero);
+		WriteBinaryFloat3(cursor, finger_valid ? &finger->tip_velocity : &zero);
+	}
+}
+
+/// Reads a single hand block from the cursor and advances it by BINARY_HAND_BLOCK_SIZE
+inline bool DecodeBinaryHand(const char** cursor, HandData* hand)
+{
+	const char* header = *cursor;
+	int finger_count = (uint8_t)header[0];
+	if (finger_count > MAX_FINGERS_PER_HAND)
+	{
+		return false;
+	}
+	hand->finger_count = finger_count;
+	hand->forearm.is_valid = header[1] != 0;
+	uint8_t extended_mask = (uint8_t)header[2];
+	for (int i = 0; i < MAX_FINGERS_PER_HAND; ++i)
+	{
+		hand->fingers[i].type = (uint8_t)header[3 + i];
+		hand->fingers[i].is_extended = (extended_mask & (1 << i)) != 0;
+	}
+	*cursor += BINARY_HAND_HEADER_SIZE;
+
+	ReadBinaryFloat3(cursor, &hand->palm);
+	ReadBinaryFloat3(cursor, &hand->stabilized_palm);
+	ReadBinaryFloat3(cursor, &hand->palm_normal);
+	ReadBinaryFloat3(cursor, &hand->palm_velocity);
+	ReadBinaryFloat3(cursor, &hand->palm_to_fingers);
+	hand->grab_angle = ReadBinaryFloat(cursor);
+	hand->pinch_distance = ReadBinaryFloat(cursor);
+
+	ReadBinaryFloat3(cursor, &hand->forearm.wrist);
+	ReadBinaryFloat3(cursor, &hand->forearm.direction);
+	ReadBinaryFloat3(cursor, &hand->forearm.elbow);
+
+	for (int i = 0; i < MAX_FINGERS_PER_HAND; ++i)
+	{
+		FingerData* finger = &hand->fingers[i];
+		ReadBinaryFloat3(cursor, &finger->direction);
+		ReadBinaryFloat3(cursor, &finger->tip);
+		ReadBinaryFloat3(cursor, &finger->stabilized_tip);
+		ReadBinaryFloat3(cursor, &finger->tip_velocity);
+	}
+
+	return true;
+}
+
+/// Encodes the frame into the given buffer. Returns the number of bytes written, or 0 if the buffer is too small.
+inline size_t EncodeBinaryFrame(const FrameData* frame, char* buffer, size_t buffer_length)
+{
+	uint8_t hand_mask = frame->hand_mask & (LEFT_HAND_BIT | RIGHT_HAND_BIT);
+	size_t frame_size = BinaryFrameSize(hand_mask);
+	if (buffer_length < frame_size)
+	{
+		return 0;
+	}
+
+	buffer[0] = BINARY_FRAME_MAGIC_0;
+	buffer[1] = BINARY_FRAME_MAGIC_1;
+	buffer[2] = (char)BINARY_FRAME_VERSION;
+	buffer[3] = (char)hand_mask;
+	DatagramStamp stamp = { 0, 0, frame->id, frame->capture_timestamp };
+	WriteDatagramStamp(buffer + BINARY_FRAME_STAMP_OFFSET, &stamp);
+
+	char* cursor = buffer + BINARY_FRAME_HEADER_SIZE;
+	for (int i = 0; i < MAX_HANDS_PER_FRAME; ++i)
+	{
+		if (HasHand(frame, i))
+		{
+			EncodeBinaryHand(&frame->hands[i], &cursor);
+		}
+	}
+
+	return frame_size;
+}
+
+/// Returns true if the buffer starts with a binary frame header of a supported version
+inline bool IsBinaryFrame(const char* buffer, size_t length)
+{
+	return length >= BINARY_FRAME_HEADER_SIZE &&
+		buffer[0] == BINARY_FRAME_MAGIC_0 &&
+		buffer[1] == BINARY_FRAME_MAGIC_1 &&
+		(uint8_t)buffer[2] == BINARY_FRAME_VERSION;
+}
+
+/// Decodes a frame written by EncodeBinaryFrame. Returns false if the data is not a complete binary frame.
+inline bool DecodeBinaryFrame(const char* buffer, size_t length, FrameData* frame)
+{
+	if (!IsBinaryFrame(buffer, length))
+	{
+		return false;
+	}
+
+	uint8_t hand_mask = (uint8_t)buffer[3];
+	if ((hand_mask & ~(LEFT_HAND_BIT | RIGHT_HAND_BIT)) != 0 || length < BinaryFrameSize(hand_mask))
+	{
+		return false;
+	}
+
+	DatagramStamp stamp;
+	ReadDatagramStamp(buffer + BINARY_FRAME_STAMP_OFFSET, &stamp);
+	frame->id = stamp.frame_id;
+	frame->capture_timestamp = stamp.capture_timestamp;
+	frame->hand_mask = hand_mask;
+	const char* cursor = buffer + BINARY_FRAME_HEADER_SIZE;
+	for (int i = 0; i < MAX_HANDS_PER_FRAME; ++i)
+	{
+		if (HasHand(frame, i) && !DecodeBinaryHand(&cursor, &frame->hands[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/// Fills in the send fields of an encoded binary frame
+inline void StampBinaryFrame(char* buffer, size_t length, uint32_t sequence, int64_t send_timestamp)
+{
+	if (length >= BINARY_FRAME_HEADER_SIZE)
+	{
+		WriteDatagramSendStamp(buffer + BINARY_FRAME_STAMP_OFFSET, sequence, send_timestamp);
+	}
+}
+
+/// Reads the stamp of an encoded binary frame
+inline bool ReadBinaryFrameStamp(const char* buffer, size_t length, DatagramStamp* stamp)
+{
+	if (!IsBinaryFrame(buffer, length))
+	{
+		return false;
+	}
+	ReadDatagramStamp(buffer + BINARY_FRAME_STAMP_OFFSET, stamp);
+	return true;
+}
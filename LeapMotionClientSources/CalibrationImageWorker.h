@@ -0,0 +1,240 @@
+#pragma once
+
+#include "CalibrationProtocol.h"
+#include "DetectorWorkspace.h"
+#include "opencv2\core.hpp"
+#include "opencv2\imgcodecs.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+#define CALIBRATION_MAX_WORKER_THREADS	4
+
+/// One worker per core, up to CALIBRATION_MAX_WORKER_THREADS since an upload is only a handful of images
+inline int DefaultCalibrationWorkerCount()
+{
+	int core_count = (int)thread::hardware_concurrency();
+	return core_count < 1 ? 1 : (core_count < CALIBRATION_MAX_WORKER_THREADS ? core_count : CALIBRATION_MAX_WORKER_THREADS);
+}
+
+/// One calibration image on its way from the socket to the worker
+struct CalibrationImageSlot
+{
+	// Position of the image in the upload
+	int					index;
+	// Received payload of a compressed image
+	vector<uchar>		encoded;
+	// Decoded image, or the received pixels of a raw image
+	Mat					image;
+};
+
+/// Decodes and processes calibration images on a pool of worker threads, so that an image is worked on as soon as it
+/// has been received while the next ones are still being uploaded. Images are handed over in slots whose buffers are
+/// kept from one image, and one upload, to the next. The receiving thread never waits for the workers: when every
+/// slot is in use another one is added, so that the socket is read as soon as each image arrives. Each worker keeps
+/// its own DetectorWorkspace.
+class CalibrationImageWorker
+{
+public:
+
+	/// process_image is called on the worker threads with every decoded image and the workspace of the worker. Images
+	/// are processed concurrently and in no particular order, so results should be stored by slot->index.
+	CalibrationImageWorker(function<void(CalibrationImageSlot*, DetectorWorkspace*)> process_image,
+		int worker_count = DefaultCalibrationWorkerCount()) :
+		worker_workspaces(worker_count)
+	{
+		process = process_image;
+		worker_threads.resize(worker_count);
+		for (int i = 0; i <= worker_count; ++i)
+		{
+			slots.emplace_back(new CalibrationImageSlot());
+		}
+	}
+
+	~CalibrationImageWorker()
+	{
+		Finish();
+	}
+
+	/// Starts the worker for an upload described by the given header
+	void Start(const CalibrationHeader* header)
+	{
+		image_format = header->image_format;
+		image_width = header->width;
+		image_height = header->height;
+		has_failed = false;
+		decode_ns = 0;
+		process_ns = 0;
+		free_slots.clear();
+		queued_slots.clear();
+		for (unique_ptr<CalibrationImageSlot>& slot : slots)
+		{
+			PrepareSlot(slot.get());
+			free_slots.push_back(slot.get());
+		}
+		is_running = true;
+		for (size_t i = 0; i < worker_threads.size(); ++i)
+		{
+			worker_threads[i] = thread(&CalibrationImageWorker::Run, this, &worker_workspaces[i]);
+		}
+	}
+
+	/// Returns a free slot to receive the next image into, without waiting for the workers. For raw images the pixels
+	/// go to slot->image, which already has the right size; compressed images go to slot->encoded.
+	CalibrationImageSlot* AcquireSlot()
+	{
+		{
+			lock_guard<mutex> lock(worker_mutex);
+			if (!free_slots.empty())
+			{
+				CalibrationImageSlot* slot = free_slots.front();
+				free_slots.pop_front();
+				return slot;
+			}
+		}
+		// Only the receiving thread adds slots, and the workers only touch the slots they were handed
+		slots.emplace_back(new CalibrationImageSlot());
+		CalibrationImageSlot* slot = slots.back().get();
+		PrepareSlot(slot);
+		return slot;
+	}
+
+	/// Hands a received image over to the worker
+	void Submit(CalibrationImageSlot* slot)
+	{
+		{
+			lock_guard<mutex> lock(worker_mutex);
+			queued_slots.push_back(slot);
+		}
+		worker_condition.notify_one();
+	}
+
+	/// Waits until every submitted image has been processed and stops the worker. Returns false if an image could not
+	/// be decoded.
+	bool Finish()
+	{
+		{
+			lock_guard<mutex> lock(worker_mutex);
+			if (!is_running)
+			{
+				return !has_failed;
+			}
+			is_running = false;
+		}
+		worker_condition.notify_all();
+		for (thread& worker_thread : worker_threads)
+		{
+			worker_thread.join();
+		}
+		return !has_failed;
+	}
+
+	int WorkerCount() const
+	{
+		return (int)worker_threads.size();
+	}
+
+	/// Total time spent decoding the images of the last upload, summed over the workers
+	double DecodeMilliseconds() const
+	{
+		return decode_ns / 1e6;
+	}
+
+	/// Total time spent processing the images of the last upload, summed over the workers
+	double ProcessMilliseconds() const
+	{
+		return process_ns / 1e6;
+	}
+
+private:
+
+	function<void(CalibrationImageSlot*, DetectorWorkspace*)>	process;
+	vector<unique_ptr<CalibrationImageSlot>>	slots;
+	deque<CalibrationImageSlot*>			free_slots;
+	deque<CalibrationImageSlot*>			queued_slots;
+	mutex									worker_mutex;
+	condition_variable						worker_condition;
+	vector<thread>							worker_threads;
+	// Buffers the hand and fingertip detectors work in, one per worker
+	vector<DetectorWorkspace>				worker_workspaces;
+	bool									is_running		= false;
+	bool									has_failed		= false;
+	int32_t									image_format	= CALIBRATION_FORMAT_RAW_BGR;
+	int										image_width		= 0;
+	int										image_height	= 0;
+	int64_t									decode_ns		= 0;
+	int64_t									process_ns		= 0;
+
+	void PrepareSlot(CalibrationImageSlot* slot)
+	{
+		if (image_format == CALIBRATION_FORMAT_RAW_BGR)
+		{
+			slot->image.create(image_height, image_width, CV_8UC3);
+		}
+	}
+
+	void Run(DetectorWorkspace* workspace)
+	{
+		unique_lock<mutex> lock(worker_mutex);
+		while (true)
+		{
+			// Images queued before Finish are still processed
+			worker_condition.wait(lock, [this] { return !queued_slots.empty() || !is_running; });
+			if (queued_slots.empty())
+			{
+				break;
+			}
+			CalibrationImageSlot* slot = queued_slots.front();
+			queued_slots.pop_front();
+			bool is_failed = has_failed;
+			lock.unlock();
+
+			// Once one image is lost the fingertips no longer pair up, so the rest are only returned
+			int64_t slot_decode_ns = 0;
+			int64_t slot_process_ns = 0;
+			if (!is_failed)
+			{
+				auto start_time = chrono::steady_clock::now();
+				is_failed = !Decode(slot);
+				auto decoded_time = chrono::steady_clock::now();
+				if (!is_failed)
+				{
+					process(slot, workspace);
+				}
+				slot_decode_ns = chrono::duration_cast<chrono::nanoseconds>(decoded_time - start_time).count();
+				slot_process_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - decoded_time).count();
+			}
+
+			lock.lock();
+			has_failed = has_failed || is_failed;
+			decode_ns += slot_decode_ns;
+			process_ns += slot_process_ns;
+			free_slots.push_back(slot);
+		}
+	}
+
+	bool Decode(CalibrationImageSlot* slot)
+	{
+		if (image_format == CALIBRATION_FORMAT_RAW_BGR)
+		{
+			return true;
+		}
+		if (slot->encoded.empty())
+		{
+			return false;
+		}
+		// Decoding into the slot's Mat reuses its memory when the size stays the same
+		Mat encoded(1, (int)slot->encoded.size(), CV_8UC1, slot->encoded.data());
+		imdecode(encoded, IMREAD_COLOR, &slot->image);
+		return slot->image.cols == image_width && slot->image.rows == image_height && slot->image.type() == CV_8UC3;
+	}
+};
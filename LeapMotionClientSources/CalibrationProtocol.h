@@ -0,0 +1,90 @@
+#pragma once
+
+#include "DatagramStamp.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// After "Do calibration" the Hololens uploads the calibration images over the TCP connection as framed messages, all
+// values little-endian:
+//
+// Message
+//   uint32 length				bytes that follow the length field, i.e. the type and the payload
+//   uint8 type					CALIBRATION_MESSAGE_HEADER or CALIBRATION_MESSAGE_IMAGE
+//   payload					length - 1 bytes
+// Header payload, sent once before the images (CALIBRATION_HEADER_PAYLOAD_SIZE bytes)
+//   float fx, fy, cx, cy		camera intrinsics in pixels
+//   int32 width, height		image size in pixels
+//   int32 image_count			number of image messages that follow
+//   int32 image_size			bytes of each decoded image, width * height * 3
+//   int32 image_format			CALIBRATION_FORMAT_RAW_BGR, CALIBRATION_FORMAT_JPEG or CALIBRATION_FORMAT_PNG
+// Image payload
+//   int64 capture_age			microseconds from the capture of the image to sending this message, in the Hololens
+//								clock. The clocks of the two devices are not synchronized, so the client takes the
+//								capture time to be the arrival of the message minus this age.
+//   image						RAW_BGR: BGR pixels, rows top to bottom with no padding, so that it can be received
+//								straight into a CV_8UC3 Mat. JPEG, PNG: the encoded file, of at most
+//								CALIBRATION_MAX_ENCODED_SIZE(image_size) bytes.
+//
+// The Hololens picks the format. A client that does not know the format fails the upload.
+
+#define CALIBRATION_MESSAGE_HEADER			1
+#define CALIBRATION_MESSAGE_IMAGE			2
+#define CALIBRATION_FRAME_HEADER_SIZE		5
+#define CALIBRATION_HEADER_PAYLOAD_SIZE		36
+#define CALIBRATION_IMAGE_PREFIX_SIZE		8
+#define CALIBRATION_FORMAT_RAW_BGR			0
+#define CALIBRATION_FORMAT_JPEG				1
+#define CALIBRATION_FORMAT_PNG				2
+// PNG of noisy camera images can come out slightly larger than the raw pixels
+#define CALIBRATION_MAX_ENCODED_SIZE(image_size)	((image_size) + (image_size) / 8 + 4096)
+// Larger than any Hololens camera image, so that a corrupt header cannot make the client allocate gigabytes
+#define CALIBRATION_MAX_IMAGE_SIDE			4096
+#define CALIBRATION_MAX_IMAGE_COUNT			256
+
+struct CalibrationHeader
+{
+	float	fx;
+	float	fy;
+	float	cx;
+	float	cy;
+	int32_t	width;
+	int32_t	height;
+	int32_t	image_count;
+	int32_t	image_size;
+	int32_t	image_format;
+};
+
+/// Reads the length and type of a message from its first CALIBRATION_FRAME_HEADER_SIZE bytes. Returns false if the
+/// message has no type.
+inline bool ReadCalibrationFrameHeader(const char* source, uint8_t* type, uint32_t* payload_length)
+{
+	uint32_t length = ReadStampUInt32(source);
+	if (length < 1)
+	{
+		return false;
+	}
+	*type = (uint8_t)source[4];
+	*payload_length = length - 1;
+	return true;
+}
+
+/// Reads a header payload. Returns false if the values do not describe a valid upload.
+inline bool ReadCalibrationHeader(const char* source, CalibrationHeader* header)
+{
+	memcpy(&header->fx, source, sizeof(float));
+	memcpy(&header->fy, source + 4, sizeof(float));
+	memcpy(&header->cx, source + 8, sizeof(float));
+	memcpy(&header->cy, source + 12, sizeof(float));
+	header->width = (int32_t)ReadStampUInt32(source + 16);
+	header->height = (int32_t)ReadStampUInt32(source + 20);
+	header->image_count = (int32_t)ReadStampUInt32(source + 24);
+	header->image_size = (int32_t)ReadStampUInt32(source + 28);
+	header->image_format = (int32_t)ReadStampUInt32(source + 32);
+
+	return header->width > 0 && header->width <= CALIBRATION_MAX_IMAGE_SIDE &&
+		header->height > 0 && header->height <= CALIBRATION_MAX_IMAGE_SIDE &&
+		header->image_count > 0 && header->image_count <= CALIBRATION_MAX_IMAGE_COUNT &&
+		header->width * header->height * 3 == header->image_size &&
+		header->image_format >= CALIBRATION_FORMAT_RAW_BGR && header->image_format <= CALIBRATION_FORMAT_PNG;
+}
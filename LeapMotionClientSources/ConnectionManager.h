@@ -3,6 +3,15 @@
 #include "Leap.h"
 #include "Utils.h"
 #include "AppMessages.h"
+#include "BinaryFrameEncoding.h"
+#include "DeltaFrameEncoding.h"
+#include "JsonFrameWriter.h"
+#include "FrameSubscribers.h"
+#include "StreamMetrics.h"
+#include "StreamSession.h"
+#include "ControlMessageFramer.h"
+#include "CalibrationImageWorker.h"
+#include "FrameHistory.h"
 #include "HandDetector.h"
 #include "FingertipDetector.h"
 #include "opencv2\core.hpp"
@@ -10,8 +19,10 @@
 
 #include <WinSock2.h>
 #include <Ws2tcpip.h>
+#include <algorithm>
 #include <iostream>
 #include <stdio.h>
+#include <limits.h>
 
 using namespace std;
 using namespace cv;
@@ -21,14 +32,47 @@ using namespace cv;
 #define HOLO_TCP_PORT						6000
 #define HOLO_UDP_PORT						6001
 #define RECEIVE_BUFFER_LENGTH				1024
+#define SEND_BUFFER_LENGTH					16384
+#define KEYFRAME_INTERVAL					DEFAULT_KEYFRAME_INTERVAL
+#define MULTICAST_TTL						1
+#define CALIBRATION_SOCKET_BUFFER_SIZE		(4 * 1024 * 1024)
 
 string finger_names[] = { "Thumb", "Index", "Middle", "Ring", "Pinky" };
 
+/// A frame encoded once in every encoding used by some subscriber. The encodings are packed one after the other.
+struct EncodedFrame
+{
+	size_t	offset[FRAME_ENCODING_COUNT];
+	size_t	length[FRAME_ENCODING_COUNT];
+	// Bytes of data in use
+	size_t	size;
+	char	data[SEND_BUFFER_LENGTH];
+};
+
+/// Copies a frame popped from the streaming pipeline. Only the used bytes are copied, a few hundred for most frames
+/// instead of the whole buffer. The slot may be overwritten while it is copied, in which case the ring discards the
+/// copy, so the size read from it is clamped to the buffer.
+inline void CopyRingItem(const EncodedFrame& from, EncodedFrame* to)
+{
+	memcpy(to->offset, from.offset, sizeof(from.offset));
+	memcpy(to->length, from.length, sizeof(from.length));
+	to->size = min(from.size, (size_t)SEND_BUFFER_LENGTH);
+	memcpy(to->data, from.data, to->size);
+}
+
 class ConnectionManager
 {
 public:
 	
-	ConnectionManager(Controller* lc)
+	ConnectionManager(Controller* lc) :
+		calibration_worker([this](CalibrationImageSlot* slot, DetectorWorkspace* workspace)
+		{
+			ProcessCalibrationImage(slot, workspace);
+		}),
+		delta_encoder(KEYFRAME_INTERVAL),
+		control_framer({ DO_CALIBRATION_STRING, SKIP_CALIBRATION_STRING, HOLO_CALIBRATION_SUCCESS_STRING,
+			HOLO_CALIBRATION_FAIL_STRING, PAUSE_STREAMING_STRING, RESUME_STREAMING_STRING, END_STREAMING_STRING,
+			REQUEST_KEYFRAME_STRING })
 	{
 		leap_controller = lc;
 		DoWSAStartup();
@@ -46,7 +90,8 @@ public:
 		{
 			int tcp_result = closesocket(tcp_socket);
 			int udp_result = closesocket(udp_socket);
-			if (tcp_result == SOCKET_ERROR || udp_result == SOCKET_ERROR)
+			int wake_result = closesocket(wake_socket);
+			if (tcp_result == SOCKET_ERROR || udp_result == SOCKET_ERROR || wake_result == SOCKET_ERROR)
 			{
 				cout << CLOSE_SOCKET_FAIL_STRING << WSAGetLastError() << endl;
 			}
@@ -73,7 +118,8 @@ public:
 	{
 		tcp_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 		udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-		if (tcp_socket == INVALID_SOCKET || udp_socket == INVALID_SOCKET)
+		wake_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (tcp_socket == INVALID_SOCKET || udp_socket == INVALID_SOCKET || wake_socket == INVALID_SOCKET)
 		{
 			cout << SOCKET_CREATION_FAIL_STRING << WSAGetLastError() << endl;
 			if (DoRetryBasedOnInput(RETRY_SOCKET_CREATION_STRING))
@@ -88,11 +134,18 @@ public:
 		}
 	}
 
-	/// Bind the local addresses to sockets. If binding fails the user can choose to retry.
+	/// Bind the local addresses to sockets. If binding fails the user can choose to retry. The wake socket gets any free
+	/// loopback port.
 	void BindSockets()
 	{
+		wake_sockaddr.sin_family = AF_INET;
+		wake_sockaddr.sin_port = 0;
+		wake_sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int wake_sockaddr_length = sizeof(wake_sockaddr);
 		if (::bind(tcp_socket, (sockaddr*)&local_tcp_sockaddr, sizeof(local_tcp_sockaddr)) == SOCKET_ERROR || 
-			::bind(udp_socket, (sockaddr*)&local_udp_sockaddr, sizeof(local_udp_sockaddr)) == SOCKET_ERROR)
+			::bind(udp_socket, (sockaddr*)&local_udp_sockaddr, sizeof(local_udp_sockaddr)) == SOCKET_ERROR ||
+			::bind(wake_socket, (sockaddr*)&wake_sockaddr, sizeof(wake_sockaddr)) == SOCKET_ERROR ||
+			getsockname(wake_socket, (sockaddr*)&wake_sockaddr, &wake_sockaddr_length) == SOCKET_ERROR)
 		{
 			cout << BIND_SOCKET_FAIL_STRING << WSAGetLastError() << endl;
 			if (DoRetryBasedOnInput(RETRY_SOCKET_BIND_STRING))
@@ -107,11 +160,11 @@ public:
 		}
 	}
 
-	/// Tries to establish connection to Hololens. If it fails the user can choose to retry.
+	/// Tries to establish connection to Hololens. If it fails the user can choose to retry. The UDP socket is left
+	/// unconnected so that it can send to every subscriber; the Hololens becomes the first one.
 	void ConnectToHololens()
 	{
-		if (connect(tcp_socket, (sockaddr*)&holo_tcp_sockaddr, sizeof(holo_tcp_sockaddr)) == SOCKET_ERROR || 
-			connect(udp_socket, (sockaddr*)&holo_udp_sockaddr, sizeof(holo_udp_sockaddr)) == SOCKET_ERROR)
+		if (connect(tcp_socket, (sockaddr*)&holo_tcp_sockaddr, sizeof(holo_tcp_sockaddr)) == SOCKET_ERROR)
 		{
 			cout << CONNECT_ERROR_STRING << WSAGetLastError() << endl;
 			if (DoRetryBasedOnInput(RETRY_CONNECT_STRING))
@@ -123,6 +176,77 @@ public:
 				DoCleanup(true);
 				exit(EXIT_FAILURE);
 			}
+			return;
+		}
+
+		AddSubscriber(holo_udp_sockaddr, frame_encoding, 0.0);
+	}
+
+	/// Lets the user add more receivers of the frame stream, e.g. other headsets or a desktop observer
+	void ConfigureSubscribers()
+	{
+		while (DoRetryBasedOnInput(ADD_SUBSCRIBER_STRING))
+		{
+			sockaddr_in address = {};
+			address.sin_family = AF_INET;
+			cout << ENTER_IP_STRING << endl;
+			string ip = GetInputString();
+			if (inet_pton(AF_INET, ip.c_str(), &address.sin_addr) != 1)
+			{
+				cout << INVALID_INPUT_STRING << endl;
+				continue;
+			}
+			cout << ENTER_PORT_STRING << endl;
+			address.sin_port = htons((u_short)GetInputInteger());
+
+			cout << ENTER_ENCODING_STRING << endl;
+			char encoding_choice = GetInputCharAsLowerCase();
+			FrameEncoding encoding = encoding_choice == 'b' ? FrameEncoding::BINARY :
+				encoding_choice == 'd' ? FrameEncoding::DELTA : FrameEncoding::JSON;
+
+			cout << ENTER_MAX_RATE_STRING << endl;
+			int max_rate = GetInputInteger();
+
+			if (AddSubscriber(address, encoding, max_rate > 0 ? (double)max_rate : 0.0) < 0)
+			{
+				cout << TOO_MANY_SUBSCRIBERS_STRING << endl;
+				return;
+			}
+			cout << endl;
+		}
+	}
+
+	/// Adds a receiver of the frame stream. Returns its id, or -1 if there are too many subscribers.
+	int AddSubscriber(const sockaddr_in& address, FrameEncoding encoding, double max_rate)
+	{
+		if (IsMulticastAddress(&address))
+		{
+			DWORD ttl = MULTICAST_TTL;
+			setsockopt(udp_socket, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(ttl));
+		}
+
+		int id = subscribers.Add(address, encoding, max_rate);
+		// A new delta subscriber cannot decode anything before the next keyframe
+		if (id >= 0 && encoding == FrameEncoding::DELTA)
+		{
+			delta_encoder.RequestKeyframe();
+		}
+		return id;
+	}
+
+	bool RemoveSubscriber(int id)
+	{
+		return subscribers.Remove(id);
+	}
+
+	void PrintSubscriberStats()
+	{
+		for (const FrameSubscriber& subscriber : subscribers.Snapshot())
+		{
+			char ip[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, (void*)&subscriber.address.sin_addr, ip, sizeof(ip));
+			cout << "Subscriber " << subscriber.id << " (" << ip << ":" << ntohs(subscriber.address.sin_port)
+				<< "): sent " << subscriber.sent_count << ", skipped by rate limit " << subscriber.skipped_count << endl;
 		}
 	}
 
@@ -136,14 +260,13 @@ public:
 	/// Wait for message saying if calibration is to be done or a previous result will be used
 	void ReceiveCalibrationChoice()
 	{
-		// Clear buffer and wait to receive instructions
-		memset(recv_buffer, '\0', RECEIVE_BUFFER_LENGTH);
-		int bytes_received = 0;
-		while (bytes_received <= 0)
+		string choice;
+		if (!ReceiveControlMessage(&choice))
 		{
-			bytes_received = recv(tcp_socket, recv_buffer, RECEIVE_BUFFER_LENGTH, 0);
+			cout << CONTROL_CONNECTION_CLOSED_STRING << endl;
+			DoCleanup(true);
+			exit(EXIT_FAILURE);
 		}
-		string choice(recv_buffer);
 		cout << choice << endl;
 		if (choice == DO_CALIBRATION_STRING)
 		{
@@ -151,106 +274,111 @@ public:
 		}
 	}
 
-	/// Wait for the Hololens to send calibration message.
+	/// Wait for the Hololens to upload the calibration images. The upload is framed as described in
+	/// CalibrationProtocol.h: a header with the camera intrinsics, image size and format, then one message per image.
+	/// Each image is received straight into a slot of calibration_worker, which decodes it and finds the fingertips on
+	/// its own thread while the next image is being received. Getting a slot never waits for the workers, so every
+	/// image is read as soon as it arrives and paired with the Leap frame of its arrival time less its capture age.
 	void ReceiveCalibrationMessage()
 	{
-		// First receive message with fx, fy, cx, cy, image width and height, number of images that will be 
-		// sent, and the size in bytes of each image
-		memset(recv_buffer, '\0', RECEIVE_BUFFER_LENGTH);
-		int bytes_received = 0;
-		while (bytes_received <= 0)
-		{
-			bytes_received = recv(tcp_socket, recv_buffer, RECEIVE_BUFFER_LENGTH, 0);
-		}
-
-		// Read the received message
-		string received_message(recv_buffer);
-		string fx_str, fy_str, cx_str, cy_str, width_str, height_str, image_amount_str, image_size_str;
-		float fx, fy, cx, cy;
-		int width, height, image_amount, image_size;
-		stringstream ss(received_message);
-		getline(ss, fx_str, ';');
-		getline(ss, fy_str, ';');
-		getline(ss, cx_str, ';');
-		getline(ss, cy_str, ';');
-		getline(ss, width_str, ';');
-		getline(ss, height_str, ';');
-		getline(ss, image_amount_str, ';');
-		getline(ss, image_size_str, ';');
-		fx = stof(fx_str);
-		fy = stof(fy_str);
-		cx = stof(cx_str);
-		cy = stof(cy_str);
-		width = stoi(width_str);
-		height = stoi(height_str);
-		image_amount = stoi(image_amount_str);
-		image_size = stoi(image_size_str);
-
-		// Start receiving images
-		int number_of_images_received = 0;
-		vector<Mat> received_images;
-		vector<Frame> leap_frames;
-		do
-		{
-			// Clear buffer and start receiving the image
-			bool frame_captured = false;
-			memset(recv_buffer, '\0', RECEIVE_BUFFER_LENGTH);
-			char* image_data = new char[image_size];
-			bytes_received = 0;
-			int total_bytes_received = 0;
-			do
-			{
-				bytes_received = recv(tcp_socket, recv_buffer, RECEIVE_BUFFER_LENGTH, 0);
-				copy(recv_buffer, recv_buffer + bytes_received, image_data + total_bytes_received);
-				total_bytes_received += bytes_received;
-				if (!frame_captured && total_bytes_received > 0)
-				{
-					leap_frames.push_back(leap_controller->frame());
-					frame_captured = true;
-				}
-			} 
-			while (total_bytes_received < image_size);
+		int receive_buffer_size = CALIBRATION_SOCKET_BUFFER_SIZE;
+		setsockopt(tcp_socket, SOL_SOCKET, SO_RCVBUF, (const char*)&receive_buffer_size, sizeof(receive_buffer_size));
+
+		// First receive the header with fx, fy, cx, cy, image width and height, number of images that will be sent,
+		// the size in bytes of each image and the format they are sent in
+		CalibrationHeader header;
+		char header_payload[CALIBRATION_HEADER_PAYLOAD_SIZE];
+		uint32_t payload_length = ReceiveCalibrationFrameHeader(CALIBRATION_MESSAGE_HEADER);
+		if (payload_length != CALIBRATION_HEADER_PAYLOAD_SIZE || !ReceiveExactly(header_payload, payload_length) ||
+			!ReadCalibrationHeader(header_payload, &header))
+		{
+			FailCalibrationUpload();
+		}
 
-			// Convert received image data into a Mat for future processing
-			Mat calibration_image(Size(width, height), CV_8UC3);
-			for (int row = 0; row < height; ++row)
+		// Receive each image together with the Leap frame captured at the same time
+		calibration_leap_frames.resize(header.image_count);
+		calibration_image_fingertips.assign(header.image_count, vector<Point2f>());
+		calibration_leap_fingertips.assign(header.image_count, vector<Point3f>());
+		WorkStealingPool::Shared().ResetUtilization();
+		calibration_worker.Start(&header);
+		bool is_raw = header.image_format == CALIBRATION_FORMAT_RAW_BGR;
+		uint32_t max_payload_length = is_raw ? header.image_size : CALIBRATION_MAX_ENCODED_SIZE(header.image_size);
+		int64_t transfer_ns = 0;
+		uint64_t transfer_bytes = 0;
+		for (int i = 0; i < header.image_count; ++i)
+		{
+			payload_length = ReceiveCalibrationFrameHeader(CALIBRATION_MESSAGE_IMAGE);
+			int64_t arrival_time = CurrentTimestamp();
+			int64_t transfer_start = MetricsClock();
+			char image_prefix[CALIBRATION_IMAGE_PREFIX_SIZE];
+			if (payload_length < CALIBRATION_IMAGE_PREFIX_SIZE || !ReceiveExactly(image_prefix, CALIBRATION_IMAGE_PREFIX_SIZE))
 			{
-				for (int col = 0; col < width; ++col)
-				{
-					int index = row * width * 3 * sizeof(char) + col * 3 * sizeof(char);
-					Vec3b pix;
-					pix[0] = (uchar)image_data[index];
-					pix[1] = (uchar)image_data[index + 1];
-					pix[2] = (uchar)image_data[index + 2];
-					calibration_image.at<Vec3b>(row, col) = pix;
-				}
+				FailCalibrationUpload();
 			}
-			received_images.push_back(calibration_image);
-
-			delete[] image_data;
-			image_data = NULL;
-
-			number_of_images_received++;
-		} 
-		while (number_of_images_received < image_amount);
-
-		// Find the fingertips in each image and each Leap frame
+			FindCalibrationFrame(arrival_time - ReadStampInt64(image_prefix), &calibration_leap_frames[i]);
+			payload_length -= CALIBRATION_IMAGE_PREFIX_SIZE;
+			if (is_raw ? payload_length != max_payload_length : payload_length > max_payload_length)
+			{
+				FailCalibrationUpload();
+			}
+			CalibrationImageSlot* slot = calibration_worker.AcquireSlot();
+			if (!is_raw)
+			{
+				slot->encoded.resize(payload_length);
+			}
+			char* destination = is_raw ? (char*)slot->image.data : (char*)slot->encoded.data();
+			if (!ReceiveExactly(destination, payload_length))
+			{
+				FailCalibrationUpload();
+			}
+			transfer_ns += MetricsClock() - transfer_start;
+			transfer_bytes += payload_length;
+			slot->index = i;
+			calibration_worker.Submit(slot);
+		}
+		// Only the images still being worked on are waited for
+		int64_t finish_start = MetricsClock();
+		if (!calibration_worker.Finish())
+		{
+			FailCalibrationUpload();
+		}
+		cout << "Received " << header.image_count << " calibration images, " << transfer_bytes << " bytes. Transfer: "
+			<< transfer_ns / 1e6 << " ms, decode: " << calibration_worker.DecodeMilliseconds() << " ms, detection: "
+			<< calibration_worker.ProcessMilliseconds() << " ms on " << calibration_worker.WorkerCount()
+			<< " workers, waited after the last image: " << (MetricsClock() - finish_start) / 1e6 << " ms" << endl;
+		PoolUtilization detection_utilization;
+		WorkStealingPool::Shared().Utilization(&detection_utilization);
+		PrintPoolUtilization(detection_utilization);
+
+		// Gather the fingertips in upload order, so that the image and Leap fingertips pair up
 		vector<Point2f> image_fingertips;
 		vector<Point3f> leap_fingertips;
-		for (int i = 0; i < image_amount; ++i)
+		for (int i = 0; i < header.image_count; ++i)
 		{
-			// Image
-			Mat current_img = received_images[i];
-			Mat hand_image = hand_detector.DetectHands(&current_img, true);
-			fingertip_detector.FindFingertips(&hand_image, &image_fingertips);
-			
-			// Leap frame
-			ExtractFingertips(&leap_frames[i], &leap_fingertips);
+			image_fingertips.insert(image_fingertips.end(), calibration_image_fingertips[i].begin(),
+				calibration_image_fingertips[i].end());
+			leap_fingertips.insert(leap_fingertips.end(), calibration_leap_fingertips[i].begin(),
+				calibration_leap_fingertips[i].end());
 		}
 
 		Mat rot_mat(3, 3, CV_64F);
 		Mat trans_vec(3, 1, CV_64F);
-		calibrator.Calibrate(&rot_mat, &trans_vec, fx, fy, cx, cy, &image_fingertips, &leap_fingertips);
+		calibrator.Calibrate(&rot_mat, &trans_vec, header.fx, header.fy, header.cx, header.cy, &image_fingertips,
+			&leap_fingertips);
+
+		// Keep the result so that it can be applied to the streamed frames
+		double rotation[9];
+		double translation[3];
+		for (int row = 0; row < 3; ++row)
+		{
+			for (int col = 0; col < 3; ++col)
+			{
+				rotation[row * 3 + col] = rot_mat.at<double>(row, col);
+			}
+			translation[row] = trans_vec.at<double>(row, 0);
+		}
+		MakeCalibratedTransform(rotation, translation, &calibrated_transform);
+		is_calibrated = true;
 
 		// Send the result of the calibration to the Hololens
 		string transform_string = string(LEAP_CALIBRATION_SUCCESS_STRING);
@@ -264,6 +392,11 @@ public:
 		transform_string += to_string(trans_vec.at<double>(0, 0)) + ";";
 		transform_string += to_string(trans_vec.at<double>(1, 0)) + ";";
 		transform_string += to_string(trans_vec.at<double>(2, 0));
+		// Extra field telling the Hololens that the streamed frames already have the transform applied
+		if (stream_calibrated_frames)
+		{
+			transform_string += string(";") + CALIBRATED_FRAMES_STRING;
+		}
 		transform_string += "\n";
 		const char* message = transform_string.c_str();
 		int bytes_sent = send(tcp_socket, message, strlen(message) * sizeof(char), 0);
@@ -272,16 +405,96 @@ public:
 		ListenForCalibrationResult();
 	}
 
-	void ListenForCalibrationResult()
+	/// Waits for the next message on the control connection, before the control loop runs. The bytes received after it,
+	/// such as the start of the calibration upload, stay in control_framer. Returns false if the connection was closed.
+	bool ReceiveControlMessage(string* message)
+	{
+		while (!control_framer.Next(message))
+		{
+			int bytes_received = recv(tcp_socket, recv_buffer, RECEIVE_BUFFER_LENGTH, 0);
+			if (bytes_received <= 0)
+			{
+				return false;
+			}
+			control_framer.Append(recv_buffer, bytes_received);
+		}
+		return true;
+	}
+
+	/// Receives exactly length bytes into destination, reading as much as the socket has at a time, after the bytes
+	/// received with the last control message. Returns false if the connection was closed or failed first.
+	bool ReceiveExactly(char* destination, size_t length)
+	{
+		size_t total_bytes_received = control_framer.TakePending(destination, length);
+		while (total_bytes_received < length)
+		{
+			size_t remaining = length - total_bytes_received;
+			int bytes_received = recv(tcp_socket, destination + total_bytes_received,
+				remaining < INT_MAX ? (int)remaining : INT_MAX, 0);
+			if (bytes_received <= 0)
+			{
+				return false;
+			}
+			total_bytes_received += bytes_received;
+		}
+		return true;
+	}
+
+	/// Receives the length and type of the next calibration message and returns the length of its payload. Fails the
+	/// upload if the message is not of the expected type.
+	uint32_t ReceiveCalibrationFrameHeader(uint8_t expected_type)
 	{
-		memset(recv_buffer, '\0', RECEIVE_BUFFER_LENGTH);
-		int bytes_received = 0;
-		while (bytes_received <= 0)
+		char frame_header[CALIBRATION_FRAME_HEADER_SIZE];
+		uint8_t type;
+		uint32_t payload_length;
+		if (!ReceiveExactly(frame_header, CALIBRATION_FRAME_HEADER_SIZE) ||
+			!ReadCalibrationFrameHeader(frame_header, &type, &payload_length) || type != expected_type)
 		{
-			bytes_received = recv(tcp_socket, recv_buffer, RECEIVE_BUFFER_LENGTH, 0);
+			FailCalibrationUpload();
 		}
-		// Read the received message
-		string received_message(recv_buffer);
+		return payload_length;
+	}
+
+	/// Finds the Leap frame captured closest to the given wall clock time, or interpolates between the two around it
+	void FindCalibrationFrame(int64_t capture_time, FrameData* frame)
+	{
+		bool is_found = interpolate_calibration_frames ?
+			calibration_frame_history.Interpolate(capture_time, frame) :
+			calibration_frame_history.FindClosest(capture_time, frame);
+		if (!is_found)
+		{
+			// Nothing is recording the history, so the current frame is the best there is
+			Frame leap_frame = leap_controller->frame();
+			LeapFrameToFrameData(&leap_frame, frame);
+		}
+	}
+
+	/// Finds the fingertips in a received calibration image and in the Leap frame paired with it. Runs on the threads
+	/// of calibration_worker, several images at a time, so the results are stored by image.
+	void ProcessCalibrationImage(CalibrationImageSlot* slot, DetectorWorkspace* workspace)
+	{
+		// Image
+		Mat hand_image = hand_detector.DetectHands(&slot->image, true, workspace);
+		fingertip_detector.FindFingertips(&hand_image, &calibration_image_fingertips[slot->index], workspace);
+
+		// Leap frame
+		ExtractFingertips(&calibration_leap_frames[slot->index], &calibration_leap_fingertips[slot->index]);
+	}
+
+	/// The upload cannot be resynchronized once its framing is lost, so the client quits
+	void FailCalibrationUpload()
+	{
+		calibration_worker.Finish();
+		cout << CALIBRATION_UPLOAD_FAIL_STRING << WSAGetLastError() << endl;
+		DoCleanup(true);
+		exit(EXIT_FAILURE);
+	}
+
+	void ListenForCalibrationResult()
+	{
+		// A closed connection leaves the message empty, which ends the client below
+		string received_message;
+		ReceiveControlMessage(&received_message);
 		if (received_message != HOLO_CALIBRATION_SUCCESS_STRING)
 		{
 			if (received_message == HOLO_CALIBRATION_FAIL_STRING)
@@ -297,41 +510,254 @@ public:
 		}
 	}
 
-	/// Send the relevant info of a frame as JSON
+	/// Frames to pair with the calibration images. The frame source should record into this while calibrating.
+	FrameHistory* CalibrationFrameHistory()
+	{
+		return &calibration_frame_history;
+	}
+
+	/// Choose whether the Leap frame paired with a calibration image is interpolated between the two frames captured
+	/// around the image, or is simply the closest one
+	void SetInterpolateCalibrationFrames(bool interpolate)
+	{
+		interpolate_calibration_frames = interpolate;
+	}
+
+	/// Choose whether the calibration is applied to the streamed frames here instead of on the Hololens. Must be set
+	/// before calibration so that the Hololens is told about it.
+	void SetStreamCalibratedFrames(bool calibrated)
+	{
+		stream_calibrated_frames = calibrated;
+	}
+
+	/// The transform from the Leap coordinate system to the streamed one. Includes the calibration if calibrated frames
+	/// were chosen and a calibration was done in this session.
+	FrameTransform StreamTransform()
+	{
+		if (stream_calibrated_frames && is_calibrated)
+		{
+			return calibrated_transform;
+		}
+		FrameTransform transform;
+		MakeStreamTransform(&transform);
+		return transform;
+	}
+
+	/// Measure encoding, sending and frame sizes. Null disables the measurements.
+	void SetMetrics(StreamMetrics* stream_metrics)
+	{
+		metrics = stream_metrics;
+	}
+
+	/// Choose the wire format used for the Hololens. Must be set before connecting.
+	void SetFrameEncoding(FrameEncoding encoding)
+	{
+		frame_encoding = encoding;
+	}
+
+	/// Send the relevant info of a frame to every subscriber
 	void SendLeapFrame(Leap::Frame* frame)
 	{
-		string frame_json_string = LeapFrameToJson(frame);
-		size_t string_length = frame_json_string.size();
-		send(udp_socket, frame_json_string.c_str(), string_length * sizeof(char), 0);
+		FrameData frame_data;
+		FrameTransform transform = StreamTransform();
+		LeapFrameToFrameData(frame, &frame_data, &transform);
+		SendFrame(&frame_data);
+	}
+
+	/// Send a frame to every subscriber
+	void SendFrame(const FrameData* frame_data)
+	{
+		EncodeFrame(frame_data, &send_frame);
+		SendEncodedFrame(&send_frame);
+	}
+
+	/// Encode a frame once in every encoding that some subscriber uses. Must always be called from the same thread.
+	void EncodeFrame(const FrameData* frame_data, EncodedFrame* encoded)
+	{
+		int64_t start_time = metrics != nullptr ? MetricsClock() : 0;
+		uint8_t encoding_mask = subscribers.EncodingMask();
+		size_t offset = 0;
+		for (int i = 0; i < FRAME_ENCODING_COUNT; ++i)
+		{
+			encoded->offset[i] = offset;
+			encoded->length[i] = 0;
+			if (encoding_mask & (1 << i))
+			{
+				encoded->length[i] = EncodeFrame(frame_data, (FrameEncoding)i, encoded->data + offset,
+					SEND_BUFFER_LENGTH - offset);
+				offset += encoded->length[i];
+			}
+		}
+		encoded->size = offset;
+
+		if (metrics != nullptr)
+		{
+			metrics->RecordSince(MetricStage::ENCODE, start_time);
+			metrics->Record(MetricStage::FRAME_BYTES, (int64_t)offset);
+		}
 	}
 
-	/// Listen for control messages from the Hololens
-	void ListenForControlMessage(bool* is_streaming, bool* is_paused)
+	/// Encode a frame with the given encoding. Returns the encoded length, or 0 if the buffer is too small.
+	/// Must always be called from the same thread.
+	size_t EncodeFrame(const FrameData* frame_data, FrameEncoding encoding, char* buffer, size_t buffer_length)
 	{
-		// Clear buffer
-		memset(recv_buffer, '\0', RECEIVE_BUFFER_LENGTH);
-		int bytes_received = 0;
-		while (bytes_received <= 0 && *is_streaming)
+		if (encoding == FrameEncoding::BINARY)
 		{
-			bytes_received = recv(tcp_socket, recv_buffer, RECEIVE_BUFFER_LENGTH, 0);
+			return EncodeBinaryFrame(frame_data, buffer, buffer_length);
 		}
-		string message(recv_buffer);
+		else if (encoding == FrameEncoding::DELTA)
+		{
+			return delta_encoder.EncodeFrame(frame_data, buffer, buffer_length);
+		}
+		else
+		{
+			json_writer.WriteFrame(frame_data);
+			if (json_writer.Size() > buffer_length)
+			{
+				return 0;
+			}
+			memcpy(buffer, json_writer.Data(), json_writer.Size());
+			return json_writer.Size();
+		}
+	}
+
+	/// Send an encoded frame to every subscriber that is due a frame. Each datagram is stamped with the subscriber's
+	/// own sequence number right before it is sent, so the same encoded bytes are reused for every subscriber.
+	/// Must always be called from the same thread.
+	void SendEncodedFrame(EncodedFrame* encoded)
+	{
+		int64_t send_timestamp = CurrentTimestamp();
+		size_t delta_index = (size_t)FrameEncoding::DELTA;
+		bool is_keyframe = IsDeltaKeyframe(encoded->data + encoded->offset[delta_index], encoded->length[delta_index]);
+
+		subscribers.ForEachDue(send_timestamp,
+			[is_keyframe](const FrameSubscriber& subscriber)
+			{
+				// Rate limited delta subscribers must not miss a keyframe, later deltas are relative to it
+				return is_keyframe && subscriber.encoding == FrameEncoding::DELTA;
+			},
+			[this, encoded, send_timestamp](const FrameSubscriber& subscriber)
+			{
+				size_t index = (size_t)subscriber.encoding;
+				size_t frame_length = encoded->length[index];
+				if (frame_length == 0)
+				{
+					return false;
+				}
+
+				char* frame = encoded->data + encoded->offset[index];
+				StampFrame(subscriber.encoding, frame, frame_length, subscriber.sequence, send_timestamp);
+				int64_t start_time = metrics != nullptr ? MetricsClock() : 0;
+				sendto(udp_socket, frame, (int)frame_length, 0, (const sockaddr*)&subscriber.address,
+					sizeof(subscriber.address));
+				if (metrics != nullptr)
+				{
+					metrics->RecordSince(MetricStage::SEND, start_time);
+				}
+				return true;
+			});
+	}
+
+	/// Handles control messages from the Hololens until the session is stopped. The thread sleeps in WSAPoll until the
+	/// control socket or the wake socket is readable, so it uses no CPU between messages. Closing the control
+	/// connection stops the session.
+	void RunControlLoop(StreamSession* session)
+	{
+		u_long non_blocking = 1;
+		ioctlsocket(tcp_socket, FIONBIO, &non_blocking);
+
+		WSAPOLLFD poll_sockets[2];
+		poll_sockets[0].fd = tcp_socket;
+		poll_sockets[0].events = POLLRDNORM;
+		poll_sockets[1].fd = wake_socket;
+		poll_sockets[1].events = POLLRDNORM;
+		// Messages that arrived together with the calibration result
+		string message;
+		while (control_framer.Next(&message))
+		{
+			HandleControlMessage(message, session);
+		}
+		while (!session->IsStopped())
+		{
+			if (WSAPoll(poll_sockets, 2, -1) == SOCKET_ERROR)
+			{
+				cout << CONTROL_POLL_FAIL_STRING << WSAGetLastError() << endl;
+				session->Stop();
+				break;
+			}
+
+			if (poll_sockets[1].revents != 0)
+			{
+				// Only wakes the loop so that it sees the new session state
+				recv(wake_socket, control_buffer, RECEIVE_BUFFER_LENGTH, 0);
+			}
+
+			if (poll_sockets[0].revents != 0)
+			{
+				int bytes_received = recv(tcp_socket, control_buffer, RECEIVE_BUFFER_LENGTH, 0);
+				if (bytes_received == 0 || (bytes_received == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK))
+				{
+					cout << CONTROL_CONNECTION_CLOSED_STRING << endl;
+					session->Stop();
+					break;
+				}
+				if (bytes_received > 0)
+				{
+					control_framer.Append(control_buffer, bytes_received);
+					while (control_framer.Next(&message))
+					{
+						HandleControlMessage(message, session);
+					}
+				}
+			}
+		}
+	}
+
+	/// Makes RunControlLoop check the session state, e.g. after the session was stopped from the console
+	void WakeControlLoop()
+	{
+		char wake_byte = 0;
+		sendto(wake_socket, &wake_byte, 1, 0, (const sockaddr*)&wake_sockaddr, sizeof(wake_sockaddr));
+	}
+
+private:
+
+	void HandleControlMessage(const string& message, StreamSession* session)
+	{
 		cout << message << endl;
 		if (message == PAUSE_STREAMING_STRING)
 		{
-			*is_paused = true;
+			session->Pause();
 		}
 		else if (message == RESUME_STREAMING_STRING)
 		{
-			*is_paused = false;
+			session->Resume();
 		}
 		else if (message == END_STREAMING_STRING)
 		{
-			*is_streaming = false;
+			session->Stop();
+		}
+		else if (message == REQUEST_KEYFRAME_STRING)
+		{
+			delta_encoder.RequestKeyframe();
 		}
 	}
 
-private:
+	void StampFrame(FrameEncoding encoding, char* frame, size_t frame_length, uint32_t sequence, int64_t send_timestamp)
+	{
+		if (encoding == FrameEncoding::BINARY)
+		{
+			StampBinaryFrame(frame, frame_length, sequence, send_timestamp);
+		}
+		else if (encoding == FrameEncoding::DELTA)
+		{
+			StampDeltaFrame(frame, frame_length, sequence, send_timestamp);
+		}
+		else
+		{
+			StampJsonFrame(frame, frame_length, sequence, send_timestamp);
+		}
+	}
 
 	/// Intializes Winsocket. If the initialization fails the user given the choice of trying again.
 	int DoWSAStartup()
@@ -372,6 +798,9 @@ private:
 	WSADATA					wsa_data;
 	SOCKET					tcp_socket;
 	SOCKET					udp_socket;
+	// Loopback socket that only wakes up the control loop
+	SOCKET					wake_socket;
+	sockaddr_in				wake_sockaddr;
 	sockaddr_in				local_tcp_sockaddr;
 	sockaddr_in				local_udp_sockaddr;
 	sockaddr_in				holo_tcp_sockaddr;
@@ -381,7 +810,30 @@ private:
 	HandDetector			hand_detector;
 	FingertipDetector		fingertip_detector;
 	LeapToHoloCalibrator	calibrator;
-
+	CalibrationImageWorker	calibration_worker;
+	// Recent Leap frames, for pairing each calibration image with the frame captured at the same time
+	FrameHistory				calibration_frame_history;
+	bool						interpolate_calibration_frames	= true;
+	// One entry per image of the current upload, filled by calibration_worker
+	vector<FrameData>			calibration_leap_frames;
+	vector<vector<Point2f>>		calibration_image_fingertips;
+	vector<vector<Point3f>>		calibration_leap_fingertips;
+
+	bool					stream_calibrated_frames	= false;
+	bool					is_calibrated				= false;
+	FrameTransform			calibrated_transform;
+
+	FrameEncoding			frame_encoding		= FrameEncoding::JSON;
+	JsonFrameWriter			json_writer;
+	DeltaFrameEncoder		delta_encoder;
+	FrameSubscribers		subscribers;
+	StreamMetrics*			metrics				= nullptr;
 
 	char						recv_buffer[RECEIVE_BUFFER_LENGTH];
+	// Used only by the control loop thread, so that it never shares recv_buffer with the calibration code
+	char						control_buffer[RECEIVE_BUFFER_LENGTH];
+	// Splits the control messages, first on the main thread before streaming and then in the control loop, which
+	// takes over the bytes received after the calibration result
+	ControlMessageFramer		control_framer;
+	EncodedFrame				send_frame;
 };
\ No newline at end of file
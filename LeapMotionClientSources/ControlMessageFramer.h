@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define CONTROL_MESSAGE_DELIMITER		'\n'
+#define CONTROL_MESSAGE_MAX_LENGTH		1024
+
+/// Splits the bytes received on the control channel into messages. Messages end with a newline. For peers that send
+/// bare messages without one, pending bytes that exactly match a known message are also taken as a message.
+class ControlMessageFramer
+{
+public:
+
+	ControlMessageFramer(const vector<string>& known)
+	{
+		known_messages = known;
+	}
+
+	void Append(const char* data, size_t length)
+	{
+		pending.append(data, length);
+	}
+
+	/// Moves up to length of the bytes received after the last message to destination, for a peer that follows a
+	/// message with data framed another way. Returns the number of bytes moved.
+	size_t TakePending(char* destination, size_t length)
+	{
+		size_t taken = min(length, pending.size());
+		pending.copy(destination, taken);
+		pending.erase(0, taken);
+		return taken;
+	}
+
+	/// Takes the next complete message. Returns false if there is none yet.
+	bool Next(string* message)
+	{
+		size_t delimiter = pending.find(CONTROL_MESSAGE_DELIMITER);
+		if (delimiter != string::npos)
+		{
+			message->assign(pending, 0, delimiter);
+			// Tolerate CRLF
+			if (!message->empty() && message->back() == '\r')
+			{
+				message->pop_back();
+			}
+			pending.erase(0, delimiter + 1);
+			return true;
+		}
+
+		for (const string& known : known_messages)
+		{
+			if (pending == known)
+			{
+				message->swap(pending);
+				pending.clear();
+				return true;
+			}
+		}
+
+		// A peer that never sends a delimiter must not make the buffer grow without bound
+		if (pending.size() > CONTROL_MESSAGE_MAX_LENGTH)
+		{
+			pending.clear();
+		}
+		return false;
+	}
+
+private:
+
+	vector<string>		known_messages;
+	string				pending;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+// Every streamed datagram carries a stamp that lets the receiver detect loss and reordering and measure latency:
+//
+//   uint32 sequence			increases by one for every datagram sent, written right before sending
+//   int64 send_timestamp		client wall clock in microseconds since the Unix epoch, written right before sending
+//   int64 frame_id				id of the Leap frame
+//   int64 capture_timestamp	Leap capture time of the frame in microseconds, in the Leap service's clock
+
+#define DATAGRAM_STAMP_SIZE			28
+
+struct DatagramStamp
+{
+	uint32_t	sequence;
+	int64_t		send_timestamp;
+	int64_t		frame_id;
+	int64_t		capture_timestamp;
+};
+
+/// Current wall clock time in microseconds since the Unix epoch
+inline int64_t CurrentTimestamp()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline void WriteStampUInt32(char* destination, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		destination[i] = (char)((value >> (8 * i)) & 0xFF);
+	}
+}
+
+inline void WriteStampInt64(char* destination, int64_t value)
+{
+	uint64_t bits = (uint64_t)value;
+	for (int i = 0; i < 8; ++i)
+	{
+		destination[i] = (char)((bits >> (8 * i)) & 0xFF);
+	}
+}
+
+inline uint32_t ReadStampUInt32(const char* source)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		value |= (uint32_t)(uint8_t)source[i] << (8 * i);
+	}
+	return value;
+}
+
+inline int64_t ReadStampInt64(const char* source)
+{
+	uint64_t bits = 0;
+	for (int i = 0; i < 8; ++i)
+	{
+		bits |= (uint64_t)(uint8_t)source[i] << (8 * i);
+	}
+	return (int64_t)bits;
+}
+
+/// Writes the whole stamp in its binary layout
+inline void WriteDatagramStamp(char* destination, const DatagramStamp* stamp)
+{
+	WriteStampUInt32(destination, stamp->sequence);
+	WriteStampInt64(destination + 4, stamp->send_timestamp);
+	WriteStampInt64(destination + 12, stamp->frame_id);
+	WriteStampInt64(destination + 20, stamp->capture_timestamp);
+}
+
+/// Overwrites only the send fields of a stamp that is already in place
+inline void WriteDatagramSendStamp(char* destination, uint32_t sequence, int64_t send_timestamp)
+{
+	WriteStampUInt32(destination, sequence);
+	WriteStampInt64(destination + 4, send_timestamp);
+}
+
+inline void ReadDatagramStamp(const char* source, DatagramStamp* stamp)
+{
+	stamp->sequence = ReadStampUInt32(source);
+	stamp->send_timestamp = ReadStampInt64(source + 4);
+	stamp->frame_id = ReadStampInt64(source + 12);
+	stamp->capture_timestamp = ReadStampInt64(source + 20);
+}
@@ -0,0 +1,459 @@
+#pragma once
+
+#include "FrameData.h"
+#include "BinaryFrameEncoding.h"
+#include "DatagramStamp.h"
+
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+// Quantized delta stream. Every message starts with a 38 byte header:
+//
+//   uint8 magic[2]				'L', 'Q'
+//   uint8 version				DELTA_FRAME_VERSION
+//   uint8 kind					DELTA_KIND_KEYFRAME or DELTA_KIND_DELTA
+//   uint16 sequence			increases by one for every encoded message
+//   uint16 keyframe_sequence	sequence of the keyframe the message is relative to
+//   uint8 hand_mask
+//   uint8 reserved
+//   datagram stamp				see DatagramStamp.h, the send fields are left as zeros by the encoder
+//
+// A keyframe is followed by the full precision binary frame written by EncodeBinaryFrame. A delta is followed by one
+// block per present hand where every value is a 16 bit fixed-point integer. The palm is relative to the palm of the
+// keyframe, and all the other positions of the hand are relative to the palm of the same frame. Only the valid
+// fingers are written. The hand set of a delta always matches its keyframe.
+
+#define DELTA_FRAME_MAGIC_0				'L'
+#define DELTA_FRAME_MAGIC_1				'Q'
+#define DELTA_FRAME_VERSION				2
+#define DELTA_KIND_KEYFRAME				0
+#define DELTA_KIND_DELTA				1
+#define DELTA_FRAME_STAMP_OFFSET		10
+#define DELTA_FRAME_HEADER_SIZE			(DELTA_FRAME_STAMP_OFFSET + DATAGRAM_STAMP_SIZE)
+#define DELTA_FRAME_MAX_SIZE			(DELTA_FRAME_HEADER_SIZE + BINARY_FRAME_MAX_SIZE)
+// With this interval a synthetic two-hand frame averages about 410 bytes, against 736 binary and 4.7 KB JSON
+#define DEFAULT_KEYFRAME_INTERVAL		30
+
+// Size of one step of each quantized value. Directions are unit vectors scaled by mm_to_m.
+#define POSITION_QUANTUM				0.0001f
+#define VELOCITY_QUANTUM				0.001f
+#define DIRECTION_QUANTUM				(0.001f / 32767.0f)
+#define ANGLE_QUANTUM					0.0001f
+
+enum class DeltaDecodeResult
+{
+	FRAME,
+	NEED_KEYFRAME,
+	INVALID
+};
+
+inline void WriteDeltaUInt16(char* destination, uint16_t value)
+{
+	destination[0] = (char)(value & 0xFF);
+	destination[1] = (char)(value >> 8);
+}
+
+inline uint16_t ReadDeltaUInt16(const char* source)
+{
+	return (uint16_t)((uint8_t)source[0] | ((uint8_t)source[1] << 8));
+}
+
+/// Quantizes a value and writes it to the cursor. Returns false if it does not fit in 16 bits.
+inline bool WriteQuantized(char** cursor, float value, float quantum)
+{
+	float steps = roundf(value / quantum);
+	if (!(steps >= -32767.0f && steps <= 32767.0f))
+	{
+		return false;
+	}
+	WriteDeltaUInt16(*cursor, (uint16_t)(int16_t)steps);
+	*cursor += sizeof(int16_t);
+	return true;
+}
+
+inline bool WriteQuantized3(char** cursor, const Float3* value, const Float3* origin, float quantum)
+{
+	return WriteQuantized(cursor, value->x - origin->x, quantum) &&
+		WriteQuantized(cursor, value->y - origin->y, quantum) &&
+		WriteQuantized(cursor, value->z - origin->z, quantum);
+}
+
+inline float ReadQuantized(const char** cursor, float quantum)
+{
+	float value = (int16_t)ReadDeltaUInt16(*cursor) * quantum;
+	*cursor += sizeof(int16_t);
+	return value;
+}
+
+inline void ReadQuantized3(const char** cursor, Float3* value, const Float3* origin, float quantum)
+{
+	value->x = origin->x + ReadQuantized(cursor, quantum);
+	value->y = origin->y + ReadQuantized(cursor, quantum);
+	value->z = origin->z + ReadQuantized(cursor, quantum);
+}
+
+/// Returns the value the receiver reconstructs for a quantized offset from the origin
+inline Float3 Requantize3(const Float3* value, const Float3* origin, float quantum)
+{
+	Float3 result;
+	result.x = origin->x + roundf((value->x - origin->x) / quantum) * quantum;
+	result.y = origin->y + roundf((value->y - origin->y) / quantum) * quantum;
+	result.z = origin->z + roundf((value->z - origin->z) / quantum) * quantum;
+	return result;
+}
+
+/// Encodes frames as keyframes and quantized deltas. A keyframe is sent every keyframe_interval frames, when the set
+/// of hands changes, when a value does not fit its quantized range, and after RequestKeyframe has been called.
+class DeltaFrameEncoder
+{
+public:
+
+	DeltaFrameEncoder(int interval = DEFAULT_KEYFRAME_INTERVAL)
+	{
+		keyframe_interval = interval;
+	}
+
+	/// Makes the next encoded frame a keyframe. Can be called from any thread.
+	void RequestKeyframe()
+	{
+		keyframe_requested = true;
+	}
+
+	/// Encodes the frame into the given buffer. Returns the number of bytes written, or 0 if the buffer is too small.
+	size_t EncodeFrame(const FrameData* frame, char* buffer, size_t buffer_length)
+	{
+		bool do_keyframe = keyframe_requested.exchange(false) ||
+			!has_keyframe ||
+			frames_since_keyframe + 1 >= keyframe_interval ||
+			frame->hand_mask != keyframe.hand_mask;
+
+		size_t frame_length = 0;
+		if (!do_keyframe)
+		{
+			frame_length = EncodeDelta(frame, buffer, buffer_length);
+		}
+		if (frame_length == 0)
+		{
+			frame_length = EncodeKeyframe(frame, buffer, buffer_length);
+		}
+
+		if (frame_length > 0)
+		{
+			++sequence;
+		}
+		return frame_length;
+	}
+
+private:
+
+	int					keyframe_interval;
+	atomic<bool>		keyframe_requested		= { false };
+	bool				has_keyframe			= false;
+	int					frames_since_keyframe	= 0;
+	uint16_t			sequence				= 0;
+	uint16_t			keyframe_sequence		= 0;
+	FrameData			keyframe;
+
+	void WriteHeader(char* buffer, uint8_t kind, const FrameData* frame)
+	{
+		buffer[0] = DELTA_FRAME_MAGIC_0;
+		buffer[1] = DELTA_FRAME_MAGIC_1;
+		buffer[2] = (char)DELTA_FRAME_VERSION;
+		buffer[3] = (char)kind;
+		WriteDeltaUInt16(buffer + 4, sequence);
+		WriteDeltaUInt16(buffer + 6, keyframe_sequence);
+		buffer[8] = (char)frame->hand_mask;
+		buffer[9] = 0;
+		DatagramStamp stamp = { 0, 0, frame->id, frame->capture_timestamp };
+		WriteDatagramStamp(buffer + DELTA_FRAME_STAMP_OFFSET, &stamp);
+	}
+
+	size_t EncodeKeyframe(const FrameData* frame, char* buffer, size_t buffer_length)
+	{
+		if (buffer_length < DELTA_FRAME_HEADER_SIZE)
+		{
+			return 0;
+		}
+		size_t body_length = EncodeBinaryFrame(frame, buffer + DELTA_FRAME_HEADER_SIZE, buffer_length - DELTA_FRAME_HEADER_SIZE);
+		if (body_length == 0)
+		{
+			return 0;
+		}
+
+		keyframe_sequence = sequence;
+		WriteHeader(buffer, DELTA_KIND_KEYFRAME, frame);
+		keyframe = *frame;
+		has_keyframe = true;
+		frames_since_keyframe = 0;
+		return DELTA_FRAME_HEADER_SIZE + body_length;
+	}
+
+	/// Returns 0 if the frame can not be written as a delta
+	size_t EncodeDelta(const FrameData* frame, char* buffer, size_t buffer_length)
+	{
+		if (buffer_length < DELTA_FRAME_HEADER_SIZE)
+		{
+			return 0;
+		}
+		char* cursor = buffer + DELTA_FRAME_HEADER_SIZE;
+		char* end = buffer + buffer_length;
+		for (int i = 0; i < MAX_HANDS_PER_FRAME; ++i)
+		{
+			if (HasHand(frame, i) && !EncodeDeltaHand(&frame->hands[i], &keyframe.hands[i].palm, &cursor, end))
+			{
+				return 0;
+			}
+		}
+
+		WriteHeader(buffer, DELTA_KIND_DELTA, frame);
+		++frames_since_keyframe;
+		return cursor - buffer;
+	}
+
+	bool EncodeDeltaHand(const HandData* hand, const Float3* keyframe_palm, char** cursor, char* end)
+	{
+		const Float3 zero = { 0.0f, 0.0f, 0.0f };
+		int finger_count = hand->finger_count < MAX_FINGERS_PER_HAND ? hand->finger_count : MAX_FINGERS_PER_HAND;
+		size_t hand_size = BINARY_HAND_HEADER_SIZE +
+			(BINARY_HAND_FLOAT_COUNT + (hand->forearm.is_valid ? BINARY_FOREARM_FLOAT_COUNT : 0) +
+			finger_count * BINARY_FINGER_FLOAT_COUNT) * sizeof(int16_t);
+		if ((size_t)(end - *cursor) < hand_size)
+		{
+			return false;
+		}
+
+		// Same hand header as the binary frame
+		uint8_t extended_mask = 0;
+		for (int i = 0; i < finger_count; ++i)
+		{
+			if (hand->fingers[i].is_extended)
+			{
+				extended_mask |= (uint8_t)(1 << i);
+			}
+		}
+		char* header = *cursor;
+		header[0] = (char)finger_count;
+		header[1] = (char)(hand->forearm.is_valid ? 1 : 0);
+		header[2] = (char)extended_mask;
+		for (int i = 0; i < MAX_FINGERS_PER_HAND; ++i)
+		{
+			header[3 + i] = (char)(i < finger_count ? hand->fingers[i].type : 0);
+		}
+		*cursor += BINARY_HAND_HEADER_SIZE;
+
+		// Offsets are taken from the palm the receiver will reconstruct, so that the quantization error of the palm
+		// does not add up with the error of the other positions
+		Float3 palm = Requantize3(&hand->palm, keyframe_palm, POSITION_QUANTUM);
+		bool fits = WriteQuantized3(cursor, &hand->palm, keyframe_palm, POSITION_QUANTUM) &&
+			WriteQuantized3(cursor, &hand->stabilized_palm, &palm, POSITION_QUANTUM) &&
+			WriteQuantized3(cursor, &hand->palm_normal, &zero, DIRECTION_QUANTUM) &&
+			WriteQuantized3(cursor, &hand->palm_velocity, &zero, VELOCITY_QUANTUM) &&
+			WriteQuantized3(cursor, &hand->palm_to_fingers, &zero, DIRECTION_QUANTUM) &&
+			WriteQuantized(cursor, hand->grab_angle, ANGLE_QUANTUM) &&
+			WriteQuantized(cursor, hand->pinch_distance, POSITION_QUANTUM);
+
+		if (fits && hand->forearm.is_valid)
+		{
+			fits = WriteQuantized3(cursor, &hand->forearm.wrist, &palm, POSITION_QUANTUM) &&
+				WriteQuantized3(cursor, &hand->forearm.direction, &zero, DIRECTION_QUANTUM) &&
+				WriteQuantized3(cursor, &hand->forearm.elbow, &palm, POSITION_QUANTUM);
+		}
+
+		for (int i = 0; i < finger_count && fits; ++i)
+		{
+			const FingerData* finger = &hand->fingers[i];
+			fits = WriteQuantized3(cursor, &finger->direction, &zero, DIRECTION_QUANTUM) &&
+				WriteQuantized3(cursor, &finger->tip, &palm, POSITION_QUANTUM) &&
+				WriteQuantized3(cursor, &finger->stabilized_tip, &palm, POSITION_QUANTUM) &&
+				WriteQuantized3(cursor, &finger->tip_velocity, &zero, VELOCITY_QUANTUM);
+		}
+
+		return fits;
+	}
+};
+
+/// Reconstructs frames from the messages written by DeltaFrameEncoder. Deltas that refer to a keyframe the decoder
+/// has not received are rejected with NEED_KEYFRAME, in which case the sender should be asked for a new keyframe.
+class DeltaFrameDecoder
+{
+public:
+
+	DeltaFrameDecoder() {}
+
+	DeltaDecodeResult Decode(const char* buffer, size_t length, FrameData* frame)
+	{
+		if (length < DELTA_FRAME_HEADER_SIZE ||
+			buffer[0] != DELTA_FRAME_MAGIC_0 ||
+			buffer[1] != DELTA_FRAME_MAGIC_1 ||
+			(uint8_t)buffer[2] != DELTA_FRAME_VERSION)
+		{
+			return DeltaDecodeResult::INVALID;
+		}
+
+		uint8_t kind = (uint8_t)buffer[3];
+		uint16_t sequence = ReadDeltaUInt16(buffer + 4);
+		uint16_t keyframe_sequence = ReadDeltaUInt16(buffer + 6);
+		uint8_t hand_mask = (uint8_t)buffer[8];
+		DatagramStamp stamp;
+		ReadDatagramStamp(buffer + DELTA_FRAME_STAMP_OFFSET, &stamp);
+
+		// Count messages lost in between. Sequence numbers wrap around at 2^16.
+		if (has_sequence)
+		{
+			uint16_t gap = (uint16_t)(sequence - last_sequence);
+			if (gap > 1 && gap < 0x8000)
+			{
+				lost_messages += gap - 1;
+			}
+		}
+		last_sequence = sequence;
+		has_sequence = true;
+
+		if (kind == DELTA_KIND_KEYFRAME)
+		{
+			if (!DecodeBinaryFrame(buffer + DELTA_FRAME_HEADER_SIZE, length - DELTA_FRAME_HEADER_SIZE, &keyframe))
+			{
+				return DeltaDecodeResult::INVALID;
+			}
+			current_keyframe_sequence = keyframe_sequence;
+			has_keyframe = true;
+			*frame = keyframe;
+			frame->id = stamp.frame_id;
+			frame->capture_timestamp = stamp.capture_timestamp;
+			return DeltaDecodeResult::FRAME;
+		}
+
+		if (kind != DELTA_KIND_DELTA)
+		{
+			return DeltaDecodeResult::INVALID;
+		}
+
+		// The keyframe this delta is relative to was lost or has not arrived yet
+		if (!has_keyframe || keyframe_sequence != current_keyframe_sequence || hand_mask != keyframe.hand_mask)
+		{
+			return DeltaDecodeResult::NEED_KEYFRAME;
+		}
+
+		frame->id = stamp.frame_id;
+		frame->capture_timestamp = stamp.capture_timestamp;
+		frame->hand_mask = hand_mask;
+		const char* cursor = buffer + DELTA_FRAME_HEADER_SIZE;
+		const char* end = buffer + length;
+		for (int i = 0; i < MAX_HANDS_PER_FRAME; ++i)
+		{
+			if (HasHand(frame, i) && !DecodeDeltaHand(&cursor, end, &keyframe.hands[i].palm, &frame->hands[i]))
+			{
+				return DeltaDecodeResult::INVALID;
+			}
+		}
+		return DeltaDecodeResult::FRAME;
+	}
+
+	/// Number of messages missing from the sequence so far
+	uint32_t LostMessages() const
+	{
+		return lost_messages;
+	}
+
+private:
+
+	bool				has_keyframe				= false;
+	bool				has_sequence				= false;
+	uint16_t			current_keyframe_sequence	= 0;
+	uint16_t			last_sequence				= 0;
+	uint32_t			lost_messages				= 0;
+	FrameData			keyframe;
+
+	bool DecodeDeltaHand(const char** cursor, const char* end, const Float3* keyframe_palm, HandData* hand)
+	{
+		const Float3 zero = { 0.0f, 0.0f, 0.0f };
+		if (end - *cursor < BINARY_HAND_HEADER_SIZE)
+		{
+			return false;
+		}
+
+		const char* header = *cursor;
+		int finger_count = (uint8_t)header[0];
+		bool forearm_valid = header[1] != 0;
+		uint8_t extended_mask = (uint8_t)header[2];
+		if (finger_count > MAX_FINGERS_PER_HAND)
+		{
+			return false;
+		}
+		size_t hand_size = BINARY_HAND_HEADER_SIZE +
+			(BINARY_HAND_FLOAT_COUNT + (forearm_valid ? BINARY_FOREARM_FLOAT_COUNT : 0) +
+			finger_count * BINARY_FINGER_FLOAT_COUNT) * sizeof(int16_t);
+		if ((size_t)(end - *cursor) < hand_size)
+		{
+			return false;
+		}
+
+		hand->finger_count = finger_count;
+		hand->forearm.is_valid = forearm_valid;
+		for (int i = 0; i < MAX_FINGERS_PER_HAND; ++i)
+		{
+			hand->fingers[i].type = (uint8_t)header[3 + i];
+			hand->fingers[i].is_extended = (extended_mask & (1 << i)) != 0;
+		}
+		*cursor += BINARY_HAND_HEADER_SIZE;
+
+		ReadQuantized3(cursor, &hand->palm, keyframe_palm, POSITION_QUANTUM);
+		ReadQuantized3(cursor, &hand->stabilized_palm, &hand->palm, POSITION_QUANTUM);
+		ReadQuantized3(cursor, &hand->palm_normal, &zero, DIRECTION_QUANTUM);
+		ReadQuantized3(cursor, &hand->palm_velocity, &zero, VELOCITY_QUANTUM);
+		ReadQuantized3(cursor, &hand->palm_to_fingers, &zero, DIRECTION_QUANTUM);
+		hand->grab_angle = ReadQuantized(cursor, ANGLE_QUANTUM);
+		hand->pinch_distance = ReadQuantized(cursor, POSITION_QUANTUM);
+
+		if (forearm_valid)
+		{
+			ReadQuantized3(cursor, &hand->forearm.wrist, &hand->palm, POSITION_QUANTUM);
+			ReadQuantized3(cursor, &hand->forearm.direction, &zero, DIRECTION_QUANTUM);
+			ReadQuantized3(cursor, &hand->forearm.elbow, &hand->palm, POSITION_QUANTUM);
+		}
+
+		for (int i = 0; i < finger_count; ++i)
+		{
+			FingerData* finger = &hand->fingers[i];
+			ReadQuantized3(cursor, &finger->direction, &zero, DIRECTION_QUANTUM);
+			ReadQuantized3(cursor, &finger->tip, &hand->palm, POSITION_QUANTUM);
+			ReadQuantized3(cursor, &finger->stabilized_tip, &hand->palm, POSITION_QUANTUM);
+			ReadQuantized3(cursor, &finger->tip_velocity, &zero, VELOCITY_QUANTUM);
+		}
+
+		return true;
+	}
+};
+
+/// Returns true if the encoded delta stream message is a keyframe
+inline bool IsDeltaKeyframe(const char* buffer, size_t length)
+{
+	return length >= DELTA_FRAME_HEADER_SIZE && (uint8_t)buffer[3] == DELTA_KIND_KEYFRAME;
+}
+
+/// Fills in the send fields of an encoded delta stream message
+inline void StampDeltaFrame(char* buffer, size_t length, uint32_t sequence, int64_t send_timestamp)
+{
+	if (length >= DELTA_FRAME_HEADER_SIZE)
+	{
+		WriteDatagramSendStamp(buffer + DELTA_FRAME_STAMP_OFFSET, sequence, send_timestamp);
+	}
+}
+
+/// Reads the stamp of an encoded delta stream message
+inline bool ReadDeltaFrameStamp(const char* buffer, size_t length, DatagramStamp* stamp)
+{
+	if (length < DELTA_FRAME_HEADER_SIZE ||
+		buffer[0] != DELTA_FRAME_MAGIC_0 ||
+		buffer[1] != DELTA_FRAME_MAGIC_1 ||
+		(uint8_t)buffer[2] != DELTA_FRAME_VERSION)
+	{
+		return false;
+	}
+	ReadDatagramStamp(buffer + DELTA_FRAME_STAMP_OFFSET, stamp);
+	return true;
+}
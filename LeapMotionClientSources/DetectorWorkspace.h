@@ -0,0 +1,49 @@
+#pragma once
+
+#include "SkinClassifier.h"
+
+#include <memory>
+#include <vector>
+#include "opencv2/core.hpp"
+
+using namespace std;
+using namespace cv;
+
+/// The buffers HandDetector and FingertipDetector work in, kept from one image to the next. Once the detectors have
+/// seen an image of a resolution, further images of it are processed in the same buffers, so that detecting hands and
+/// fingertips in many images does not allocate and free a dozen full size images for each. A workspace is used by one
+/// thread at a time; threads that detect at the same time each need their own.
+struct DetectorWorkspace
+{
+	// HandDetector
+	Mat								surround_image;
+	Mat								initial_guess;
+	Mat								filtered_image;
+	Mat								integral_image;
+	Mat								morphology_image;
+	Mat								labels;
+	Mat								stats;
+	Mat								centroids;
+	vector<vector<Point>>			contours;
+	vector<Vec4i>					hierarchy;
+	// The result of DetectHands, valid until the workspace is used again
+	Mat								hands;
+	// The classifier of the skin model last used, made again only when the model is reloaded
+	shared_ptr<const SkinModel>		skin_model;
+	unique_ptr<SkinClassifier>		skin_classifier;
+
+	// FingertipDetector
+	Mat								hand_labels;
+	Mat								hand_stats;
+	Mat								hand_centroids;
+	Mat								hand_images[2];
+	Mat								opened_image;
+	Mat								top_hat_image;
+	Mat								finger_labels;
+	Mat								finger_stats;
+	Mat								finger_centroids;
+	// Labels of the top hat areas, largest first, and their areas
+	vector<int>						ordered_labels;
+	vector<int>						label_areas;
+	vector<Point2f>					tips;
+};
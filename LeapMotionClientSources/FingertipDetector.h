@@ -1,14 +1,14 @@
 #pragma once
 
-#include "stdafx.h"
-#include "opencv2\core.hpp"
-#include "opencv2\highgui.hpp"
-#include "opencv2\imgproc\imgproc.hpp"
-#include <list>
+#include "DetectorWorkspace.h"
+#include <algorithm>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "opencv2/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 
 using namespace std;
 using namespace cv;
-using namespace concurrency;
 
 class FingertipDetector
 {
@@ -19,14 +19,16 @@ public:
 		opening_kernel = getStructuringElement(MORPH_ELLIPSE, Size(opening_kernel_size, opening_kernel_size));
 	}
 
-	/// Find all fingertips in an image containing two hands and returns them ordered left to right
-	void FindFingertips(Mat* source_image, vector<Point2f>* fingertips)
+	/// Find all fingertips in an image containing two hands and returns them ordered left to right. The images in
+	/// between are kept in the workspace.
+	void FindFingertips(Mat* source_image, vector<Point2f>* fingertips, DetectorWorkspace* workspace)
 	{
 		// Separate each hand into separate images
-		Mat h1, h2;
-		Mat hand_labels;
-		Mat stats;
-		Mat centroids;
+		Mat& h1 = workspace->hand_images[0];
+		Mat& h2 = workspace->hand_images[1];
+		Mat& hand_labels = workspace->hand_labels;
+		Mat& stats = workspace->hand_stats;
+		Mat& centroids = workspace->hand_centroids;
 		
 		int label_amt = connectedComponentsWithStats(*source_image, hand_labels, stats, centroids);
 		// Background always has label 0, so we get the hands from labels 1 and 2
@@ -34,9 +36,10 @@ public:
 		inRange(hand_labels, 2, 2, h2);
 
 		// Find all fingertips for each hand and then sort them left to right
-		vector<Point2f> tips;
-		AnalyzeHand(&h1, &tips);
-		AnalyzeHand(&h2, &tips);
+		vector<Point2f>& tips = workspace->tips;
+		tips.clear();
+		AnalyzeHand(&h1, &tips, workspace);
+		AnalyzeHand(&h2, &tips, workspace);
 		std::sort(tips.begin(), tips.end(), [](Point2f a, Point2f b)
 		{
 			return a.x < b.x;
@@ -56,12 +59,15 @@ private:
 	Mat			opening_kernel;
 
 	/// Analyzes an image with a single hand in it and extracts the fingertips from it
-	void AnalyzeHand(Mat* hand_image, vector<Point2f>* fingertips)
+	void AnalyzeHand(Mat* hand_image, vector<Point2f>* fingertips, DetectorWorkspace* workspace)
 	{
-		// Open image and create top hat image
-		Mat opened_image, top_hat_image;
-		morphologyEx(*hand_image, opened_image, MORPH_OPEN, opening_kernel, Point(-1, -1), 2);
-		top_hat_image = *hand_image - opened_image;
+		// Open image and create top hat image. The opening is done as morphologyEx does it, with the eroded image kept
+		// in the top hat image until the top hat is taken.
+		Mat& opened_image = workspace->opened_image;
+		Mat& top_hat_image = workspace->top_hat_image;
+		erode(*hand_image, top_hat_image, opening_kernel, Point(-1, -1), 2);
+		dilate(top_hat_image, opened_image, opening_kernel, Point(-1, -1), 2);
+		subtract(*hand_image, opened_image, top_hat_image);
 		//Find centroid
 		Moments m = moments(opened_image, true);
 		Point centroid(m.m10 / m.m00, m.m01 / m.m00);
@@ -76,9 +82,14 @@ private:
 		imwrite("./fingertips/tophat.jpg", top_hat_image);*/
 
 		// Find the 5 largest areas from top hat image. These should be the fingers
-		Mat labels, stats, centroids;
+		Mat& labels = workspace->finger_labels;
+		Mat& stats = workspace->finger_stats;
+		Mat& centroids = workspace->finger_centroids;
 		int label_amt = connectedComponentsWithStats(top_hat_image, labels, stats, centroids);
-		list<int> ordered_labels, label_areas;
+		vector<int>& ordered_labels = workspace->ordered_labels;
+		vector<int>& label_areas = workspace->label_areas;
+		ordered_labels.clear();
+		label_areas.clear();
 		// Sort the labels in descending order
 		for (int label = 1; label < label_amt; ++label)
 		{
@@ -120,14 +131,9 @@ private:
 			}
 		}
 
-		// Choose the 5 largest labels
-		vector<int> fingers;
-		auto iter = ordered_labels.begin();
-		for (int i = 0; i < 5; ++i)
-		{
-			fingers.push_back(*iter);
-			++iter;
-		}
+		// Choose the 5 largest labels, or all of them if there are fewer
+		int finger_count = min(5, (int)ordered_labels.size());
+		const int* fingers = ordered_labels.data();
 
 		/*Mat hand_colour;
 		cvtColor(*hand_image, hand_colour, COLOR_GRAY2BGR);
@@ -135,10 +141,9 @@ private:
 		Mat fingers_image = Mat::zeros(hand_colour.size(), CV_8U);*/
 
 		// Find all fingertips and add them to output
-		vector<Point2f> tips;
 		int rows = labels.rows;
 		int cols = labels.cols;
-		for (int i = 0; i < fingers.size(); ++i)
+		for (int i = 0; i < finger_count; ++i)
 		{
 			int finger_label = fingers[i];
 			Point2i furthest_point;
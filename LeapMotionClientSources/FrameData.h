@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+
+#define MAX_HANDS_PER_FRAME			2
+#define MAX_FINGERS_PER_HAND		5
+#define LEFT_HAND_INDEX				0
+#define RIGHT_HAND_INDEX			1
+#define LEFT_HAND_BIT				0x01
+#define RIGHT_HAND_BIT				0x02
+
+/// Three component vector used by the plain frame model
+struct Float3
+{
+	float x;
+	float y;
+	float z;
+};
+
+/// Forearm of a single hand
+struct ForearmData
+{
+	bool		is_valid;
+	Float3		wrist;
+	Float3		direction;
+	Float3		elbow;
+};
+
+/// Single finger of a hand
+struct FingerData
+{
+	int32_t		type;
+	bool		is_extended;
+	Float3		direction;
+	Float3		tip;
+	Float3		stabilized_tip;
+	Float3		tip_velocity;
+};
+
+/// Single hand together with its valid fingers and its forearm
+struct HandData
+{
+	Float3		palm;
+	Float3		stabilized_palm;
+	Float3		palm_normal;
+	Float3		palm_velocity;
+	Float3		palm_to_fingers;
+	float		grab_angle;
+	float		pinch_distance;
+	int32_t		finger_count;
+	FingerData	fingers[MAX_FINGERS_PER_HAND];
+	ForearmData	forearm;
+};
+
+/// Plain copy of the fields of a Leap frame that are streamed to the Hololens. All values are already converted to
+/// the streamed coordinate system, i.e. they are exactly the values written to the JSON. The struct does not depend
+/// on the Leap SDK so it can be encoded, decoded, and stored without one.
+struct FrameData
+{
+	int64_t		id;
+	int64_t		capture_timestamp;
+	uint8_t		hand_mask;
+	HandData	hands[MAX_HANDS_PER_FRAME];
+};
+
+/// Returns the hand presence bit of the hand with the given index
+inline uint8_t HandBit(int hand_index)
+{
+	return hand_index == LEFT_HAND_INDEX ? LEFT_HAND_BIT : RIGHT_HAND_BIT;
+}
+
+/// Returns true if the frame contains the hand with the given index
+inline bool HasHand(const FrameData* frame, int hand_index)
+{
+	return (frame->hand_mask & HandBit(hand_index)) != 0;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "FrameData.h"
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// About four seconds of frames at the Leap's highest frame rate
+#define FRAME_HISTORY_CAPACITY			512
+
+inline Float3 LerpFloat3(const Float3& a, const Float3& b, float t)
+{
+	Float3 result;
+	result.x = a.x + t * (b.x - a.x);
+	result.y = a.y + t * (b.y - a.y);
+	result.z = a.z + t * (b.z - a.z);
+	return result;
+}
+
+/// Interpolates the vectors of two hands with the same fingers. Directions and normals are interpolated like
+/// positions and not renormalized, which is close enough for frames a few milliseconds apart.
+inline void InterpolateHands(const HandData* a, const HandData* b, float t, HandData* result)
+{
+	result->palm = LerpFloat3(a->palm, b->palm, t);
+	result->stabilized_palm = LerpFloat3(a->stabilized_palm, b->stabilized_palm, t);
+	result->palm_normal = LerpFloat3(a->palm_normal, b->palm_normal, t);
+	result->palm_velocity = LerpFloat3(a->palm_velocity, b->palm_velocity, t);
+	result->palm_to_fingers = LerpFloat3(a->palm_to_fingers, b->palm_to_fingers, t);
+	result->grab_angle = a->grab_angle + t * (b->grab_angle - a->grab_angle);
+	result->pinch_distance = a->pinch_distance + t * (b->pinch_distance - a->pinch_distance);
+	for (int f = 0; f < a->finger_count; ++f)
+	{
+		const FingerData* finger_a = &a->fingers[f];
+		const FingerData* finger_b = &b->fingers[f];
+		FingerData* finger = &result->fingers[f];
+		finger->direction = LerpFloat3(finger_a->direction, finger_b->direction, t);
+		finger->tip = LerpFloat3(finger_a->tip, finger_b->tip, t);
+		finger->stabilized_tip = LerpFloat3(finger_a->stabilized_tip, finger_b->stabilized_tip, t);
+		finger->tip_velocity = LerpFloat3(finger_a->tip_velocity, finger_b->tip_velocity, t);
+	}
+	if (a->forearm.is_valid && b->forearm.is_valid)
+	{
+		result->forearm.wrist = LerpFloat3(a->forearm.wrist, b->forearm.wrist, t);
+		result->forearm.direction = LerpFloat3(a->forearm.direction, b->forearm.direction, t);
+		result->forearm.elbow = LerpFloat3(a->forearm.elbow, b->forearm.elbow, t);
+	}
+}
+
+/// Linear interpolation between two frames, t = 0 giving a and t = 1 giving b. Hands are only interpolated when both
+/// frames have them with the same fingers, otherwise they are taken from the closer frame.
+inline void InterpolateFrames(const FrameData* a, const FrameData* b, float t, FrameData* result)
+{
+	*result = t < 0.5f ? *a : *b;
+	result->capture_timestamp = a->capture_timestamp + (int64_t)(t * (float)(b->capture_timestamp - a->capture_timestamp));
+	for (int h = 0; h < MAX_HANDS_PER_FRAME; ++h)
+	{
+		if (HasHand(a, h) && HasHand(b, h) && a->hands[h].finger_count == b->hands[h].finger_count)
+		{
+			InterpolateHands(&a->hands[h], &b->hands[h], t, &result->hands[h]);
+		}
+	}
+}
+
+/// The most recent frames, each with the time it was captured. The storage is allocated once, so adding a frame is a
+/// copy into the oldest slot, and looking a time up is a binary search. Frames are added by one thread and looked up
+/// by others; the lock is only held for the copy or the search.
+class FrameHistory
+{
+public:
+
+	FrameHistory(size_t capacity = FRAME_HISTORY_CAPACITY) : entries(capacity)
+	{
+	}
+
+	/// Adds a frame captured at the given time, replacing the oldest frame once the history is full. Times must not
+	/// decrease from one frame to the next.
+	void Add(int64_t timestamp, const FrameData& frame)
+	{
+		lock_guard<mutex> lock(history_mutex);
+		Entry* entry = &entries[next_index];
+		entry->timestamp = timestamp;
+		entry->frame = frame;
+		next_index = (next_index + 1) % entries.size();
+		count = count < entries.size() ? count + 1 : count;
+	}
+
+	void Clear()
+	{
+		lock_guard<mutex> lock(history_mutex);
+		count = 0;
+	}
+
+	size_t Count() const
+	{
+		lock_guard<mutex> lock(history_mutex);
+		return count;
+	}
+
+	/// Copies the frame captured closest to the given time. Returns false if the history is empty.
+	bool FindClosest(int64_t timestamp, FrameData* frame) const
+	{
+		lock_guard<mutex> lock(history_mutex);
+		if (count == 0)
+		{
+			return false;
+		}
+		size_t after = LowerBound(timestamp);
+		size_t closest = after;
+		if (after == count || (after > 0 && timestamp - At(after - 1)->timestamp < At(after)->timestamp - timestamp))
+		{
+			closest = after - 1;
+		}
+		*frame = At(closest)->frame;
+		return true;
+	}
+
+	/// Interpolates between the two frames captured around the given time. Times outside of the history get the
+	/// oldest or the newest frame. Returns false if the history is empty.
+	bool Interpolate(int64_t timestamp, FrameData* frame) const
+	{
+		lock_guard<mutex> lock(history_mutex);
+		if (count == 0)
+		{
+			return false;
+		}
+		size_t after = LowerBound(timestamp);
+		if (after == 0 || after == count)
+		{
+			*frame = At(after == 0 ? 0 : count - 1)->frame;
+			return true;
+		}
+		const Entry* a = At(after - 1);
+		const Entry* b = At(after);
+		float t = b->timestamp > a->timestamp ? (float)(timestamp - a->timestamp) / (float)(b->timestamp - a->timestamp) : 0.0f;
+		InterpolateFrames(&a->frame, &b->frame, t, frame);
+		return true;
+	}
+
+private:
+
+	struct Entry
+	{
+		int64_t		timestamp;
+		FrameData	frame;
+	};
+
+	vector<Entry>		entries;
+	size_t				next_index		= 0;
+	size_t				count			= 0;
+	mutable mutex		history_mutex;
+
+	/// Entry by age, 0 being the oldest
+	const Entry* At(size_t age) const
+	{
+		return &entries[(next_index + entries.size() - count + age) % entries.size()];
+	}
+
+	/// Age of the first entry captured at or after the given time, or count if there is none
+	size_t LowerBound(int64_t timestamp) const
+	{
+		size_t low = 0;
+		size_t high = count;
+		while (low < high)
+		{
+			size_t middle = low + (high - low) / 2;
+			if (At(middle)->timestamp < timestamp)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return low;
+	}
+};
@@ -0,0 +1,397 @@
+#pragma once
+
+#include "FrameData.h"
+#include "BinaryFrameEncoding.h"
+#include "DatagramStamp.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Frame log layout, all values little-endian:
+//
+// Header (FRAME_LOG_HEADER_SIZE bytes)
+//   uint8 magic[4]				'L', 'F', 'L', 'G'
+//   uint32 version				FRAME_LOG_VERSION
+//   uint32 record_size			FRAME_LOG_RECORD_SIZE
+//   uint32 reserved
+//   uint64 record_count		updated after every appended record
+// record_count records of FRAME_LOG_RECORD_SIZE bytes, in the order they were recorded
+//   int64 recorded_timestamp	client wall clock in microseconds when the frame was recorded
+//   uint32 frame_length		length of the binary frame that follows
+//   uint32 reserved
+//   binary frame				see BinaryFrameEncoding.h, padded with zeros to BINARY_FRAME_MAX_SIZE
+//
+// Since every record has the same size the records themselves are the index: record i starts at
+// FRAME_LOG_HEADER_SIZE + i * FRAME_LOG_RECORD_SIZE, and as frames are recorded in capture order a capture timestamp
+// can be found with a binary search.
+
+#define FRAME_LOG_MAGIC					"LFLG"
+#define FRAME_LOG_VERSION				1
+#define FRAME_LOG_HEADER_SIZE			64
+#define FRAME_LOG_RECORD_HEADER_SIZE	16
+#define FRAME_LOG_RECORD_SIZE			(FRAME_LOG_RECORD_HEADER_SIZE + BINARY_FRAME_MAX_SIZE)
+#define FRAME_LOG_COUNT_OFFSET			16
+// Room for about ten seconds of frames at the Leap's frame rate. The file grows by doubling.
+#define FRAME_LOG_INITIAL_CAPACITY		(FRAME_LOG_HEADER_SIZE + 1024 * FRAME_LOG_RECORD_SIZE)
+
+/// A file mapped into memory, either read-only or read-write with a size that can be changed
+class MappedFile
+{
+public:
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	/// Creates or truncates the file and maps it read-write with the given size
+	bool Create(const string& path, size_t size)
+	{
+		Close();
+		is_writable = true;
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+#else
+		file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (file < 0)
+		{
+			return false;
+		}
+#endif
+		return Resize(size);
+	}
+
+	/// Maps an existing file read-only
+	bool OpenRead(const string& path)
+	{
+		Close();
+		is_writable = false;
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+		LARGE_INTEGER file_size;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size))
+		{
+			return false;
+		}
+		size = (size_t)file_size.QuadPart;
+#else
+		file = open(path.c_str(), O_RDONLY);
+		struct stat file_stat;
+		if (file < 0 || fstat(file, &file_stat) != 0)
+		{
+			return false;
+		}
+		size = (size_t)file_stat.st_size;
+#endif
+		return Map();
+	}
+
+	/// Writable files only. Changes the size of the file and maps it again, which invalidates Data.
+	bool Resize(size_t new_size)
+	{
+		Unmap();
+#ifdef _WIN32
+		LARGE_INTEGER position;
+		position.QuadPart = (LONGLONG)new_size;
+		if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN) || !SetEndOfFile(file))
+		{
+			return false;
+		}
+#else
+		if (ftruncate(file, (off_t)new_size) != 0)
+		{
+			return false;
+		}
+#endif
+		size = new_size;
+		return Map();
+	}
+
+	void Close()
+	{
+		Unmap();
+#ifdef _WIN32
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (file >= 0)
+		{
+			close(file);
+			file = -1;
+		}
+#endif
+		size = 0;
+	}
+
+	char* Data()
+	{
+		return data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+private:
+
+#ifdef _WIN32
+	HANDLE		file			= INVALID_HANDLE_VALUE;
+	HANDLE		mapping			= NULL;
+#else
+	int			file			= -1;
+#endif
+	char*		data			= nullptr;
+	size_t		size			= 0;
+	bool		is_writable		= false;
+
+	bool Map()
+	{
+		if (size == 0)
+		{
+			return false;
+		}
+#ifdef _WIN32
+		ULARGE_INTEGER mapping_size;
+		mapping_size.QuadPart = size;
+		mapping = CreateFileMappingA(file, NULL, is_writable ? PAGE_READWRITE : PAGE_READONLY,
+			mapping_size.HighPart, mapping_size.LowPart, NULL);
+		if (mapping == NULL)
+		{
+			return false;
+		}
+		data = (char*)MapViewOfFile(mapping, is_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+		return data != nullptr;
+#else
+		void* mapped = mmap(NULL, size, is_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+		data = mapped == MAP_FAILED ? nullptr : (char*)mapped;
+		return data != nullptr;
+#endif
+	}
+
+	void Unmap()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+		}
+		if (mapping != NULL)
+		{
+			CloseHandle(mapping);
+			mapping = NULL;
+		}
+#else
+		if (data != nullptr)
+		{
+			munmap(data, size);
+		}
+#endif
+		data = nullptr;
+	}
+};
+
+/// Appends frames to a frame log. Appending is a copy into the mapped file, so it is cheap enough to do on the thread
+/// that produces the frames. Not thread-safe: all calls must come from the same thread, or be serialized.
+class FrameLogWriter
+{
+public:
+
+	~FrameLogWriter()
+	{
+		Close();
+	}
+
+	bool Open(const string& path)
+	{
+		record_count = 0;
+		if (!file.Create(path, FRAME_LOG_INITIAL_CAPACITY))
+		{
+			file.Close();
+			return false;
+		}
+
+		char* header = file.Data();
+		memset(header, 0, FRAME_LOG_HEADER_SIZE);
+		memcpy(header, FRAME_LOG_MAGIC, 4);
+		WriteStampUInt32(header + 4, FRAME_LOG_VERSION);
+		WriteStampUInt32(header + 8, FRAME_LOG_RECORD_SIZE);
+		WriteStampInt64(header + FRAME_LOG_COUNT_OFFSET, 0);
+		return true;
+	}
+
+	bool IsOpen()
+	{
+		return file.Data() != nullptr;
+	}
+
+	/// Appends the frame. Returns false if the log is not open or could not be grown.
+	bool Append(const FrameData* frame)
+	{
+		if (!IsOpen())
+		{
+			return false;
+		}
+
+		size_t record_offset = FRAME_LOG_HEADER_SIZE + (size_t)record_count * FRAME_LOG_RECORD_SIZE;
+		if (record_offset + FRAME_LOG_RECORD_SIZE > file.Size() && !file.Resize(file.Size() * 2))
+		{
+			return false;
+		}
+
+		char* record = file.Data() + record_offset;
+		size_t frame_length = EncodeBinaryFrame(frame, record + FRAME_LOG_RECORD_HEADER_SIZE, BINARY_FRAME_MAX_SIZE);
+		WriteStampInt64(record, CurrentTimestamp());
+		WriteStampUInt32(record + 8, (uint32_t)frame_length);
+		WriteStampUInt32(record + 12, 0);
+		memset(record + FRAME_LOG_RECORD_HEADER_SIZE + frame_length, 0, BINARY_FRAME_MAX_SIZE - frame_length);
+
+		// The count is written last so that a log cut short by a crash still only covers complete records
+		++record_count;
+		WriteStampInt64(file.Data() + FRAME_LOG_COUNT_OFFSET, (int64_t)record_count);
+		return true;
+	}
+
+	uint64_t Count() const
+	{
+		return record_count;
+	}
+
+	/// Trims the file to the recorded frames and closes it
+	void Close()
+	{
+		if (IsOpen())
+		{
+			file.Resize(FRAME_LOG_HEADER_SIZE + (size_t)record_count * FRAME_LOG_RECORD_SIZE);
+		}
+		file.Close();
+	}
+
+private:
+
+	MappedFile		file;
+	uint64_t		record_count	= 0;
+};
+
+/// Reads frames from a frame log by index
+class FrameLogReader
+{
+public:
+
+	bool Open(const string& path)
+	{
+		record_count = 0;
+		if (!file.OpenRead(path) || file.Size() < FRAME_LOG_HEADER_SIZE)
+		{
+			file.Close();
+			return false;
+		}
+
+		const char* header = file.Data();
+		if (memcmp(header, FRAME_LOG_MAGIC, 4) != 0 ||
+			ReadStampUInt32(header + 4) != FRAME_LOG_VERSION ||
+			ReadStampUInt32(header + 8) != FRAME_LOG_RECORD_SIZE)
+		{
+			file.Close();
+			return false;
+		}
+
+		// Never trust the count beyond what the file actually holds
+		uint64_t stored_count = (uint64_t)ReadStampInt64(header + FRAME_LOG_COUNT_OFFSET);
+		uint64_t available_count = (file.Size() - FRAME_LOG_HEADER_SIZE) / FRAME_LOG_RECORD_SIZE;
+		record_count = stored_count < available_count ? stored_count : available_count;
+		return true;
+	}
+
+	uint64_t Count() const
+	{
+		return record_count;
+	}
+
+	/// Decodes the record with the given index. recorded_timestamp can be null.
+	bool Read(uint64_t index, FrameData* frame, int64_t* recorded_timestamp = nullptr)
+	{
+		if (index >= record_count)
+		{
+			return false;
+		}
+
+		const char* record = Record(index);
+		if (recorded_timestamp != nullptr)
+		{
+			*recorded_timestamp = ReadStampInt64(record);
+		}
+		uint32_t frame_length = ReadStampUInt32(record + 8);
+		return frame_length <= BINARY_FRAME_MAX_SIZE &&
+			DecodeBinaryFrame(record + FRAME_LOG_RECORD_HEADER_SIZE, frame_length, frame);
+	}
+
+	/// Capture timestamp of the record with the given index, read without decoding the frame
+	int64_t CaptureTimestamp(uint64_t index)
+	{
+		DatagramStamp stamp;
+		const char* record = Record(index);
+		if (!ReadBinaryFrameStamp(record + FRAME_LOG_RECORD_HEADER_SIZE, ReadStampUInt32(record + 8), &stamp))
+		{
+			return 0;
+		}
+		return stamp.capture_timestamp;
+	}
+
+	/// Index of the first record captured at or after the given time, or Count() if there is none
+	uint64_t Seek(int64_t capture_timestamp)
+	{
+		uint64_t low = 0;
+		uint64_t high = record_count;
+		while (low < high)
+		{
+			uint64_t middle = low + (high - low) / 2;
+			if (CaptureTimestamp(middle) < capture_timestamp)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return low;
+	}
+
+	void Close()
+	{
+		file.Close();
+		record_count = 0;
+	}
+
+private:
+
+	MappedFile		file;
+	uint64_t		record_count	= 0;
+
+	const char* Record(uint64_t index)
+	{
+		return file.Data() + FRAME_LOG_HEADER_SIZE + (size_t)index * FRAME_LOG_RECORD_SIZE;
+	}
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "FrameData.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+using namespace std;
+
+/// Base class for anything that produces frames. Implementations call SetConnected when the device comes and goes
+/// and PublishFrame for every new frame. Consumers either register a callback, which is called on the producing
+/// thread, or block in WaitForFrame. Nothing polls: waiting threads sleep on a condition variable until a frame
+/// arrives, the source is resumed, or the source is stopped.
+class FrameSource
+{
+public:
+
+	virtual ~FrameSource() {}
+
+	/// Start producing frames
+	virtual void Start() = 0;
+
+	/// Stop producing frames and wake up every waiting thread
+	virtual void Stop()
+	{
+		{
+			lock_guard<mutex> lock(source_mutex);
+			is_stopped = true;
+		}
+		source_condition.notify_all();
+	}
+
+	/// Waits until the source is connected. Returns false if the timeout passed or the source was stopped first.
+	bool WaitForConnection(chrono::milliseconds timeout)
+	{
+		unique_lock<mutex> lock(source_mutex);
+		source_condition.wait_for(lock, timeout, [this] { return is_connected || is_stopped; });
+		return is_connected && !is_stopped;
+	}
+
+	/// Waits for a frame newer than the last one returned. While the source is paused the caller stays parked here.
+	/// Returns false if the timeout passed or the source was stopped before a frame arrived.
+	bool WaitForFrame(FrameData* frame, chrono::milliseconds timeout)
+	{
+		unique_lock<mutex> lock(source_mutex);
+		bool has_frame = source_condition.wait_for(lock, timeout, [this]
+		{
+			return is_stopped || (!is_paused && published_count != consumed_count);
+		});
+		if (!has_frame || is_stopped)
+		{
+			return false;
+		}
+		*frame = latest_frame;
+		consumed_count = published_count;
+		return true;
+	}
+
+	/// Registers a function that is called with every published frame on the producing thread. Returns only once a call
+	/// of the previous function that is in progress has returned, so that what it uses can be released after clearing
+	/// it. Must not be called from the callback.
+	void SetFrameCallback(function<void(const FrameData&)> callback)
+	{
+		lock_guard<mutex> lock(callback_mutex);
+		frame_callback = callback;
+	}
+
+	/// Frames published while paused are dropped
+	void SetPaused(bool paused)
+	{
+		{
+			lock_guard<mutex> lock(source_mutex);
+			is_paused = paused;
+			// Frames from before the pause are stale once streaming resumes
+			consumed_count = published_count;
+		}
+		source_condition.notify_all();
+	}
+
+	bool IsPaused()
+	{
+		lock_guard<mutex> lock(source_mutex);
+		return is_paused;
+	}
+
+	bool IsConnected()
+	{
+		lock_guard<mutex> lock(source_mutex);
+		return is_connected;
+	}
+
+protected:
+
+	void SetConnected(bool connected)
+	{
+		{
+			lock_guard<mutex> lock(source_mutex);
+			is_connected = connected;
+		}
+		source_condition.notify_all();
+	}
+
+	/// Makes the frame the latest frame and hands it to the callback
+	void PublishFrame(const FrameData& frame)
+	{
+		{
+			lock_guard<mutex> lock(source_mutex);
+			if (is_paused || is_stopped)
+			{
+				return;
+			}
+			latest_frame = frame;
+			++published_count;
+		}
+		source_condition.notify_all();
+
+		// Held during the call, so that SetFrameCallback waits for it
+		lock_guard<mutex> lock(callback_mutex);
+		if (frame_callback)
+		{
+			frame_callback(frame);
+		}
+	}
+
+	/// Lets implementations skip the work of building a frame that would be dropped anyway
+	bool IsAcceptingFrames()
+	{
+		lock_guard<mutex> lock(source_mutex);
+		return !is_paused && !is_stopped;
+	}
+
+	/// Blocks while the source is paused, for sources that can hold their position instead of dropping frames. Returns
+	/// false if the source was stopped.
+	bool WaitWhilePaused()
+	{
+		unique_lock<mutex> lock(source_mutex);
+		source_condition.wait(lock, [this] { return !is_paused || is_stopped; });
+		return !is_stopped;
+	}
+
+	/// Clears the stopped state before the source is started again
+	void ResetStopped()
+	{
+		lock_guard<mutex> lock(source_mutex);
+		is_stopped = false;
+	}
+
+private:
+
+	mutex								source_mutex;
+	condition_variable					source_condition;
+	FrameData							latest_frame;
+	uint64_t							published_count		= 0;
+	uint64_t							consumed_count		= 0;
+	bool								is_connected		= false;
+	bool								is_paused			= false;
+	bool								is_stopped			= false;
+	// Only taken by the producing thread and by SetFrameCallback
+	mutex								callback_mutex;
+	function<void(const FrameData&)>	frame_callback;
+};
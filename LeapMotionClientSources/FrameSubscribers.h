@@ -0,0 +1,141 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+#define MAX_FRAME_SUBSCRIBERS			16
+#define FRAME_ENCODING_COUNT			3
+
+/// Wire format used for the streamed Leap frames
+enum class FrameEncoding
+{
+	JSON,
+	BINARY,
+	DELTA
+};
+
+/// A receiver of the frame stream. The address can also be a multicast group, in which case one datagram reaches
+/// every member of the group.
+struct FrameSubscriber
+{
+	int				id;
+	sockaddr_in		address;
+	FrameEncoding	encoding;
+	// Microseconds between two frames sent to the subscriber, 0 for no limit
+	int64_t			min_interval;
+	int64_t			next_send_timestamp;
+	// Every subscriber has its own datagram sequence so that it can detect its own losses
+	uint32_t		sequence;
+	uint64_t		sent_count;
+	uint64_t		skipped_count;
+};
+
+/// Returns true if the address is an IPv4 multicast group, i.e. in 224.0.0.0/4
+inline bool IsMulticastAddress(const sockaddr_in* address)
+{
+	return (ntohl(address->sin_addr.s_addr) & 0xF0000000) == 0xE0000000;
+}
+
+/// Thread-safe list of the subscribers of the frame stream. Frames are encoded once per encoding in use and the same
+/// bytes are then sent to every subscriber of that encoding, so an extra subscriber only costs a send.
+class FrameSubscribers
+{
+public:
+
+	/// Adds a subscriber that receives at most max_rate frames per second, or every frame if max_rate is 0.
+	/// Returns the id of the subscriber, or -1 if there are already MAX_FRAME_SUBSCRIBERS subscribers.
+	int Add(const sockaddr_in& address, FrameEncoding encoding, double max_rate)
+	{
+		lock_guard<mutex> lock(subscribers_mutex);
+		if (subscribers.size() >= MAX_FRAME_SUBSCRIBERS)
+		{
+			return -1;
+		}
+
+		FrameSubscriber subscriber = {};
+		subscriber.id = next_id++;
+		subscriber.address = address;
+		subscriber.encoding = encoding;
+		subscriber.min_interval = max_rate > 0.0 ? (int64_t)(1e6 / max_rate) : 0;
+		subscribers.push_back(subscriber);
+		return subscriber.id;
+	}
+
+	bool Remove(int id)
+	{
+		lock_guard<mutex> lock(subscribers_mutex);
+		for (auto it = subscribers.begin(); it != subscribers.end(); ++it)
+		{
+			if (it->id == id)
+			{
+				subscribers.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	size_t Count()
+	{
+		lock_guard<mutex> lock(subscribers_mutex);
+		return subscribers.size();
+	}
+
+	/// Bit (1 << encoding) is set for every encoding that at least one subscriber uses
+	uint8_t EncodingMask()
+	{
+		lock_guard<mutex> lock(subscribers_mutex);
+		uint8_t mask = 0;
+		for (const FrameSubscriber& subscriber : subscribers)
+		{
+			mask |= (uint8_t)(1 << (int)subscriber.encoding);
+		}
+		return mask;
+	}
+
+	/// Calls send for every subscriber whose rate limit allows a frame at the given time. Subscribers for which
+	/// must_send returns true, e.g. because the frame is a keyframe, are sent to regardless of the limit. send
+	/// returns true if the frame was sent, which advances the subscriber's sequence.
+	template<typename MustSend, typename Send>
+	void ForEachDue(int64_t now, MustSend must_send, Send send)
+	{
+		lock_guard<mutex> lock(subscribers_mutex);
+		for (FrameSubscriber& subscriber : subscribers)
+		{
+			if (now < subscriber.next_send_timestamp && !must_send(subscriber))
+			{
+				++subscriber.skipped_count;
+				continue;
+			}
+
+			if (send(subscriber))
+			{
+				++subscriber.sequence;
+				++subscriber.sent_count;
+				// Keep the cadence of the limit, but do not let a stall build up a burst of frames
+				subscriber.next_send_timestamp += subscriber.min_interval;
+				if (subscriber.next_send_timestamp < now)
+				{
+					subscriber.next_send_timestamp = now;
+				}
+			}
+		}
+	}
+
+	/// Copy of the current subscribers, e.g. for printing statistics
+	vector<FrameSubscriber> Snapshot()
+	{
+		lock_guard<mutex> lock(subscribers_mutex);
+		return subscribers;
+	}
+
+private:
+
+	mutex						subscribers_mutex;
+	vector<FrameSubscriber>		subscribers;
+	int							next_id				= 0;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "FrameData.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define FRAME_TRANSFORM_USE_SSE
+#endif
+
+using namespace std;
+
+#define LEAP_MM_TO_M						0.001f
+// Vectors of one hand in each of the two batches: palm and forearm vectors plus two vectors for each finger
+#define FRAME_TRANSFORM_VECTORS_PER_HAND	(4 + 2 * MAX_FINGERS_PER_HAND)
+// Rounded up to a multiple of the SIMD width so that the kernel never needs a scalar tail
+#define FRAME_TRANSFORM_BATCH_CAPACITY		((MAX_HANDS_PER_FRAME * FRAME_TRANSFORM_VECTORS_PER_HAND + 3) & ~3)
+
+/// Affine transform from the Leap coordinate system to the streamed coordinate system. Positions are mapped with
+/// linear * p + translation, directions and velocities only with linear * v.
+struct FrameTransform
+{
+	float	linear[9];		// Row major
+	float	translation[3];
+};
+
+/// Structure of arrays of the vectors of one frame, kept together with where each vector came from
+struct FrameVectorBatch
+{
+	alignas(16) float	x[FRAME_TRANSFORM_BATCH_CAPACITY];
+	alignas(16) float	y[FRAME_TRANSFORM_BATCH_CAPACITY];
+	alignas(16) float	z[FRAME_TRANSFORM_BATCH_CAPACITY];
+	Float3*				targets[FRAME_TRANSFORM_BATCH_CAPACITY];
+	size_t				count;
+};
+
+/// The transform used when there is no calibration: Leap's y-up millimetres are turned into the z-up metres of the
+/// stream by swapping y and z, mirroring x, and scaling
+inline void MakeStreamTransform(FrameTransform* transform)
+{
+	const float linear[9] =
+	{
+		-LEAP_MM_TO_M,	0.0f,			0.0f,
+		0.0f,			0.0f,			LEAP_MM_TO_M,
+		0.0f,			LEAP_MM_TO_M,	0.0f
+	};
+	memcpy(transform->linear, linear, sizeof(linear));
+	memset(transform->translation, 0, sizeof(transform->translation));
+}
+
+/// Folds the Leap to camera calibration into the stream transform so that the streamed vectors are already in the
+/// camera's coordinate system. As on the Hololens, the y-axis is flipped after the rigid transform because the camera
+/// is modeled as a pinhole camera whose y-axis points down.
+inline void MakeCalibratedTransform(const double rotation[9], const double translation[3], FrameTransform* transform)
+{
+	FrameTransform stream;
+	MakeStreamTransform(&stream);
+	for (int row = 0; row < 3; ++row)
+	{
+		float flip = row == 1 ? -1.0f : 1.0f;
+		for (int col = 0; col < 3; ++col)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < 3; ++k)
+			{
+				sum += (float)rotation[row * 3 + k] * stream.linear[k * 3 + col];
+			}
+			transform->linear[row * 3 + col] = flip * sum;
+		}
+		transform->translation[row] = flip * (float)translation[row];
+	}
+}
+
+inline void AddToBatch(FrameVectorBatch* batch, Float3* vec)
+{
+	batch->x[batch->count] = vec->x;
+	batch->y[batch->count] = vec->y;
+	batch->z[batch->count] = vec->z;
+	batch->targets[batch->count] = vec;
+	++batch->count;
+}
+
+/// Transforms every vector of the batch in place. Lanes past count are zeroed first so that they hold no denormals.
+inline void TransformVectorBatch(const FrameTransform* transform, FrameVectorBatch* batch, bool translate)
+{
+	size_t padded_count = (batch->count + 3) & ~(size_t)3;
+	for (size_t i = batch->count; i < padded_count; ++i)
+	{
+		batch->x[i] = batch->y[i] = batch->z[i] = 0.0f;
+	}
+
+	const float* m = transform->linear;
+	float tx = translate ? transform->translation[0] : 0.0f;
+	float ty = translate ? transform->translation[1] : 0.0f;
+	float tz = translate ? transform->translation[2] : 0.0f;
+
+#ifdef FRAME_TRANSFORM_USE_SSE
+	__m128 m00 = _mm_set1_ps(m[0]), m01 = _mm_set1_ps(m[1]), m02 = _mm_set1_ps(m[2]);
+	__m128 m10 = _mm_set1_ps(m[3]), m11 = _mm_set1_ps(m[4]), m12 = _mm_set1_ps(m[5]);
+	__m128 m20 = _mm_set1_ps(m[6]), m21 = _mm_set1_ps(m[7]), m22 = _mm_set1_ps(m[8]);
+	__m128 t0 = _mm_set1_ps(tx), t1 = _mm_set1_ps(ty), t2 = _mm_set1_ps(tz);
+	for (size_t i = 0; i < padded_count; i += 4)
+	{
+		__m128 x = _mm_load_ps(batch->x + i);
+		__m128 y = _mm_load_ps(batch->y + i);
+		__m128 z = _mm_load_ps(batch->z + i);
+		__m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m01, y)), _mm_add_ps(_mm_mul_ps(m02, z), t0));
+		__m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, x), _mm_mul_ps(m11, y)), _mm_add_ps(_mm_mul_ps(m12, z), t1));
+		__m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, x), _mm_mul_ps(m21, y)), _mm_add_ps(_mm_mul_ps(m22, z), t2));
+		_mm_store_ps(batch->x + i, rx);
+		_mm_store_ps(batch->y + i, ry);
+		_mm_store_ps(batch->z + i, rz);
+	}
+#else
+	for (size_t i = 0; i < padded_count; ++i)
+	{
+		float x = batch->x[i];
+		float y = batch->y[i];
+		float z = batch->z[i];
+		batch->x[i] = m[0] * x + m[1] * y + m[2] * z + tx;
+		batch->y[i] = m[3] * x + m[4] * y + m[5] * z + ty;
+		batch->z[i] = m[6] * x + m[7] * y + m[8] * z + tz;
+	}
+#endif
+
+	for (size_t i = 0; i < batch->count; ++i)
+	{
+		Float3* target = batch->targets[i];
+		target->x = batch->x[i];
+		target->y = batch->y[i];
+		target->z = batch->z[i];
+	}
+}
+
+/// Applies the transform to every vector of the frame in two batched passes, one for positions and one for
+/// directions and velocities
+inline void TransformFrame(const FrameTransform* transform, FrameData* frame)
+{
+	FrameVectorBatch positions;
+	FrameVectorBatch directions;
+	positions.count = 0;
+	directions.count = 0;
+
+	for (int i = 0; i < MAX_HANDS_PER_FRAME; ++i)
+	{
+		if (!HasHand(frame, i))
+		{
+			continue;
+		}
+
+		HandData* hand = &frame->hands[i];
+		AddToBatch(&positions, &hand->palm);
+		AddToBatch(&positions, &hand->stabilized_palm);
+		AddToBatch(&directions, &hand->palm_normal);
+		AddToBatch(&directions, &hand->palm_velocity);
+		AddToBatch(&directions, &hand->palm_to_fingers);
+
+		if (hand->forearm.is_valid)
+		{
+			AddToBatch(&positions, &hand->forearm.wrist);
+			AddToBatch(&positions, &hand->forearm.elbow);
+			AddToBatch(&directions, &hand->forearm.direction);
+		}
+
+		for (int j = 0; j < hand->finger_count && j < MAX_FINGERS_PER_HAND; ++j)
+		{
+			FingerData* finger = &hand->fingers[j];
+			AddToBatch(&positions, &finger->tip);
+			AddToBatch(&positions, &finger->stabilized_tip);
+			AddToBatch(&directions, &finger->direction);
+			AddToBatch(&directions, &finger->tip_velocity);
+		}
+	}
+
+	TransformVectorBatch(transform, &positions, true);
+	TransformVectorBatch(transform, &directions, false);
+}
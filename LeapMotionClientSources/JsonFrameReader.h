@@ -0,0 +1,356 @@
+#pragma once
+
+#include "FrameData.h"
+#include "DatagramStamp.h"
+
+#include <charconv>
+#include <string.h>
+
+using namespace std;
+
+// Deep enough for a finger inside the fingers array of a hand inside an arm inside the frame, with room for unknown
+// values that are skipped
+#define JSON_READER_MAX_DEPTH			16
+
+/// If the key is name_x, name_y or name_z returns the matching component of the vector, otherwise null
+inline float* JsonVectorComponent(const char* key, size_t key_length, const char* name, Float3* vector)
+{
+	size_t name_length = strlen(name);
+	if (key_length != name_length + 2 || memcmp(key, name, name_length) != 0 || key[name_length] != '_')
+	{
+		return nullptr;
+	}
+	switch (key[name_length + 1])
+	{
+	case 'x': return &vector->x;
+	case 'y': return &vector->y;
+	case 'z': return &vector->z;
+	default: return nullptr;
+	}
+}
+
+inline bool JsonKeyIs(const char* key, size_t key_length, const char* name)
+{
+	return key_length == strlen(name) && memcmp(key, name, key_length) == 0;
+}
+
+/// Reads the JSON written by JsonFrameWriter back into a frame, without allocating. Keys may come in any order and
+/// unknown keys are skipped, so any JSON of the same shape is accepted. Strings with escapes are only allowed in
+/// skipped values.
+class JsonFrameReader
+{
+public:
+
+	/// Reads a whole frame and its stamp. Returns false if the JSON is malformed or has more fingers than a hand can.
+	bool ReadFrame(const char* json, size_t length, FrameData* frame, DatagramStamp* stamp)
+	{
+		cursor = json;
+		end = json + length;
+		depth = 0;
+		*stamp = { 0, 0, 0, 0 };
+		frame->id = 0;
+		frame->capture_timestamp = 0;
+		frame->hand_mask = 0;
+
+		bool is_read = ReadObject([this, frame, stamp](const char* key, size_t key_length)
+		{
+			if (JsonKeyIs(key, key_length, "sequence"))
+			{
+				int64_t sequence;
+				bool is_number = ReadInt(&sequence);
+				stamp->sequence = (uint32_t)sequence;
+				return is_number;
+			}
+			if (JsonKeyIs(key, key_length, "send_timestamp"))
+			{
+				return ReadInt(&stamp->send_timestamp);
+			}
+			if (JsonKeyIs(key, key_length, "frame_id"))
+			{
+				return ReadInt(&stamp->frame_id);
+			}
+			if (JsonKeyIs(key, key_length, "capture_timestamp"))
+			{
+				return ReadInt(&stamp->capture_timestamp);
+			}
+			if (JsonKeyIs(key, key_length, "left_arm"))
+			{
+				return ReadArm(frame, LEFT_HAND_INDEX);
+			}
+			if (JsonKeyIs(key, key_length, "right_arm"))
+			{
+				return ReadArm(frame, RIGHT_HAND_INDEX);
+			}
+			return SkipValue();
+		});
+
+		frame->id = stamp->frame_id;
+		frame->capture_timestamp = stamp->capture_timestamp;
+		SkipWhitespace();
+		return is_read && cursor == end;
+	}
+
+private:
+
+	const char*		cursor		= nullptr;
+	const char*		end			= nullptr;
+	int				depth		= 0;
+
+	bool ReadArm(FrameData* frame, int hand_index)
+	{
+		if (ReadNull())
+		{
+			return true;
+		}
+		HandData* hand = &frame->hands[hand_index];
+		hand->finger_count = 0;
+		hand->forearm.is_valid = false;
+		frame->hand_mask |= HandBit(hand_index);
+		return ReadObject([this, hand](const char* key, size_t key_length)
+		{
+			if (JsonKeyIs(key, key_length, "forearm"))
+			{
+				return ReadForearm(&hand->forearm);
+			}
+			if (JsonKeyIs(key, key_length, "hand"))
+			{
+				return ReadHand(hand);
+			}
+			return SkipValue();
+		});
+	}
+
+	bool ReadForearm(ForearmData* forearm)
+	{
+		forearm->is_valid = false;
+		if (ReadNull())
+		{
+			return true;
+		}
+		forearm->is_valid = true;
+		return ReadObject([this, forearm](const char* key, size_t key_length)
+		{
+			float* component = JsonVectorComponent(key, key_length, "wrist", &forearm->wrist);
+			component = component ? component : JsonVectorComponent(key, key_length, "direction", &forearm->direction);
+			component = component ? component : JsonVectorComponent(key, key_length, "elbow", &forearm->elbow);
+			return component ? ReadFloat(component) : SkipValue();
+		});
+	}
+
+	bool ReadHand(HandData* hand)
+	{
+		return ReadObject([this, hand](const char* key, size_t key_length)
+		{
+			if (JsonKeyIs(key, key_length, "fingers"))
+			{
+				hand->finger_count = 0;
+				return ReadArray([this, hand]()
+				{
+					return hand->finger_count < MAX_FINGERS_PER_HAND && ReadFinger(&hand->fingers[hand->finger_count++]);
+				});
+			}
+			if (JsonKeyIs(key, key_length, "grab_angle"))
+			{
+				return ReadFloat(&hand->grab_angle);
+			}
+			if (JsonKeyIs(key, key_length, "pinch_distance"))
+			{
+				return ReadFloat(&hand->pinch_distance);
+			}
+			float* component = JsonVectorComponent(key, key_length, "palm", &hand->palm);
+			component = component ? component : JsonVectorComponent(key, key_length, "stabilized_palm", &hand->stabilized_palm);
+			component = component ? component : JsonVectorComponent(key, key_length, "palm_normal", &hand->palm_normal);
+			component = component ? component : JsonVectorComponent(key, key_length, "palm_velocity", &hand->palm_velocity);
+			component = component ? component : JsonVectorComponent(key, key_length, "palm_to_fingers", &hand->palm_to_fingers);
+			return component ? ReadFloat(component) : SkipValue();
+		});
+	}
+
+	bool ReadFinger(FingerData* finger)
+	{
+		finger->type = 0;
+		finger->is_extended = false;
+		return ReadObject([this, finger](const char* key, size_t key_length)
+		{
+			if (JsonKeyIs(key, key_length, "type"))
+			{
+				int64_t type;
+				bool is_number = ReadInt(&type);
+				finger->type = (int32_t)type;
+				return is_number;
+			}
+			if (JsonKeyIs(key, key_length, "is_extended"))
+			{
+				int64_t is_extended;
+				bool is_number = ReadInt(&is_extended);
+				finger->is_extended = is_extended != 0;
+				return is_number;
+			}
+			float* component = JsonVectorComponent(key, key_length, "direction", &finger->direction);
+			component = component ? component : JsonVectorComponent(key, key_length, "tip", &finger->tip);
+			component = component ? component : JsonVectorComponent(key, key_length, "stabilized_tip", &finger->stabilized_tip);
+			component = component ? component : JsonVectorComponent(key, key_length, "tip_velocity", &finger->tip_velocity);
+			return component ? ReadFloat(component) : SkipValue();
+		});
+	}
+
+	void SkipWhitespace()
+	{
+		while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r'))
+		{
+			++cursor;
+		}
+	}
+
+	bool Consume(char expected)
+	{
+		SkipWhitespace();
+		if (cursor < end && *cursor == expected)
+		{
+			++cursor;
+			return true;
+		}
+		return false;
+	}
+
+	bool ConsumeLiteral(const char* literal)
+	{
+		SkipWhitespace();
+		size_t literal_length = strlen(literal);
+		if ((size_t)(end - cursor) < literal_length || memcmp(cursor, literal, literal_length) != 0)
+		{
+			return false;
+		}
+		cursor += literal_length;
+		return true;
+	}
+
+	bool ReadNull()
+	{
+		return ConsumeLiteral("null");
+	}
+
+	/// Calls read_member with every key of an object, positioned at its value, which read_member must consume
+	template<typename MemberReader>
+	bool ReadObject(MemberReader read_member)
+	{
+		if (++depth > JSON_READER_MAX_DEPTH || !Consume('{'))
+		{
+			return false;
+		}
+		if (!Consume('}'))
+		{
+			do
+			{
+				const char* key;
+				size_t key_length;
+				if (!ReadString(&key, &key_length) || !Consume(':') || !read_member(key, key_length))
+				{
+					return false;
+				}
+			} while (Consume(','));
+			if (!Consume('}'))
+			{
+				return false;
+			}
+		}
+		--depth;
+		return true;
+	}
+
+	/// Calls read_element for every element of an array, which read_element must consume
+	template<typename ElementReader>
+	bool ReadArray(ElementReader read_element)
+	{
+		if (++depth > JSON_READER_MAX_DEPTH || !Consume('['))
+		{
+			return false;
+		}
+		if (!Consume(']'))
+		{
+			do
+			{
+				if (!read_element())
+				{
+					return false;
+				}
+			} while (Consume(','));
+			if (!Consume(']'))
+			{
+				return false;
+			}
+		}
+		--depth;
+		return true;
+	}
+
+	/// Points the key at the raw contents of a string, which for the keys of a frame is the key itself
+	bool ReadString(const char** text, size_t* text_length)
+	{
+		if (!Consume('"'))
+		{
+			return false;
+		}
+		const char* start = cursor;
+		while (cursor < end && *cursor != '"')
+		{
+			// The escaped character is skipped so that an escaped quote does not end the string
+			cursor += *cursor == '\\' ? 2 : 1;
+		}
+		if (cursor >= end)
+		{
+			return false;
+		}
+		*text = start;
+		*text_length = cursor - start;
+		++cursor;
+		return true;
+	}
+
+	bool ReadInt(int64_t* value)
+	{
+		SkipWhitespace();
+		from_chars_result result = from_chars(cursor, end, *value);
+		cursor = result.ptr;
+		return result.ec == errc();
+	}
+
+	bool ReadFloat(float* value)
+	{
+		SkipWhitespace();
+		from_chars_result result = from_chars(cursor, end, *value);
+		cursor = result.ptr;
+		return result.ec == errc();
+	}
+
+	bool SkipValue()
+	{
+		SkipWhitespace();
+		if (cursor >= end)
+		{
+			return false;
+		}
+		if (*cursor == '{')
+		{
+			return ReadObject([this](const char*, size_t) { return SkipValue(); });
+		}
+		if (*cursor == '[')
+		{
+			return ReadArray([this]() { return SkipValue(); });
+		}
+		if (*cursor == '"')
+		{
+			const char* text;
+			size_t text_length;
+			return ReadString(&text, &text_length);
+		}
+		if (ConsumeLiteral("null") || ConsumeLiteral("true") || ConsumeLiteral("false"))
+		{
+			return true;
+		}
+		double number;
+		from_chars_result result = from_chars(cursor, end, number);
+		cursor = result.ptr;
+		return result.ec == errc();
+	}
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "FrameData.h"
+#include "DatagramStamp.h"
+
+#include <algorithm>
+#include <charconv>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+#define JSON_WRITER_INITIAL_CAPACITY	8192
+#define JSON_NUMBER_MAX_LENGTH			32
+
+// The send fields are written as fixed-width placeholders padded with spaces, which JSON allows, so that they can be
+// filled in right before sending without moving the rest of the frame
+#define JSON_SEQUENCE_KEY				"{ \"sequence\": "
+#define JSON_SEND_TIMESTAMP_KEY			", \"send_timestamp\": "
+#define JSON_STAMP_FIELD_WIDTH			20
+#define JSON_SEQUENCE_OFFSET			(sizeof(JSON_SEQUENCE_KEY) - 1)
+#define JSON_SEND_TIMESTAMP_OFFSET		(JSON_SEQUENCE_OFFSET + JSON_STAMP_FIELD_WIDTH + sizeof(JSON_SEND_TIMESTAMP_KEY) - 1)
+#define JSON_STAMP_END					(JSON_SEND_TIMESTAMP_OFFSET + JSON_STAMP_FIELD_WIDTH)
+
+/// Writes frames as the JSON understood by the Unity LeapFrameData parser. The writer owns one buffer that is reused
+/// for every frame, so once the buffer has grown to fit a two hand frame no more allocations are made. Floats are
+/// written with the shortest representation that reads back to the same value.
+class JsonFrameWriter
+{
+public:
+
+	JsonFrameWriter()
+	{
+		buffer.resize(JSON_WRITER_INITIAL_CAPACITY);
+	}
+
+	/// Writes the frame, replacing the previous contents of the buffer
+	void WriteFrame(const FrameData* frame)
+	{
+		length = 0;
+
+		// { "sequence": 0, "send_timestamp": 0, "frame_id": 1, "capture_timestamp": 2, "left_arm": {.....}, "right_arm": {.....} }
+		AppendLiteral(JSON_SEQUENCE_KEY);
+		AppendStampPlaceholder();
+		AppendLiteral(JSON_SEND_TIMESTAMP_KEY);
+		AppendStampPlaceholder();
+		AppendInt(", \"frame_id\": ", frame->id);
+		AppendInt(", \"capture_timestamp\": ", frame->capture_timestamp);
+
+		if (HasHand(frame, LEFT_HAND_INDEX))
+		{
+			AppendLiteral(", \"left_arm\": ");
+			WriteArm(&frame->hands[LEFT_HAND_INDEX]);
+		}
+
+		if (HasHand(frame, RIGHT_HAND_INDEX))
+		{
+			AppendLiteral(", \"right_arm\": ");
+			WriteArm(&frame->hands[RIGHT_HAND_INDEX]);
+		}
+
+		AppendLiteral(" }");
+	}
+
+	/// The JSON written by the last call to WriteFrame. Not null terminated.
+	const char* Data() const
+	{
+		return buffer.data();
+	}
+
+	size_t Size() const
+	{
+		return length;
+	}
+
+private:
+
+	vector<char>	buffer;
+	size_t			length		= 0;
+
+	void WriteArm(const HandData* hand)
+	{
+		// { "forearm": {.....}, "hand": {.....} }
+		AppendLiteral("{ \"forearm\": ");
+		WriteForearm(&hand->forearm);
+		AppendLiteral(", \"hand\": ");
+		WriteHand(hand);
+		AppendLiteral(" }");
+	}
+
+	void WriteForearm(const ForearmData* forearm)
+	{
+		if (!forearm->is_valid)
+		{
+			AppendLiteral("null");
+			return;
+		}
+
+		// { "wrist_x": 2.2, ....., "elbow_z": 0.3 }
+		AppendFloat("{ \"wrist_x\": ", forearm->wrist.x);
+		AppendFloat(", \"wrist_y\": ", forearm->wrist.y);
+		AppendFloat(", \"wrist_z\": ", forearm->wrist.z);
+		AppendFloat(", \"direction_x\": ", forearm->direction.x);
+		AppendFloat(", \"direction_y\": ", forearm->direction.y);
+		AppendFloat(", \"direction_z\": ", forearm->direction.z);
+		AppendFloat(", \"elbow_x\": ", forearm->elbow.x);
+		AppendFloat(", \"elbow_y\": ", forearm->elbow.y);
+		AppendFloat(", \"elbow_z\": ", forearm->elbow.z);
+		AppendLiteral(" }");
+	}
+
+	void WriteFinger(const FingerData* finger)
+	{
+		// { "type": 2, ....., "tip_velocity_z": 0.2 }
+		AppendInt("{ \"type\": ", finger->type);
+		AppendFloat(", \"direction_x\": ", finger->direction.x);
+		AppendFloat(", \"direction_y\": ", finger->direction.y);
+		AppendFloat(", \"direction_z\": ", finger->direction.z);
+		AppendInt(", \"is_extended\": ", finger->is_extended ? 1 : 0);
+		AppendFloat(", \"tip_x\": ", finger->tip.x);
+		AppendFloat(", \"tip_y\": ", finger->tip.y);
+		AppendFloat(", \"tip_z\": ", finger->tip.z);
+		AppendFloat(", \"stabilized_tip_x\": ", finger->stabilized_tip.x);
+		AppendFloat(", \"stabilized_tip_y\": ", finger->stabilized_tip.y);
+		AppendFloat(", \"stabilized_tip_z\": ", finger->stabilized_tip.z);
+		AppendFloat(", \"tip_velocity_x\": ", finger->tip_velocity.x);
+		AppendFloat(", \"tip_velocity_y\": ", finger->tip_velocity.y);
+		AppendFloat(", \"tip_velocity_z\": ", finger->tip_velocity.z);
+		AppendLiteral(" }");
+	}
+
+	void WriteHand(const HandData* hand)
+	{
+		// { "palm_x": 32.4, ....., "fingers": [ {.....},.....{.....} ], ....., "pinch_distance": 2.1 }
+		AppendFloat("{ \"palm_x\": ", hand->palm.x);
+		AppendFloat(", \"palm_y\": ", hand->palm.y);
+		AppendFloat(", \"palm_z\": ", hand->palm.z);
+		AppendFloat(", \"stabilized_palm_x\": ", hand->stabilized_palm.x);
+		AppendFloat(", \"stabilized_palm_y\": ", hand->stabilized_palm.y);
+		AppendFloat(", \"stabilized_palm_z\": ", hand->stabilized_palm.z);
+		AppendFloat(", \"palm_normal_x\": ", hand->palm_normal.x);
+		AppendFloat(", \"palm_normal_y\": ", hand->palm_normal.y);
+		AppendFloat(", \"palm_normal_z\": ", hand->palm_normal.z);
+		AppendFloat(", \"palm_velocity_x\": ", hand->palm_velocity.x);
+		AppendFloat(", \"palm_velocity_y\": ", hand->palm_velocity.y);
+		AppendFloat(", \"palm_velocity_z\": ", hand->palm_velocity.z);
+		AppendFloat(", \"palm_to_fingers_x\": ", hand->palm_to_fingers.x);
+		AppendFloat(", \"palm_to_fingers_y\": ", hand->palm_to_fingers.y);
+		AppendFloat(", \"palm_to_fingers_z\": ", hand->palm_to_fingers.z);
+
+		AppendLiteral(", \"fingers\": [ ");
+		for (int i = 0; i < hand->finger_count; ++i)
+		{
+			if (i > 0)
+			{
+				AppendLiteral(", ");
+			}
+			WriteFinger(&hand->fingers[i]);
+		}
+		AppendLiteral(" ]");
+
+		AppendFloat(", \"grab_angle\": ", hand->grab_angle);
+		AppendFloat(", \"pinch_distance\": ", hand->pinch_distance);
+		AppendLiteral(" }");
+	}
+
+	/// Makes sure there is room for at least the given number of bytes after the current end of the buffer
+	void Reserve(size_t extra)
+	{
+		if (length + extra > buffer.size())
+		{
+			buffer.resize(max(buffer.size() * 2, length + extra));
+		}
+	}
+
+	void Append(const char* text, size_t text_length)
+	{
+		Reserve(text_length);
+		memcpy(buffer.data() + length, text, text_length);
+		length += text_length;
+	}
+
+	template<size_t N>
+	void AppendLiteral(const char (&text)[N])
+	{
+		Append(text, N - 1);
+	}
+
+	template<size_t N>
+	void AppendFloat(const char (&key)[N], float value)
+	{
+		Reserve(N - 1 + JSON_NUMBER_MAX_LENGTH);
+		memcpy(buffer.data() + length, key, N - 1);
+		length += N - 1;
+
+		// JSON has no representation for NaN or infinity
+		if (!isfinite(value))
+		{
+			value = 0.0f;
+		}
+		char* end = buffer.data() + length + JSON_NUMBER_MAX_LENGTH;
+		length = to_chars(buffer.data() + length, end, value).ptr - buffer.data();
+	}
+
+	void AppendStampPlaceholder()
+	{
+		Reserve(JSON_STAMP_FIELD_WIDTH);
+		buffer[length] = '0';
+		memset(buffer.data() + length + 1, ' ', JSON_STAMP_FIELD_WIDTH - 1);
+		length += JSON_STAMP_FIELD_WIDTH;
+	}
+
+	template<size_t N>
+	void AppendInt(const char (&key)[N], int64_t value)
+	{
+		Reserve(N - 1 + JSON_NUMBER_MAX_LENGTH);
+		memcpy(buffer.data() + length, key, N - 1);
+		length += N - 1;
+
+		char* end = buffer.data() + length + JSON_NUMBER_MAX_LENGTH;
+		length = to_chars(buffer.data() + length, end, value).ptr - buffer.data();
+	}
+};
+
+/// Writes a number into a fixed-width stamp field and pads the rest with spaces
+inline void WriteJsonStampField(char* field, int64_t value)
+{
+	char* end = to_chars(field, field + JSON_STAMP_FIELD_WIDTH, value).ptr;
+	memset(end, ' ', field + JSON_STAMP_FIELD_WIDTH - end);
+}
+
+/// Fills in the send fields of a frame written by JsonFrameWriter
+inline void StampJsonFrame(char* json, size_t length, uint32_t sequence, int64_t send_timestamp)
+{
+	if (length >= JSON_STAMP_END)
+	{
+		WriteJsonStampField(json + JSON_SEQUENCE_OFFSET, sequence);
+		WriteJsonStampField(json + JSON_SEND_TIMESTAMP_OFFSET, send_timestamp);
+	}
+}
+
+/// Reads the stamp of a frame written by JsonFrameWriter without parsing the rest of the JSON
+inline bool ReadJsonFrameStamp(const char* json, size_t length, DatagramStamp* stamp)
+{
+	const char frame_id_key[] = ", \"frame_id\": ";
+	const char capture_key[] = ", \"capture_timestamp\": ";
+	if (length < JSON_STAMP_END || memcmp(json, JSON_SEQUENCE_KEY, JSON_SEQUENCE_OFFSET) != 0)
+	{
+		return false;
+	}
+
+	const char* end = json + length;
+	int64_t sequence = 0;
+	from_chars(json + JSON_SEQUENCE_OFFSET, json + JSON_SEQUENCE_OFFSET + JSON_STAMP_FIELD_WIDTH, sequence);
+	stamp->sequence = (uint32_t)sequence;
+	from_chars(json + JSON_SEND_TIMESTAMP_OFFSET, json + JSON_STAMP_END, stamp->send_timestamp);
+
+	const char* cursor = json + JSON_STAMP_END;
+	if ((size_t)(end - cursor) < sizeof(frame_id_key) || memcmp(cursor, frame_id_key, sizeof(frame_id_key) - 1) != 0)
+	{
+		return false;
+	}
+	cursor = from_chars(cursor + sizeof(frame_id_key) - 1, end, stamp->frame_id).ptr;
+	if ((size_t)(end - cursor) < sizeof(capture_key) || memcmp(cursor, capture_key, sizeof(capture_key) - 1) != 0)
+	{
+		return false;
+	}
+	from_chars(cursor + sizeof(capture_key) - 1, end, stamp->capture_timestamp);
+	return true;
+}
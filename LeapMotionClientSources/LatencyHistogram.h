@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// Log-linear buckets in the style of HdrHistogram: values below 2^HISTOGRAM_SUB_BUCKET_BITS have a bucket each, and
+// every power of two above that is split into 2^(HISTOGRAM_SUB_BUCKET_BITS - 1) buckets, so any recorded value is
+// reported within about 3% of what was recorded
+#define HISTOGRAM_SUB_BUCKET_BITS		6
+#define HISTOGRAM_SUB_BUCKET_COUNT		(1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_HALF_SUB_BUCKET_COUNT	(HISTOGRAM_SUB_BUCKET_COUNT / 2)
+// Values of 2^HISTOGRAM_MAX_VALUE_BITS and above all go to the last bucket
+#define HISTOGRAM_MAX_VALUE_BITS		40
+#define HISTOGRAM_BUCKET_COUNT			((HISTOGRAM_MAX_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_HALF_SUB_BUCKET_COUNT)
+
+/// Index of the highest set bit. The value must not be 0.
+inline int HighestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+/// Counts of a histogram copied out at one point in time
+struct HistogramSnapshot
+{
+	uint64_t	counts[HISTOGRAM_BUCKET_COUNT];
+	uint64_t	total_count;
+	uint64_t	max_value;
+
+	/// Removes the counts of an earlier snapshot of the same histogram, leaving what was recorded in between. The
+	/// maximum cannot be split this way and is kept as the maximum since the start.
+	void Subtract(const HistogramSnapshot* earlier)
+	{
+		total_count = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			counts[i] -= earlier->counts[i];
+			total_count += counts[i];
+		}
+	}
+
+	/// Value below which the given fraction of the recorded values lie, e.g. 0.99 for the 99th percentile
+	uint64_t Percentile(double fraction) const
+	{
+		if (total_count == 0)
+		{
+			return 0;
+		}
+
+		uint64_t target = (uint64_t)(fraction * (double)total_count + 0.5);
+		target = target < 1 ? 1 : target;
+		uint64_t seen = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			seen += counts[i];
+			if (seen >= target)
+			{
+				uint64_t upper = BucketUpperBound(i);
+				return upper < max_value ? upper : max_value;
+			}
+		}
+		return max_value;
+	}
+
+	static uint64_t BucketUpperBound(int index)
+	{
+		if (index < HISTOGRAM_SUB_BUCKET_COUNT)
+		{
+			return (uint64_t)index;
+		}
+		int shift = index / HISTOGRAM_HALF_SUB_BUCKET_COUNT - 1;
+		uint64_t sub_bucket = (uint64_t)(index % HISTOGRAM_HALF_SUB_BUCKET_COUNT + HISTOGRAM_HALF_SUB_BUCKET_COUNT);
+		return ((sub_bucket + 1) << shift) - 1;
+	}
+};
+
+/// Histogram of non-negative integer values, e.g. durations in nanoseconds or sizes in bytes. Recording is a single
+/// relaxed atomic increment, so any number of threads can record while another one takes snapshots.
+class LatencyHistogram
+{
+public:
+
+	LatencyHistogram()
+	{
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			counts[i].store(0, memory_order_relaxed);
+		}
+	}
+
+	void Record(int64_t value)
+	{
+		uint64_t unsigned_value = value > 0 ? (uint64_t)value : 0;
+		counts[BucketIndex(unsigned_value)].fetch_add(1, memory_order_relaxed);
+
+		uint64_t current_max = max_value.load(memory_order_relaxed);
+		while (unsigned_value > current_max &&
+			!max_value.compare_exchange_weak(current_max, unsigned_value, memory_order_relaxed))
+		{
+		}
+	}
+
+	void Snapshot(HistogramSnapshot* snapshot) const
+	{
+		snapshot->total_count = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			snapshot->counts[i] = counts[i].load(memory_order_relaxed);
+			snapshot->total_count += snapshot->counts[i];
+		}
+		snapshot->max_value = max_value.load(memory_order_relaxed);
+	}
+
+	static int BucketIndex(uint64_t value)
+	{
+		if (value < HISTOGRAM_SUB_BUCKET_COUNT)
+		{
+			return (int)value;
+		}
+		int shift = HighestBit(value) - HISTOGRAM_SUB_BUCKET_BITS + 1;
+		int index = (shift + 1) * HISTOGRAM_HALF_SUB_BUCKET_COUNT + (int)(value >> shift) - HISTOGRAM_HALF_SUB_BUCKET_COUNT;
+		return index < HISTOGRAM_BUCKET_COUNT ? index : HISTOGRAM_BUCKET_COUNT - 1;
+	}
+
+private:
+
+	atomic<uint64_t>	counts[HISTOGRAM_BUCKET_COUNT];
+	atomic<uint64_t>	max_value			= { 0 };
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Leap.h"
+#include "Utils.h"
+#include "FrameSource.h"
+#include "FrameHistory.h"
+#include "StreamMetrics.h"
+
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+using namespace Leap;
+
+/// Frame source that is driven by the Leap service. The service calls onFrame on its own thread for every new frame,
+/// so there is no need to poll the controller and compare frame ids.
+class LeapFrameSource : public FrameSource, public Listener
+{
+public:
+
+	LeapFrameSource(Controller* lc)
+	{
+		leap_controller = lc;
+		MakeStreamTransform(&frame_transform);
+		MakeStreamTransform(&history_transform);
+	}
+
+	~LeapFrameSource()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		ResetStopped();
+		leap_controller->addListener(*this);
+		// The listener is only told about connections made after it was added
+		SetConnected(leap_controller->isConnected());
+	}
+
+	void Stop()
+	{
+		leap_controller->removeListener(*this);
+		FrameSource::Stop();
+	}
+
+	/// Sets the transform from the Leap coordinate system to the streamed one, e.g. once calibration is done
+	void SetFrameTransform(const FrameTransform& transform)
+	{
+		lock_guard<mutex> lock(transform_mutex);
+		frame_transform = transform;
+	}
+
+	/// Measure the time from capture to the frame being read here, also once the listener is running. Null disables.
+	void SetMetrics(StreamMetrics* stream_metrics)
+	{
+		metrics = stream_metrics;
+	}
+
+	/// Keep every frame in the given history, also while paused, keyed by its capture time in the client's wall clock
+	/// (see CurrentTimestamp). The frames are converted with the uncalibrated stream transform. Null stops recording.
+	void SetFrameHistory(FrameHistory* history)
+	{
+		frame_history = history;
+	}
+
+	void onConnect(const Controller& controller)
+	{
+		cout << "Leap Motion controller connected" << endl;
+		SetConnected(true);
+	}
+
+	void onDisconnect(const Controller& controller)
+	{
+		cout << "Leap Motion controller disconnected" << endl;
+		SetConnected(false);
+	}
+
+	void onFrame(const Controller& controller)
+	{
+		// Fetched once, so that the history and the stream get the same frame
+		Frame frame = controller.frame();
+		int64_t leap_now = controller.now();
+		FrameHistory* history = frame_history;
+		bool is_history_converted = false;
+		if (history != nullptr)
+		{
+			// The age of the frame in the Leap service's clock carries over to the wall clock
+			int64_t capture_time = CurrentTimestamp() - (leap_now - frame.timestamp());
+			LeapFrameToFrameData(&frame, &history_frame_data, &history_transform);
+			history->Add(capture_time, history_frame_data);
+			is_history_converted = true;
+		}
+
+		if (!IsAcceptingFrames())
+		{
+			return;
+		}
+
+		FrameTransform transform;
+		{
+			lock_guard<mutex> lock(transform_mutex);
+			transform = frame_transform;
+		}
+
+		StreamMetrics* stream_metrics = metrics;
+		if (stream_metrics != nullptr)
+		{
+			// Both are in the Leap service's clock, in microseconds
+			stream_metrics->Record(MetricStage::CAPTURE_TO_READ, (leap_now - frame.timestamp()) * 1000);
+		}
+		if (is_history_converted && memcmp(&transform, &history_transform, sizeof(transform)) == 0)
+		{
+			// Converted with the same transform for the history already
+			PublishFrame(history_frame_data);
+			return;
+		}
+		LeapFrameToFrameData(&frame, &frame_data, &transform);
+		PublishFrame(frame_data);
+	}
+
+private:
+
+	Controller*				leap_controller;
+	mutex					transform_mutex;
+	FrameTransform			frame_transform;
+	atomic<StreamMetrics*>	metrics				= { nullptr };
+	atomic<FrameHistory*>	frame_history		= { nullptr };
+	// Only touched by the Leap service thread
+	FrameData				frame_data;
+	FrameData				history_frame_data;
+	FrameTransform			history_transform;
+};
@@ -5,6 +5,10 @@
 #include "Utils.h"
 #include "Leap.h"
 #include "ConnectionManager.h"
+#include "LeapFrameSource.h"
+#include "ReplayFrameSource.h"
+#include "StreamingPipeline.h"
+#include "StreamSession.h"
 #include <thread>
 #include "opencv2\core.hpp"
 #include "opencv2\highgui.hpp"
@@ -21,23 +25,34 @@ using namespace cv;
 
 #define QUIT_INSTRUCTION_STRING			"Press enter to quit."
 #define LEAP_INITIALIZING_STRING		"Leap controller initializing."
+#define LEAP_WAITING_STRING				"Still waiting for the Leap controller to connect."
 #define LEAP_INITIALIZATION_DONE_STRING	"Leap controller initialized. Notifying Hololens that client is ready for calibration."
 #define STREAMING_DATA_STRING			"Calibration done. Starting data streaming."
+#define STREAM_FRAME_ENCODING			FrameEncoding::JSON
+// Apply the Leap to camera calibration before sending instead of on the Hololens
+#define STREAM_CALIBRATED_FRAMES		false
+// Pair each calibration image with a Leap frame interpolated to its capture time instead of the closest frame
+#define INTERPOLATE_CALIBRATION_FRAMES	true
+#define LEAP_CONNECTION_TIMEOUT_MS		5000
+#define PIPELINE_OVERFLOW_POLICY		OverflowPolicy::COALESCE_LATEST
+// Leave empty to stream from the Leap without recording
+#define RECORD_FILE_NAME				""
+// Set to a recorded frame log to stream it instead of the Leap
+#define REPLAY_FILE_NAME				""
+#define REPLAY_SPEED					REPLAY_REAL_TIME
+// Set to a name to publish the frames to shared memory, where local tools can read them with SharedFrameReader
+#define SHARED_MEMORY_NAME				""
+// Set to a file name to append latency percentiles of the frame path to it every METRICS_DUMP_INTERVAL_MS
+#define METRICS_FILE_NAME				""
 
 ConnectionManager* connection_manager;
+FrameSource* frame_source;
 
-void ListenForStopCall(bool* is_streaming)
+/// Stops the session when the user presses enter. cin cannot be interrupted, so this thread is left running on exit.
+void ListenForStopCall(StreamSession* session)
 {
 	cin.get();
-	*is_streaming = false;
-}
-
-void ListenForControlMessages(bool* is_streaming, bool* is_paused)
-{
-	while (*is_streaming)
-	{
-		connection_manager->ListenForControlMessage(is_streaming, is_paused);
-	}
+	session->Stop();
 }
 
 int main()
@@ -48,15 +63,28 @@ int main()
 
 	// Set up socket and connection to Hololens
 	connection_manager = new ConnectionManager(&leap_controller);
+	connection_manager->SetFrameEncoding(STREAM_FRAME_ENCODING);
+	connection_manager->SetStreamCalibratedFrames(STREAM_CALIBRATED_FRAMES);
+	connection_manager->SetInterpolateCalibrationFrames(INTERPOLATE_CALIBRATION_FRAMES);
 	connection_manager->ConfigureLocalAddressData();
 	connection_manager->ConfigureHoloAddressData();
 	connection_manager->CreateSockets();
 	connection_manager->BindSockets();
 	connection_manager->ConnectToHololens();
-
-	// Create a Leap Controller and wait for it to be connected
+	connection_manager->ConfigureSubscribers();
+
+	// Wait for the Leap controller to be connected. Frames are not needed until streaming starts.
+	LeapFrameSource leap_frame_source(&leap_controller);
+	ReplayFrameSource replay_frame_source(REPLAY_FILE_NAME, REPLAY_SPEED, true);
+	bool is_replaying = strlen(REPLAY_FILE_NAME) > 0;
+	frame_source = is_replaying ? (FrameSource*)&replay_frame_source : &leap_frame_source;
+	frame_source->SetPaused(true);
+	frame_source->Start();
 	cout << LEAP_INITIALIZING_STRING << endl;
-	while (!leap_controller.isConnected()) {}
+	while (!frame_source->WaitForConnection(chrono::milliseconds(LEAP_CONNECTION_TIMEOUT_MS)))
+	{
+		cout << LEAP_WAITING_STRING << endl;
+	}
 	// Make sure configs are correct
 	leap_controller.setPolicy(Controller::POLICY_OPTIMIZE_HMD);
 	leap_controller.config().setInt32("tracking_images_mode", 0);
@@ -69,36 +97,99 @@ int main()
 	leap_controller.config().save();
 	cout << LEAP_INITIALIZATION_DONE_STRING << endl;
 
-	// Notify Hololens that the Leap client is ready to start calibration
+	// Notify Hololens that the Leap client is ready to start calibration. Recent Leap frames are kept meanwhile so that
+	// each calibration image can be paired with the frame captured at the same time.
+	leap_frame_source.SetFrameHistory(connection_manager->CalibrationFrameHistory());
 	connection_manager->SendReadyForCalibrationMessage();
 	connection_manager->ReceiveCalibrationChoice();
+	leap_frame_source.SetFrameHistory(nullptr);
+	leap_frame_source.SetFrameTransform(connection_manager->StreamTransform());
 
-	// Start thread monitoring control messages coming from the Hololens
-	bool is_streaming = true;
-	bool is_paused = false;
-	thread control_message_stream(ListenForControlMessages, &is_streaming, &is_paused);
+	// Pausing, resuming and stopping the session is passed on to the frame source
+	StreamSession session;
+	session.SetStateCallback([](SessionState state)
+	{
+		if (state == SessionState::STOPPED)
+		{
+			frame_source->Stop();
+		}
+		else
+		{
+			frame_source->SetPaused(state == SessionState::PAUSED);
+		}
+	});
 
-	// Start thread that monitors if the user wants to quit
-	thread stop_button_thread(ListenForStopCall, &is_streaming);
+	// Acquire, encode and send on separate threads until streaming is stopped
+	StreamingPipeline pipeline(frame_source, connection_manager, PIPELINE_OVERFLOW_POLICY);
+	StreamMetrics metrics;
+	StreamMetricsDumper metrics_dumper(&metrics, METRICS_FILE_NAME);
+	if (strlen(METRICS_FILE_NAME) > 0)
+	{
+		if (metrics_dumper.Start())
+		{
+			connection_manager->SetMetrics(&metrics);
+			leap_frame_source.SetMetrics(&metrics);
+		}
+		else
+		{
+			cout << "Could not open metrics file " << METRICS_FILE_NAME << endl;
+		}
+	}
 
-	Frame previous_frame = leap_controller.frame();
-	Frame current_frame = previous_frame;
-	cout << STREAMING_DATA_STRING << endl;
-	cout << QUIT_INSTRUCTION_STRING << endl;
+	FrameLogWriter recorder;
+	if (strlen(RECORD_FILE_NAME) > 0)
+	{
+		if (recorder.Open(RECORD_FILE_NAME))
+		{
+			pipeline.SetRecorder(&recorder);
+		}
+		else
+		{
+			cout << "Could not create frame log " << RECORD_FILE_NAME << endl;
+		}
+	}
 
-	// Main loop that tracks the current frame
-	while (is_streaming)
+	SharedFrameWriter shared_frame_writer;
+	if (strlen(SHARED_MEMORY_NAME) > 0)
 	{
-		current_frame = leap_controller.frame();
-		if (current_frame.id() != previous_frame.id())
+		if (shared_frame_writer.Open(SHARED_MEMORY_NAME))
+		{
+			pipeline.SetSharedFrameWriter(&shared_frame_writer);
+		}
+		else
 		{
-			previous_frame = current_frame;
-			if (!is_paused)
-			{
-				connection_manager->SendLeapFrame(&current_frame);
-			}
+			cout << "Could not create shared memory " << SHARED_MEMORY_NAME << endl;
 		}
 	}
+	pipeline.Start();
+	frame_source->SetPaused(false);
+	cout << STREAMING_DATA_STRING << endl;
+	cout << QUIT_INSTRUCTION_STRING << endl;
+
+	// Start thread handling control messages coming from the Hololens
+	thread control_thread(&ConnectionManager::RunControlLoop, connection_manager, &session);
+
+	// Start thread that monitors if the user wants to quit
+	thread stop_button_thread(ListenForStopCall, &session);
+	stop_button_thread.detach();
+
+	session.WaitUntilStopped();
+	connection_manager->WakeControlLoop();
+	control_thread.join();
+	pipeline.Stop();
+	metrics_dumper.Stop();
+	pipeline.PrintStats();
+	if (recorder.IsOpen())
+	{
+		cout << "Recorded frames: " << recorder.Count() << endl;
+		recorder.Close();
+	}
+	if (shared_frame_writer.IsOpen())
+	{
+		cout << "Frames published to shared memory: " << shared_frame_writer.PublishedCount() << endl;
+		shared_frame_writer.Close();
+	}
+	connection_manager->PrintSubscriberStats();
 
 	connection_manager->DoCleanup(true);
 	exit(EXIT_SUCCESS);
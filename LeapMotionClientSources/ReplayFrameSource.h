@@ -0,0 +1,144 @@
+#pragma once
+
+#include "FrameData.h"
+#include "FrameLog.h"
+#include "FrameSource.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+#define REPLAY_REAL_TIME			1.0
+#define REPLAY_AS_FAST_AS_POSSIBLE	0.0
+
+/// Frame source that plays back a frame log recorded with FrameLogWriter. The recorded capture timestamps set the
+/// pace: speed 1.0 replays in real time, 2.0 twice as fast, and 0.0 publishes the frames back to back. Needs neither
+/// a controller nor the Leap SDK, so the streaming pipeline can be benchmarked and regression tested on any machine.
+/// While paused the replay holds its position, so no recorded frame is skipped, e.g. during the calibration.
+class ReplayFrameSource : public FrameSource
+{
+public:
+
+	ReplayFrameSource(const string& path, double speed = REPLAY_REAL_TIME, bool loop = false)
+	{
+		log_path = path;
+		replay_speed = speed;
+		is_looping = loop;
+	}
+
+	~ReplayFrameSource()
+	{
+		Stop();
+	}
+
+	/// Start the replay at the first frame captured at or after the given Leap capture time. Call before Start.
+	void SeekTo(int64_t capture_timestamp)
+	{
+		seek_timestamp = capture_timestamp;
+		has_seek = true;
+	}
+
+	void Start()
+	{
+		if (is_running)
+		{
+			return;
+		}
+		if (!log_reader.Open(log_path))
+		{
+			cout << "Could not open frame log " << log_path << endl;
+			return;
+		}
+
+		ResetStopped();
+		is_running = true;
+		SetConnected(true);
+		replay_thread = thread(&ReplayFrameSource::Replay, this);
+	}
+
+	void Stop()
+	{
+		is_running = false;
+		FrameSource::Stop();
+		if (replay_thread.joinable())
+		{
+			replay_thread.join();
+		}
+		log_reader.Close();
+		SetConnected(false);
+	}
+
+	/// Number of frames published so far, over all loops
+	uint64_t ReplayedCount() const
+	{
+		return replayed_count;
+	}
+
+	/// True once the last frame was published and the replay is not looping
+	bool IsFinished() const
+	{
+		return is_finished;
+	}
+
+private:
+
+	string				log_path;
+	double				replay_speed;
+	bool				is_looping;
+	bool				has_seek				= false;
+	int64_t				seek_timestamp			= 0;
+	FrameLogReader		log_reader;
+	atomic<bool>		is_running				= { false };
+	atomic<bool>		is_finished				= { false };
+	atomic<uint64_t>	replayed_count			= { 0 };
+	thread				replay_thread;
+
+	void Replay()
+	{
+		uint64_t first_index = has_seek ? log_reader.Seek(seek_timestamp) : 0;
+		FrameData frame;
+		do
+		{
+			auto start_time = chrono::steady_clock::now();
+			int64_t first_capture_timestamp = 0;
+			for (uint64_t i = first_index; i < log_reader.Count() && is_running; ++i)
+			{
+				if (!log_reader.Read(i, &frame))
+				{
+					continue;
+				}
+
+				if (i == first_index)
+				{
+					first_capture_timestamp = frame.capture_timestamp;
+				}
+				else if (replay_speed > 0.0)
+				{
+					double elapsed = (double)(frame.capture_timestamp - first_capture_timestamp) / replay_speed;
+					this_thread::sleep_until(start_time + chrono::microseconds((int64_t)elapsed));
+				}
+
+				if (IsPaused())
+				{
+					// The pace is kept from where the replay resumes
+					auto pause_time = chrono::steady_clock::now();
+					if (!WaitWhilePaused())
+					{
+						break;
+					}
+					start_time += chrono::steady_clock::now() - pause_time;
+				}
+
+				PublishFrame(frame);
+				++replayed_count;
+			}
+		}
+		while (is_looping && is_running && first_index < log_reader.Count());
+
+		is_finished = true;
+	}
+};
@@ -0,0 +1,383 @@
+#pragma once
+
+#include "FrameData.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Shared memory layout, for local tools that want the stream without a socket:
+//
+// SharedFrameRingHeader
+//   magic, version, slot count and the size of FrameData, so that a reader built differently refuses to attach
+//   published_count			number of frames published so far, on its own cache line
+// slot_count SharedFrameSlots
+//   sequence					2 * n + 1 while frame n is being written to the slot, 2 * n + 2 once it is complete
+//   frame						FrameData as streamed, in the writer's memory layout
+//
+// Frame n goes to slot n % slot_count. There is one writer and any number of readers. Readers never block the writer:
+// a reader copies or looks at a slot and then checks that its sequence did not change meanwhile, in the manner of a
+// seqlock, and tries again or skips ahead if it did.
+
+#define SHARED_FRAME_RING_MAGIC			"LFSM"
+#define SHARED_FRAME_RING_VERSION		1
+// About two seconds of frames at the Leap's highest frame rate
+#define SHARED_FRAME_RING_SLOTS			256
+#define SHARED_FRAME_CACHE_LINE			64
+
+struct SharedFrameRingHeader
+{
+	char				magic[4];
+	uint32_t			version;
+	uint32_t			slot_count;
+	uint32_t			frame_size;
+	char				reserved[SHARED_FRAME_CACHE_LINE - 16];
+	atomic<uint64_t>	published_count;
+	char				padding[SHARED_FRAME_CACHE_LINE - sizeof(atomic<uint64_t>)];
+};
+
+struct alignas(SHARED_FRAME_CACHE_LINE) SharedFrameSlot
+{
+	atomic<uint64_t>	sequence;
+	FrameData			frame;
+};
+
+inline size_t SharedFrameRingSize(uint32_t slot_count)
+{
+	return sizeof(SharedFrameRingHeader) + slot_count * sizeof(SharedFrameSlot);
+}
+
+/// A named block of shared memory, created read-write by its owner and opened read-only by others
+class SharedMemory
+{
+public:
+
+	~SharedMemory()
+	{
+		Close();
+	}
+
+	bool Create(const string& memory_name, size_t memory_size)
+	{
+		Close();
+		name = memory_name;
+		size = memory_size;
+		is_owner = true;
+#ifdef _WIN32
+		ULARGE_INTEGER mapping_size;
+		mapping_size.QuadPart = memory_size;
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, mapping_size.HighPart,
+			mapping_size.LowPart, name.c_str());
+		if (mapping == NULL)
+		{
+			return false;
+		}
+		data = (char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+#else
+		int file = shm_open(PosixName().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (file < 0)
+		{
+			return false;
+		}
+		void* mapped = ftruncate(file, (off_t)size) == 0 ?
+			mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+		close(file);
+		data = mapped == MAP_FAILED ? nullptr : (char*)mapped;
+#endif
+		return data != nullptr;
+	}
+
+	bool OpenRead(const string& memory_name)
+	{
+		Close();
+		name = memory_name;
+		is_owner = false;
+#ifdef _WIN32
+		mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+		if (mapping == NULL)
+		{
+			return false;
+		}
+		data = (char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		MEMORY_BASIC_INFORMATION info;
+		size = data != nullptr && VirtualQuery(data, &info, sizeof(info)) != 0 ? info.RegionSize : 0;
+#else
+		int file = shm_open(PosixName().c_str(), O_RDONLY, 0);
+		struct stat file_stat;
+		if (file < 0 || fstat(file, &file_stat) != 0)
+		{
+			if (file >= 0)
+			{
+				close(file);
+			}
+			return false;
+		}
+		size = (size_t)file_stat.st_size;
+		void* mapped = size > 0 ? mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+		close(file);
+		data = mapped == MAP_FAILED ? nullptr : (char*)mapped;
+#endif
+		return data != nullptr;
+	}
+
+	/// Unmaps the memory. The owner also removes the name, readers that are still attached keep their mapping.
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+		}
+		if (mapping != NULL)
+		{
+			CloseHandle(mapping);
+			mapping = NULL;
+		}
+#else
+		if (data != nullptr)
+		{
+			munmap(data, size);
+			if (is_owner)
+			{
+				shm_unlink(PosixName().c_str());
+			}
+		}
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	char* Data()
+	{
+		return data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+private:
+
+#ifdef _WIN32
+	HANDLE		mapping			= NULL;
+#endif
+	string		name;
+	char*		data			= nullptr;
+	size_t		size			= 0;
+	bool		is_owner		= false;
+
+	string PosixName() const
+	{
+		return name[0] == '/' ? name : "/" + name;
+	}
+};
+
+/// Publishes frames to shared memory. Publishing is a copy into the next slot and never waits for readers, so it can
+/// be done on the thread that produces the frames. Not thread-safe: there is a single writer.
+class SharedFrameWriter
+{
+public:
+
+	bool Open(const string& name, uint32_t slot_count = SHARED_FRAME_RING_SLOTS)
+	{
+		if (!memory.Create(name, SharedFrameRingSize(slot_count)))
+		{
+			return false;
+		}
+		header = (SharedFrameRingHeader*)memory.Data();
+		slots = (SharedFrameSlot*)(memory.Data() + sizeof(SharedFrameRingHeader));
+		header->version = SHARED_FRAME_RING_VERSION;
+		header->slot_count = slot_count;
+		header->frame_size = sizeof(FrameData);
+		header->published_count.store(0, memory_order_relaxed);
+		for (uint32_t i = 0; i < slot_count; ++i)
+		{
+			slots[i].sequence.store(0, memory_order_relaxed);
+		}
+		published_count = 0;
+		// Readers only attach once the magic is there
+		atomic_thread_fence(memory_order_release);
+		memcpy(header->magic, SHARED_FRAME_RING_MAGIC, sizeof(header->magic));
+		return true;
+	}
+
+	bool IsOpen()
+	{
+		return memory.Data() != nullptr;
+	}
+
+	void Publish(const FrameData* frame)
+	{
+		SharedFrameSlot* slot = &slots[published_count % header->slot_count];
+		slot->sequence.store(2 * published_count + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		memcpy(&slot->frame, frame, sizeof(FrameData));
+		slot->sequence.store(2 * published_count + 2, memory_order_release);
+		++published_count;
+		header->published_count.store(published_count, memory_order_release);
+	}
+
+	uint64_t PublishedCount() const
+	{
+		return published_count;
+	}
+
+	void Close()
+	{
+		memory.Close();
+		header = nullptr;
+		slots = nullptr;
+	}
+
+private:
+
+	SharedMemory				memory;
+	SharedFrameRingHeader*		header			= nullptr;
+	SharedFrameSlot*			slots			= nullptr;
+	uint64_t					published_count	= 0;
+};
+
+/// Reads frames published by a SharedFrameWriter in another process. Reading makes no system calls and never
+/// blocks the writer; a reader that falls more than the ring's capacity behind skips the frames it missed.
+class SharedFrameReader
+{
+public:
+
+	/// Attaches to the ring. Fails if no writer has created it or it was written by an incompatible build.
+	bool Open(const string& name)
+	{
+		if (!memory.OpenRead(name) || memory.Size() < sizeof(SharedFrameRingHeader))
+		{
+			memory.Close();
+			return false;
+		}
+		header = (const SharedFrameRingHeader*)memory.Data();
+		// The writer fills in the rest of the header before the magic
+		bool is_compatible = memcmp(header->magic, SHARED_FRAME_RING_MAGIC, sizeof(header->magic)) == 0;
+		atomic_thread_fence(memory_order_acquire);
+		is_compatible = is_compatible && header->version == SHARED_FRAME_RING_VERSION &&
+			header->frame_size == sizeof(FrameData) && header->slot_count > 0 &&
+			memory.Size() >= SharedFrameRingSize(header->slot_count);
+		if (!is_compatible)
+		{
+			Close();
+			return false;
+		}
+		slots = (const SharedFrameSlot*)(memory.Data() + sizeof(SharedFrameRingHeader));
+		next_index = PublishedCount();
+		skipped_count = 0;
+		return true;
+	}
+
+	void Close()
+	{
+		memory.Close();
+		header = nullptr;
+		slots = nullptr;
+	}
+
+	/// Number of frames published so far. Frame n can be read while n < PublishedCount() and it has not been
+	/// overwritten, i.e. n >= PublishedCount() - slot count.
+	uint64_t PublishedCount() const
+	{
+		return header->published_count.load(memory_order_acquire);
+	}
+
+	/// Calls visit with frame n where it lies in shared memory, without copying it. Returns false if the frame is not
+	/// there, or if it was overwritten while visit ran, in which case whatever visit computed must be thrown away.
+	template<typename Visitor>
+	bool Visit(uint64_t n, Visitor visit) const
+	{
+		const SharedFrameSlot* slot = &slots[n % header->slot_count];
+		uint64_t sequence = slot->sequence.load(memory_order_acquire);
+		if (sequence != 2 * n + 2)
+		{
+			return false;
+		}
+		visit((const FrameData&)slot->frame);
+		atomic_thread_fence(memory_order_acquire);
+		return slot->sequence.load(memory_order_relaxed) == sequence;
+	}
+
+	/// Copies frame n. Returns false if it is not there.
+	bool Read(uint64_t n, FrameData* frame) const
+	{
+		return Visit(n, [frame](const FrameData& shared_frame)
+		{
+			memcpy(frame, &shared_frame, sizeof(FrameData));
+		});
+	}
+
+	/// Copies the next frame this reader has not seen yet. Returns false if there is no new frame.
+	bool ReadNext(FrameData* frame)
+	{
+		while (true)
+		{
+			uint64_t published = PublishedCount();
+			if (next_index >= published)
+			{
+				return false;
+			}
+			// Frames that were overwritten before they were read are skipped
+			uint64_t oldest = published > header->slot_count ? published - header->slot_count : 0;
+			if (next_index < oldest)
+			{
+				skipped_count += oldest - next_index;
+				next_index = oldest;
+			}
+			if (Read(next_index, frame))
+			{
+				++next_index;
+				return true;
+			}
+			// Overwritten while it was being read, so the reader is about to fall behind
+			++skipped_count;
+			++next_index;
+		}
+	}
+
+	/// Copies the newest frame. Returns false if nothing has been published.
+	bool ReadLatest(FrameData* frame)
+	{
+		while (true)
+		{
+			uint64_t published = PublishedCount();
+			if (published == 0)
+			{
+				return false;
+			}
+			if (Read(published - 1, frame))
+			{
+				next_index = published;
+				return true;
+			}
+		}
+	}
+
+	/// Frames ReadNext skipped because the writer overwrote them first
+	uint64_t SkippedCount() const
+	{
+		return skipped_count;
+	}
+
+private:
+
+	SharedMemory					memory;
+	const SharedFrameRingHeader*	header			= nullptr;
+	const SharedFrameSlot*			slots			= nullptr;
+	uint64_t						next_index		= 0;
+	uint64_t						skipped_count	= 0;
+};
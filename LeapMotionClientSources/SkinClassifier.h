@@ -0,0 +1,271 @@
+#pragma once
+
+#include "SkinModel.h"
+
+#include <stdint.h>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SKIN_CLASSIFIER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SKIN_CLASSIFIER_AVX2_TARGET
+#else
+#define SKIN_CLASSIFIER_AVX2_TARGET		__attribute__((target("avx2,fma")))
+#endif
+#endif
+
+using namespace std;
+
+// Colour features computed for each pixel, which must match the sample dimension of the trained model
+#define SKIN_FEATURE_COUNT				32
+// Single precision squared distances within this fraction of a squared threshold, or of zero, are decided again in
+// double precision. Near the thresholds the single precision error on the training images is below 5e-5 of them.
+#define SKIN_CLASSIFIER_GUARD_BAND		0.001
+
+/// Classifies rows of pixels as skin or not with a skin model. The features of a row are stored feature by feature,
+/// and the distance of several pixels at once is computed from the Cholesky factors of the model in single precision,
+/// with AVX2 or SSE2 where the processor has them. The few pixels whose distance is too close to a threshold for
+/// single precision to tell are decided by the model in double precision, so that the result is the same as with
+/// cv::Mahalanobis. Immutable, so one classifier can be used from several threads.
+class SkinClassifier
+{
+public:
+
+	/// The model must have SKIN_FEATURE_COUNT features and outlive the classifier
+	SkinClassifier(const SkinModel* skin_model) : model(skin_model), bounds(skin_model->ClusterCount())
+	{
+		for (int i = 0; i < model->ClusterCount(); ++i)
+		{
+			double threshold_squared = model->Cluster(i).upper_threshold_squared;
+			bounds[i].near_zero = (float)(SKIN_CLASSIFIER_GUARD_BAND * threshold_squared);
+			bounds[i].skin_below = (float)((1.0 - SKIN_CLASSIFIER_GUARD_BAND) * threshold_squared);
+			bounds[i].not_skin_above = (float)((1.0 + SKIN_CLASSIFIER_GUARD_BAND) * threshold_squared);
+		}
+		is_avx2_supported = IsAvx2Supported();
+	}
+
+	/// Classifies count pixels whose features are at features[f * stride + i] for feature f of pixel i, setting skin
+	/// pixels to 255 in mask and the others to 0. For each pixel that has to be decided in double precision
+	/// exact_features(i, sample) is called to fill in its SKIN_FEATURE_COUNT features.
+	template<typename ExactFeatures>
+	void ClassifyRow(const float* features, size_t stride, int count, unsigned char* mask,
+		ExactFeatures exact_features) const
+	{
+		int i = 0;
+#ifdef SKIN_CLASSIFIER_X86
+		if (is_avx2_supported)
+		{
+			for (; i + 8 <= count; i += 8)
+			{
+				uint32_t skin_bits, undecided_bits;
+				ClassifyAvx2(features + i, stride, &skin_bits, &undecided_bits);
+				WriteBlock(i, 8, skin_bits, undecided_bits, mask, exact_features);
+			}
+		}
+		for (; i + 4 <= count; i += 4)
+		{
+			uint32_t skin_bits, undecided_bits;
+			ClassifySse2(features + i, stride, &skin_bits, &undecided_bits);
+			WriteBlock(i, 4, skin_bits, undecided_bits, mask, exact_features);
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			uint32_t skin_bits, undecided_bits;
+			ClassifyScalar(features + i, stride, &skin_bits, &undecided_bits);
+			WriteBlock(i, 1, skin_bits, undecided_bits, mask, exact_features);
+		}
+	}
+
+private:
+
+	/// Single precision squared distances of a cluster that decide a pixel without double precision
+	struct ClusterBounds
+	{
+		float		near_zero;
+		float		skin_below;
+		float		not_skin_above;
+	};
+
+	const SkinModel*		model;
+	vector<ClusterBounds>	bounds;
+	bool					is_avx2_supported;
+
+	static bool IsAvx2Supported()
+	{
+#if defined(SKIN_CLASSIFIER_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		bool has_fma = (info[2] & (1 << 12)) != 0;
+		// The operating system must save the AVX registers on context switches
+		bool has_os_support = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		bool has_avx2 = (info[1] & (1 << 5)) != 0;
+		return has_fma && has_os_support && has_avx2;
+#elif defined(SKIN_CLASSIFIER_X86)
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+		return false;
+#endif
+	}
+
+	/// Sets the masks of a block of pixels from the bits of its skin pixels and of the pixels to decide exactly
+	template<typename ExactFeatures>
+	void WriteBlock(int first, int width, uint32_t skin_bits, uint32_t undecided_bits, unsigned char* mask,
+		ExactFeatures& exact_features) const
+	{
+		for (int k = 0; k < width; ++k)
+		{
+			if (undecided_bits & (1u << k))
+			{
+				double sample[SKIN_FEATURE_COUNT];
+				exact_features(first + k, sample);
+				mask[first + k] = model->IsSkin(sample) ? 255 : 0;
+			}
+			else
+			{
+				mask[first + k] = (skin_bits & (1u << k)) ? 255 : 0;
+			}
+		}
+	}
+
+	/// Adds the bits of one cluster to those of a block. Pixels neither surely skin nor surely not for the cluster are
+	/// left undecided.
+	static void AddClusterBits(uint32_t skin_bits_of_cluster, uint32_t not_skin_bits_of_cluster, uint32_t* skin_bits,
+		uint32_t* undecided_bits)
+	{
+		*skin_bits |= skin_bits_of_cluster;
+		*undecided_bits |= ~(skin_bits_of_cluster | not_skin_bits_of_cluster);
+	}
+
+	void ClassifyScalar(const float* features, size_t stride, uint32_t* skin_bits, uint32_t* undecided_bits) const
+	{
+		*skin_bits = 0;
+		*undecided_bits = 0;
+		for (int c = 0; c < model->ClusterCount(); ++c)
+		{
+			if (!model->Cluster(c).is_factored)
+			{
+				*undecided_bits |= 1;
+				continue;
+			}
+			const float* mean = model->FloatMean(c);
+			const float* factor = model->FloatFactor(c);
+			float difference[SKIN_FEATURE_COUNT];
+			for (int f = 0; f < SKIN_FEATURE_COUNT; ++f)
+			{
+				difference[f] = features[f * stride] - mean[f];
+			}
+			float distance_squared = 0.0f;
+			for (int col = 0; col < SKIN_FEATURE_COUNT; ++col)
+			{
+				float projected = 0.0f;
+				for (int row = col; row < SKIN_FEATURE_COUNT; ++row)
+				{
+					projected += *factor++ * difference[row];
+				}
+				distance_squared += projected * projected;
+			}
+			const ClusterBounds& cluster_bounds = bounds[c];
+			bool is_skin = distance_squared > cluster_bounds.near_zero && distance_squared < cluster_bounds.skin_below;
+			bool is_not_skin = distance_squared > cluster_bounds.not_skin_above;
+			AddClusterBits(is_skin ? 1 : 0, is_not_skin ? 1 : 0, skin_bits, undecided_bits);
+		}
+		*undecided_bits &= ~*skin_bits & 1;
+	}
+
+#ifdef SKIN_CLASSIFIER_X86
+
+	void ClassifySse2(const float* features, size_t stride, uint32_t* skin_bits, uint32_t* undecided_bits) const
+	{
+		*skin_bits = 0;
+		*undecided_bits = 0;
+		for (int c = 0; c < model->ClusterCount(); ++c)
+		{
+			if (!model->Cluster(c).is_factored)
+			{
+				*undecided_bits |= 0xf;
+				continue;
+			}
+			const float* mean = model->FloatMean(c);
+			const float* factor = model->FloatFactor(c);
+			__m128 difference[SKIN_FEATURE_COUNT];
+			for (int f = 0; f < SKIN_FEATURE_COUNT; ++f)
+			{
+				difference[f] = _mm_sub_ps(_mm_loadu_ps(features + f * stride), _mm_set1_ps(mean[f]));
+			}
+			__m128 distance_squared = _mm_setzero_ps();
+			for (int col = 0; col < SKIN_FEATURE_COUNT; ++col)
+			{
+				__m128 projected = _mm_setzero_ps();
+				for (int row = col; row < SKIN_FEATURE_COUNT; ++row)
+				{
+					projected = _mm_add_ps(projected, _mm_mul_ps(_mm_set1_ps(*factor++), difference[row]));
+				}
+				distance_squared = _mm_add_ps(distance_squared, _mm_mul_ps(projected, projected));
+			}
+			const ClusterBounds& cluster_bounds = bounds[c];
+			__m128 is_skin = _mm_and_ps(_mm_cmpgt_ps(distance_squared, _mm_set1_ps(cluster_bounds.near_zero)),
+				_mm_cmplt_ps(distance_squared, _mm_set1_ps(cluster_bounds.skin_below)));
+			__m128 is_not_skin = _mm_cmpgt_ps(distance_squared, _mm_set1_ps(cluster_bounds.not_skin_above));
+			AddClusterBits(_mm_movemask_ps(is_skin), _mm_movemask_ps(is_not_skin), skin_bits,
+				undecided_bits);
+		}
+		*undecided_bits &= ~*skin_bits & 0xf;
+	}
+
+	SKIN_CLASSIFIER_AVX2_TARGET
+	void ClassifyAvx2(const float* features, size_t stride, uint32_t* skin_bits, uint32_t* undecided_bits) const
+	{
+		*skin_bits = 0;
+		*undecided_bits = 0;
+		for (int c = 0; c < model->ClusterCount(); ++c)
+		{
+			if (!model->Cluster(c).is_factored)
+			{
+				*undecided_bits |= 0xff;
+				continue;
+			}
+			const float* mean = model->FloatMean(c);
+			const float* factor = model->FloatFactor(c);
+			__m256 difference[SKIN_FEATURE_COUNT];
+			for (int f = 0; f < SKIN_FEATURE_COUNT; ++f)
+			{
+				difference[f] = _mm256_sub_ps(_mm256_loadu_ps(features + f * stride), _mm256_set1_ps(mean[f]));
+			}
+			__m256 distance_squared = _mm256_setzero_ps();
+			for (int col = 0; col < SKIN_FEATURE_COUNT; ++col)
+			{
+				// Two sums, so that each waits for half as many multiply-adds
+				__m256 projected_even = _mm256_setzero_ps();
+				__m256 projected_odd = _mm256_setzero_ps();
+				int row = col;
+				for (; row + 1 < SKIN_FEATURE_COUNT; row += 2)
+				{
+					projected_even = _mm256_fmadd_ps(_mm256_set1_ps(factor[0]), difference[row], projected_even);
+					projected_odd = _mm256_fmadd_ps(_mm256_set1_ps(factor[1]), difference[row + 1], projected_odd);
+					factor += 2;
+				}
+				if (row < SKIN_FEATURE_COUNT)
+				{
+					projected_even = _mm256_fmadd_ps(_mm256_set1_ps(*factor++), difference[row], projected_even);
+				}
+				__m256 projected = _mm256_add_ps(projected_even, projected_odd);
+				distance_squared = _mm256_fmadd_ps(projected, projected, distance_squared);
+			}
+			const ClusterBounds& cluster_bounds = bounds[c];
+			__m256 is_skin = _mm256_and_ps(
+				_mm256_cmp_ps(distance_squared, _mm256_set1_ps(cluster_bounds.near_zero), _CMP_GT_OQ),
+				_mm256_cmp_ps(distance_squared, _mm256_set1_ps(cluster_bounds.skin_below), _CMP_LT_OQ));
+			__m256 is_not_skin = _mm256_cmp_ps(distance_squared, _mm256_set1_ps(cluster_bounds.not_skin_above),
+				_CMP_GT_OQ);
+			AddClusterBits(_mm256_movemask_ps(is_skin), _mm256_movemask_ps(is_not_skin), skin_bits,
+				undecided_bits);
+		}
+		*undecided_bits &= ~*skin_bits & 0xff;
+	}
+
+#endif
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "SkinClassifier.h"
+
+#include <atomic>
+#include <stdint.h>
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Pixels whose features are extracted and classified together, few enough for their features to stay in the L1 cache
+#define SKIN_FEATURE_TILE_WIDTH			128
+// Features of each of the two colours of a pixel
+#define SKIN_COLOR_FEATURE_COUNT		(SKIN_FEATURE_COUNT / 2)
+// Set in the Lab colour cache entries that have been converted
+#define LAB_CACHE_CONVERTED_BIT			(1u << 24)
+// Colours converted by one cvtColor call when adding to the Lab colour cache, the two colours of each pixel of a tile
+#define LAB_CACHE_ADD_BATCH				(2 * SKIN_FEATURE_TILE_WIDTH)
+
+/// Converts a pixel to YCrCb with the same fixed point arithmetic as cvtColor does for 8 bit images
+inline Vec3b BgrToYCrCb(const Vec3b& bgr)
+{
+	int b = bgr[0], g = bgr[1], r = bgr[2];
+	int y = (b * 1868 + g * 9617 + r * 4899 + (1 << 13)) >> 14;
+	int cr = ((r - y) * 11682 + (128 << 14) + (1 << 13)) >> 14;
+	int cb = ((b - y) * 9241 + (128 << 14) + (1 << 13)) >> 14;
+	return Vec3b(saturate_cast<uchar>(y), saturate_cast<uchar>(cr), saturate_cast<uchar>(cb));
+}
+
+/// Division tables of the 8 bit HSV conversion of cvtColor
+struct HsvDivisionTables
+{
+	int		saturation[256];
+	int		hue[256];
+
+	HsvDivisionTables()
+	{
+		saturation[0] = hue[0] = 0;
+		for (int i = 1; i < 256; ++i)
+		{
+			saturation[i] = cvRound((255 << 12) / (double)i);
+			hue[i] = cvRound((180 << 12) / (6.0 * i));
+		}
+	}
+};
+
+/// Converts a pixel to HSV with the same tables and fixed point arithmetic as cvtColor does for 8 bit images
+inline Vec3b BgrToHsv(const Vec3b& bgr)
+{
+	static const HsvDivisionTables tables;
+	int b = bgr[0], g = bgr[1], r = bgr[2];
+	int v = max(b, max(g, r));
+	int diff = v - min(b, min(g, r));
+	int is_r_max = v == r ? -1 : 0;
+	int is_g_max = v == g ? -1 : 0;
+	int s = (diff * tables.saturation[v] + (1 << 11)) >> 12;
+	int h = (is_r_max & (g - b)) +
+		(~is_r_max & ((is_g_max & (b - r + 2 * diff)) + (~is_g_max & (r - g + 4 * diff))));
+	h = (h * tables.hue[diff] + (1 << 11)) >> 12;
+	h += h < 0 ? 180 : 0;
+	return Vec3b(saturate_cast<uchar>(h), (uchar)s, (uchar)v);
+}
+
+/// Lab values of BGR colours, converted by cvtColor the first time each colour is seen. Lab is the costliest of the
+/// conversions and its 8 bit tables are internal to OpenCV, so colours are converted once and then looked up. Memory
+/// is taken 256 colours at a time, and the cache is shared by every detector and thread.
+class LabColorCache
+{
+public:
+
+	static LabColorCache& Shared()
+	{
+		static LabColorCache shared_cache;
+		return shared_cache;
+	}
+
+	~LabColorCache()
+	{
+		for (int i = 0; i < (1 << 16); ++i)
+		{
+			delete pages[i].load();
+		}
+	}
+
+	/// Looks up the Lab value of a colour. Returns false if it has not been converted yet.
+	bool Find(const Vec3b& bgr, Vec3b* lab) const
+	{
+		const Page* page = pages[(bgr[0] << 8) | bgr[1]].load(memory_order_acquire);
+		if (page == nullptr)
+		{
+			return false;
+		}
+		uint32_t entry = page->entries[bgr[2]].load(memory_order_relaxed);
+		*lab = Vec3b((uchar)entry, (uchar)(entry >> 8), (uchar)(entry >> 16));
+		return (entry & LAB_CACHE_CONVERTED_BIT) != 0;
+	}
+
+	/// Converts count colours with cvtColor and caches them. Both images live on the stack, so nothing is allocated
+	/// once the pages of the colours exist.
+	void Add(const Vec3b* colors, int count)
+	{
+		Vec3b lab_colors[LAB_CACHE_ADD_BATCH];
+		for (int start = 0; start < count; start += LAB_CACHE_ADD_BATCH)
+		{
+			int batch_count = min(count - start, LAB_CACHE_ADD_BATCH);
+			Mat bgr(1, batch_count, CV_8UC3, (void*)(colors + start));
+			// cvtColor writes to the given buffer as the size and type already match
+			Mat lab(1, batch_count, CV_8UC3, lab_colors);
+			cvtColor(bgr, lab, CV_BGR2Lab);
+			for (int i = 0; i < batch_count; ++i)
+			{
+				const Vec3b& color = colors[start + i];
+				uint32_t entry = lab_colors[i][0] | (lab_colors[i][1] << 8) | (lab_colors[i][2] << 16) |
+					LAB_CACHE_CONVERTED_BIT;
+				PageOf(color)->entries[color[2]].store(entry, memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+
+	// The colours with the same blue and green, indexed by red
+	struct Page
+	{
+		atomic<uint32_t>	entries[256];
+	};
+
+	// Indexed by blue and green
+	atomic<Page*>		pages[1 << 16];
+
+	LabColorCache()
+	{
+		for (int i = 0; i < (1 << 16); ++i)
+		{
+			pages[i].store(nullptr);
+		}
+	}
+
+	Page* PageOf(const Vec3b& bgr)
+	{
+		atomic<Page*>* slot = &pages[(bgr[0] << 8) | bgr[1]];
+		Page* page = slot->load(memory_order_acquire);
+		if (page == nullptr)
+		{
+			// Another thread may add the page at the same time, in which case its page is used
+			Page* created = new Page();
+			if (slot->compare_exchange_strong(page, created, memory_order_acq_rel))
+			{
+				page = created;
+			}
+			else
+			{
+				delete created;
+			}
+		}
+		return page;
+	}
+};
+
+/// Computes the skin colour features of pixels in a single pass from the colour of each pixel and the average colour
+/// around it. For each of the two colours the features are RGB, normalized red and green, opponent colours, YCrCb,
+/// HSV and Lab, in the order the trainer writes them. They are the same as converting the whole images with cvtColor.
+class SkinFeatureExtractor
+{
+public:
+
+	SkinFeatureExtractor(LabColorCache* cache = &LabColorCache::Shared()) : lab_cache(cache) {}
+
+	/// Writes the features of count pixels, at most SKIN_FEATURE_TILE_WIDTH, to features[f * stride + i] for feature
+	/// f of pixel i
+	void ExtractTile(const Vec3b* rgb, const Vec3b* surround_rgb, int count, float* features, size_t stride) const
+	{
+		// Colours not seen before are converted together
+		Vec3b labs[SKIN_FEATURE_TILE_WIDTH];
+		Vec3b surround_labs[SKIN_FEATURE_TILE_WIDTH];
+		Vec3b unconverted[2 * SKIN_FEATURE_TILE_WIDTH];
+		int unconverted_count = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			if (!lab_cache->Find(rgb[i], &labs[i]))
+			{
+				unconverted[unconverted_count++] = rgb[i];
+			}
+			if (!lab_cache->Find(surround_rgb[i], &surround_labs[i]))
+			{
+				unconverted[unconverted_count++] = surround_rgb[i];
+			}
+		}
+		if (unconverted_count > 0)
+		{
+			lab_cache->Add(unconverted, unconverted_count);
+			for (int i = 0; i < count; ++i)
+			{
+				lab_cache->Find(rgb[i], &labs[i]);
+				lab_cache->Find(surround_rgb[i], &surround_labs[i]);
+			}
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			WriteColorFeatures(rgb[i], labs[i], features + i, stride);
+			WriteColorFeatures(surround_rgb[i], surround_labs[i], features + SKIN_COLOR_FEATURE_COUNT * stride + i,
+				stride);
+		}
+	}
+
+	/// Writes the features of one pixel in double precision
+	void ExtractPixel(const Vec3b& rgb, const Vec3b& surround_rgb, double* features) const
+	{
+		Vec3b lab, surround_lab;
+		if (!lab_cache->Find(rgb, &lab) || !lab_cache->Find(surround_rgb, &surround_lab))
+		{
+			Vec3b colors[2] = { rgb, surround_rgb };
+			lab_cache->Add(colors, 2);
+			lab_cache->Find(rgb, &lab);
+			lab_cache->Find(surround_rgb, &surround_lab);
+		}
+		WriteColorFeatures(rgb, lab, features, 1);
+		WriteColorFeatures(surround_rgb, surround_lab, features + SKIN_COLOR_FEATURE_COUNT, 1);
+	}
+
+private:
+
+	LabColorCache*		lab_cache;
+
+	/// Writes the features of one colour to features[f * stride]. They are computed in double precision as the model
+	/// was trained with them, whatever the type they are stored as.
+	template<typename Feature>
+	static void WriteColorFeatures(const Vec3b& bgr, const Vec3b& lab, Feature* features, size_t stride)
+	{
+		double rgb_sum = bgr[0] + bgr[1] + bgr[2];
+		// Normalized RGB
+		double nr, ng;
+		if (rgb_sum > 0.0)
+		{
+			nr = ((double)bgr[2] / rgb_sum) * 255.0;
+			ng = ((double)bgr[1] / rgb_sum) * 255.0;
+		}
+		else
+		{
+			nr = 0.0;
+			ng = 0.0;
+		}
+		// Opponent colors
+		int RG = bgr[2] - bgr[1];
+		int YB = (2 * bgr[0] - bgr[2] + bgr[1]) / 4;
+		Vec3b ycrcb = BgrToYCrCb(bgr);
+		Vec3b hsv = BgrToHsv(bgr);
+
+		double color_features[SKIN_COLOR_FEATURE_COUNT] =
+		{
+			(double)bgr[2], (double)bgr[1], (double)bgr[0],
+			nr, ng,
+			(double)RG, (double)YB,
+			(double)ycrcb[0], (double)ycrcb[1], (double)ycrcb[2],
+			(double)hsv[0], (double)hsv[1], (double)hsv[2],
+			(double)lab[0], (double)lab[1], (double)lab[2]
+		};
+		for (int f = 0; f < SKIN_COLOR_FEATURE_COUNT; ++f)
+		{
+			features[f * stride] = (Feature)color_features[f];
+		}
+	}
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <math.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Pixels up to this many standard deviations of the training distances past their mean are taken as skin
+#define SKIN_STD_DEV_MARGIN			0.6
+// Largest feature vector a model may have, so that a pixel's features fit in a fixed array
+#define SKIN_MAX_SAMPLE_DIM			64
+
+/// One cluster of the trained skin colour model
+struct SkinCluster
+{
+	// Mahalanobis distances of skin pixels, compared as the distances of cv::Mahalanobis were
+	double			lower_threshold;
+	double			upper_threshold;
+	// Squared, so that the distance of a pixel is compared without taking its square root
+	double			upper_threshold_squared;
+	// Offset of the cluster's mean in SkinModel::means and float_means
+	size_t			mean_offset;
+	// Offset of the cluster's inverse covariance, row by row, in SkinModel::inv_covars
+	size_t			inv_covar_offset;
+	// Offset of the Cholesky factor L of the inverse covariance in SkinModel::float_factors, column by column from
+	// the diagonal down, so that the squared distance is |L^T (x - mean)|^2. Only set if is_factored.
+	size_t			factor_offset;
+	bool			is_factored;
+};
+
+/// The skin colour model written by the trainer, parsed once into flat arrays. Immutable once loaded, so one model is
+/// shared by every detector and thread.
+///
+/// Pixels are classified by SkinClassifier from the single precision factors. The double precision distance is
+/// computed exactly as cv::Mahalanobis computes it, and decides the pixels too close to a threshold for single
+/// precision.
+class SkinModel
+{
+public:
+
+	/// Parses the trainer's result file, whose single line is the sample dimension, the cluster count and for each
+	/// cluster the mean and standard deviation of the training distances, the mean and the inverse covariance.
+	/// Returns null if the file cannot be read or is malformed.
+	static shared_ptr<const SkinModel> Load(const string& file_name)
+	{
+		ifstream result_file(file_name);
+		string line;
+		if (!getline(result_file, line))
+		{
+			return nullptr;
+		}
+
+		shared_ptr<SkinModel> model(new SkinModel());
+		stringstream ss(line);
+		string field;
+		try
+		{
+			getline(ss, field, ';');
+			model->sample_dim = stoi(field);
+			getline(ss, field, ';');
+			int cluster_count = stoi(field);
+			if (model->sample_dim <= 0 || model->sample_dim > SKIN_MAX_SAMPLE_DIM || cluster_count <= 0)
+			{
+				return nullptr;
+			}
+			for (int i = 0; i < cluster_count; ++i)
+			{
+				if (!model->ReadCluster(&ss))
+				{
+					return nullptr;
+				}
+			}
+		}
+		catch (const logic_error&)
+		{
+			// stoi and stod throw on fields that are not numbers
+			return nullptr;
+		}
+		return model;
+	}
+
+	/// The model of the given file, loaded on first use and then shared until it is reloaded. Null if it cannot be
+	/// loaded, in which case loading is tried again on the next call.
+	static shared_ptr<const SkinModel> Shared(const string& file_name)
+	{
+		lock_guard<mutex> lock(SharedMutex());
+		shared_ptr<const SkinModel>& model = SharedModels()[file_name];
+		if (!model)
+		{
+			model = Load(file_name);
+		}
+		return model;
+	}
+
+	/// Reads the file again, e.g. after the skin colours have been retrained. Detectors switch to the new model on
+	/// their next image; images already being processed finish with the old one. If the file cannot be loaded the
+	/// previous model is kept and false returned.
+	static bool Reload(const string& file_name)
+	{
+		shared_ptr<const SkinModel> reloaded = Load(file_name);
+		if (!reloaded)
+		{
+			return false;
+		}
+		lock_guard<mutex> lock(SharedMutex());
+		SharedModels()[file_name] = reloaded;
+		return true;
+	}
+
+	int SampleDim() const
+	{
+		return sample_dim;
+	}
+
+	int ClusterCount() const
+	{
+		return (int)clusters.size();
+	}
+
+	const SkinCluster& Cluster(int cluster_index) const
+	{
+		return clusters[cluster_index];
+	}
+
+	const float* FloatMean(int cluster_index) const
+	{
+		return &float_means[clusters[cluster_index].mean_offset];
+	}
+
+	const float* FloatFactor(int cluster_index) const
+	{
+		return &float_factors[clusters[cluster_index].factor_offset];
+	}
+
+	/// Squared Mahalanobis distance of a sample of SampleDim features to the mean of a cluster. The sums are taken in
+	/// the same order as in cv::Mahalanobis, so that the results are the same to the last bit.
+	double SquaredDistance(const double* sample, int cluster_index) const
+	{
+		const SkinCluster& cluster = clusters[cluster_index];
+		const double* mean = &means[cluster.mean_offset];
+		const double* inv_covar = &inv_covars[cluster.inv_covar_offset];
+		double difference[SKIN_MAX_SAMPLE_DIM];
+		for (int i = 0; i < sample_dim; ++i)
+		{
+			difference[i] = sample[i] - mean[i];
+		}
+
+		double distance_squared = 0.0;
+		for (int row = 0; row < sample_dim; ++row, inv_covar += sample_dim)
+		{
+			double row_sum = 0.0;
+			int col = 0;
+			for (; col <= sample_dim - 4; col += 4)
+			{
+				row_sum += difference[col] * inv_covar[col] + difference[col + 1] * inv_covar[col + 1] +
+					difference[col + 2] * inv_covar[col + 2] + difference[col + 3] * inv_covar[col + 3];
+			}
+			for (; col < sample_dim; ++col)
+			{
+				row_sum += difference[col] * inv_covar[col];
+			}
+			distance_squared += row_sum * difference[row];
+		}
+		return distance_squared;
+	}
+
+	/// True if the sample is within the thresholds of any cluster, exactly as decided before the model was cached
+	bool IsSkin(const double* sample) const
+	{
+		for (int i = 0; i < (int)clusters.size(); ++i)
+		{
+			double distance = sqrt(SquaredDistance(sample, i));
+			if (distance >= clusters[i].lower_threshold && distance <= clusters[i].upper_threshold)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+
+	int					sample_dim		= 0;
+	vector<SkinCluster>	clusters;
+	// Means, inverse covariances and factors of all clusters one after another
+	vector<double>		means;
+	vector<double>		inv_covars;
+	vector<float>		float_means;
+	vector<float>		float_factors;
+
+	SkinModel() {}
+
+	static mutex& SharedMutex()
+	{
+		static mutex shared_mutex;
+		return shared_mutex;
+	}
+
+	static map<string, shared_ptr<const SkinModel>>& SharedModels()
+	{
+		static map<string, shared_ptr<const SkinModel>> shared_models;
+		return shared_models;
+	}
+
+	bool ReadCluster(stringstream* ss)
+	{
+		string mah_mean_str, mah_std_dev_str, mean_str, inv_covar_str;
+		if (!getline(*ss, mah_mean_str, ';') || !getline(*ss, mah_std_dev_str, ';') ||
+			!getline(*ss, mean_str, ';') || !getline(*ss, inv_covar_str, ';'))
+		{
+			return false;
+		}
+
+		SkinCluster cluster;
+		cluster.lower_threshold = 0.0;
+		cluster.upper_threshold = stod(mah_mean_str) + SKIN_STD_DEV_MARGIN * stod(mah_std_dev_str);
+		cluster.upper_threshold_squared = cluster.upper_threshold * cluster.upper_threshold;
+
+		cluster.mean_offset = means.size();
+		cluster.inv_covar_offset = inv_covars.size();
+		if (!ReadValues(mean_str, sample_dim, &means) || !ReadValues(inv_covar_str, sample_dim * sample_dim, &inv_covars))
+		{
+			return false;
+		}
+		float_means.insert(float_means.end(), means.begin() + cluster.mean_offset, means.end());
+
+		cluster.factor_offset = float_factors.size();
+		cluster.is_factored = AppendCholeskyFactor(&inv_covars[cluster.inv_covar_offset]);
+		clusters.push_back(cluster);
+		return true;
+	}
+
+	static bool ReadValues(const string& values_str, int count, vector<double>* values)
+	{
+		stringstream values_ss(values_str);
+		string value_str;
+		for (int i = 0; i < count; ++i)
+		{
+			if (!getline(values_ss, value_str, ','))
+			{
+				return false;
+			}
+			values->push_back(stod(value_str));
+		}
+		return true;
+	}
+
+	/// Appends the lower triangular L with inv_covar = L L^T to float_factors, column by column from the diagonal down.
+	/// Returns false, appending nothing, if the matrix is not positive definite, as a badly conditioned training result
+	/// may not be.
+	bool AppendCholeskyFactor(const double* inv_covar)
+	{
+		int n = sample_dim;
+		vector<double> lower(n * n, 0.0);
+		for (int col = 0; col < n; ++col)
+		{
+			double diagonal = inv_covar[col * n + col];
+			for (int k = 0; k < col; ++k)
+			{
+				diagonal -= lower[col * n + k] * lower[col * n + k];
+			}
+			if (!(diagonal > 0.0))
+			{
+				return false;
+			}
+			lower[col * n + col] = sqrt(diagonal);
+			for (int row = col + 1; row < n; ++row)
+			{
+				// The trainer writes a symmetric matrix; averaging both halves keeps rounding from mattering
+				double entry = 0.5 * (inv_covar[row * n + col] + inv_covar[col * n + row]);
+				for (int k = 0; k < col; ++k)
+				{
+					entry -= lower[row * n + k] * lower[col * n + k];
+				}
+				lower[row * n + col] = entry / lower[col * n + col];
+			}
+		}
+		for (int col = 0; col < n; ++col)
+		{
+			for (int row = col; row < n; ++row)
+			{
+				float_factors.push_back((float)lower[row * n + col]);
+			}
+		}
+		return true;
+	}
+};
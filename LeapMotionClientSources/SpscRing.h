@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+/// What the ring does when the producer pushes into a full ring
+enum class OverflowPolicy
+{
+	// The oldest queued item is dropped to make room for the new one
+	DROP_OLDEST,
+	// As DROP_OLDEST, and in addition the consumer always takes the newest item, dropping everything older
+	COALESCE_LATEST
+};
+
+/// Copies an item out of its slot when it is popped. Items that only use part of their storage overload it to copy
+/// only what is in use.
+template<typename T>
+void CopyRingItem(const T& from, T* to)
+{
+	*to = from;
+}
+
+/// Bounded single-producer/single-consumer ring of preallocated slots. The producer fills a slot in place between
+/// BeginPush and CommitPush and never blocks. The consumer copies the item out with CopyRingItem and then claims it
+/// with a compare and swap on the tail; if the producer had to drop that item in the meantime the claim fails and the
+/// consumer moves on to the next one, so an item that is being overwritten is never returned.
+template<typename T>
+class SpscRing
+{
+public:
+
+	/// The capacity is rounded up to a power of two
+	SpscRing(size_t capacity, OverflowPolicy overflow_policy)
+	{
+		size_t rounded_capacity = 1;
+		while (rounded_capacity < capacity)
+		{
+			rounded_capacity <<= 1;
+		}
+		slots.resize(rounded_capacity);
+		mask = rounded_capacity - 1;
+		policy = overflow_policy;
+	}
+
+	/// Producer only. Returns the slot to fill, making room for it first if the ring is full.
+	T* BeginPush()
+	{
+		uint64_t current_head = head.load(memory_order_relaxed);
+		uint64_t current_tail = tail.load(memory_order_acquire);
+		while (current_head - current_tail >= slots.size())
+		{
+			// Drop the oldest item. If the consumer took it first there is room now anyway.
+			if (tail.compare_exchange_weak(current_tail, current_tail + 1, memory_order_acq_rel))
+			{
+				drop_count.fetch_add(1, memory_order_relaxed);
+				current_tail = current_tail + 1;
+			}
+		}
+		return &slots[current_head & mask];
+	}
+
+	/// Producer only. Publishes the slot returned by BeginPush and wakes up a waiting consumer.
+	void CommitPush()
+	{
+		head.store(head.load(memory_order_relaxed) + 1, memory_order_seq_cst);
+		push_count.fetch_add(1, memory_order_relaxed);
+		if (consumer_waiting.load(memory_order_seq_cst))
+		{
+			lock_guard<mutex> lock(wait_mutex);
+			wait_condition.notify_one();
+		}
+	}
+
+	/// Consumer only. Copies the next item to the output. Returns false if the ring is empty.
+	bool TryPop(T* item)
+	{
+		uint64_t current_tail = tail.load(memory_order_acquire);
+		while (true)
+		{
+			uint64_t current_head = head.load(memory_order_acquire);
+			if (current_head == current_tail)
+			{
+				return false;
+			}
+
+			uint64_t index = policy == OverflowPolicy::COALESCE_LATEST ? current_head - 1 : current_tail;
+			CopyRingItem(slots[index & mask], item);
+
+			// Only succeeds if the producer did not drop the item while it was being copied
+			if (tail.compare_exchange_strong(current_tail, index + 1, memory_order_acq_rel))
+			{
+				if (index > current_tail)
+				{
+					drop_count.fetch_add(index - current_tail, memory_order_relaxed);
+				}
+				return true;
+			}
+		}
+	}
+
+	/// Consumer only. Waits until an item is available or the timeout passes, then tries to pop it.
+	bool WaitPop(T* item, chrono::milliseconds timeout)
+	{
+		if (TryPop(item))
+		{
+			return true;
+		}
+
+		{
+			unique_lock<mutex> lock(wait_mutex);
+			consumer_waiting.store(true, memory_order_seq_cst);
+			wait_condition.wait_for(lock, timeout, [this] { return Depth() > 0 || is_woken; });
+			consumer_waiting.store(false, memory_order_seq_cst);
+			is_woken = false;
+		}
+
+		return TryPop(item);
+	}
+
+	/// Wakes up the consumer if it is waiting, e.g. when the pipeline is shutting down
+	void WakeConsumer()
+	{
+		lock_guard<mutex> lock(wait_mutex);
+		is_woken = true;
+		wait_condition.notify_one();
+	}
+
+	/// Number of queued items
+	size_t Depth() const
+	{
+		uint64_t current_tail = tail.load(memory_order_acquire);
+		uint64_t current_head = head.load(memory_order_acquire);
+		return (size_t)(current_head - current_tail);
+	}
+
+	size_t Capacity() const
+	{
+		return slots.size();
+	}
+
+	uint64_t Pushes() const
+	{
+		return push_count.load(memory_order_relaxed);
+	}
+
+	uint64_t Drops() const
+	{
+		return drop_count.load(memory_order_relaxed);
+	}
+
+private:
+
+	vector<T>			slots;
+	uint64_t			mask;
+	OverflowPolicy		policy;
+
+	// Kept on separate cache lines so the producer and consumer do not invalidate each other's line
+	alignas(64) atomic<uint64_t>	head				= { 0 };
+	alignas(64) atomic<uint64_t>	tail				= { 0 };
+	alignas(64) atomic<uint64_t>	push_count			= { 0 };
+	atomic<uint64_t>				drop_count			= { 0 };
+
+	atomic<bool>					consumer_waiting	= { false };
+	bool							is_woken			= false;
+	mutex							wait_mutex;
+	condition_variable				wait_condition;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+#include "DatagramStamp.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+#define METRICS_DUMP_INTERVAL_MS		5000
+
+/// What is measured along the frame path
+enum class MetricStage
+{
+	// Leap capture time to the frame being read on the client, in nanoseconds
+	CAPTURE_TO_READ,
+	// Encoding a frame in every encoding in use, in nanoseconds
+	ENCODE,
+	// One send call, in nanoseconds
+	SEND,
+	// Bytes of one frame over all encodings in use
+	FRAME_BYTES,
+	COUNT
+};
+
+static const char* metric_stage_names[] = { "capture_to_read_ns", "encode_ns", "send_ns", "frame_bytes" };
+
+/// Monotonic time in nanoseconds, for measuring durations
+inline int64_t MetricsClock()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Histograms of every stage of the frame path. Code on the frame path takes a pointer to this, and does nothing more
+/// than a null check when metrics are disabled.
+class StreamMetrics
+{
+public:
+
+	void Record(MetricStage stage, int64_t value)
+	{
+		histograms[(int)stage].Record(value);
+	}
+
+	/// Records the time since start, which was taken with MetricsClock
+	void RecordSince(MetricStage stage, int64_t start)
+	{
+		histograms[(int)stage].Record(MetricsClock() - start);
+	}
+
+	void Snapshot(MetricStage stage, HistogramSnapshot* snapshot) const
+	{
+		histograms[(int)stage].Snapshot(snapshot);
+	}
+
+private:
+
+	LatencyHistogram	histograms[(int)MetricStage::COUNT];
+};
+
+/// Appends the percentiles of every stage to a file at a fixed interval, one line per stage:
+/// <wall clock us> <stage> count=<n> p50=<v> p99=<v> p99.9=<v> max=<v>
+/// The counts and percentiles cover only the interval since the previous dump.
+class StreamMetricsDumper
+{
+public:
+
+	StreamMetricsDumper(StreamMetrics* stream_metrics, const string& path,
+		chrono::milliseconds interval = chrono::milliseconds(METRICS_DUMP_INTERVAL_MS))
+	{
+		metrics = stream_metrics;
+		file_path = path;
+		dump_interval = interval;
+		previous = new HistogramSnapshot[(int)MetricStage::COUNT]();
+		current = new HistogramSnapshot[(int)MetricStage::COUNT]();
+	}
+
+	~StreamMetricsDumper()
+	{
+		Stop();
+		delete[] previous;
+		delete[] current;
+	}
+
+	bool Start()
+	{
+		output.open(file_path, ios::out | ios::app);
+		if (!output.is_open())
+		{
+			return false;
+		}
+		is_running = true;
+		dump_thread = thread(&StreamMetricsDumper::Run, this);
+		return true;
+	}
+
+	/// Stops the dumper after writing the last interval
+	void Stop()
+	{
+		{
+			lock_guard<mutex> lock(dump_mutex);
+			if (!is_running)
+			{
+				return;
+			}
+			is_running = false;
+		}
+		dump_condition.notify_all();
+		dump_thread.join();
+		output.close();
+	}
+
+	void Dump()
+	{
+		int64_t now = CurrentTimestamp();
+		for (int i = 0; i < (int)MetricStage::COUNT; ++i)
+		{
+			metrics->Snapshot((MetricStage)i, &current[i]);
+			HistogramSnapshot interval = current[i];
+			interval.Subtract(&previous[i]);
+			previous[i] = current[i];
+
+			output << now << " " << metric_stage_names[i]
+				<< " count=" << interval.total_count
+				<< " p50=" << interval.Percentile(0.5)
+				<< " p99=" << interval.Percentile(0.99)
+				<< " p99.9=" << interval.Percentile(0.999)
+				<< " max=" << interval.max_value << "\n";
+		}
+		output.flush();
+	}
+
+private:
+
+	StreamMetrics*			metrics;
+	string					file_path;
+	chrono::milliseconds	dump_interval;
+	ofstream				output;
+	// Heap allocated, each one holds the counts of every bucket
+	HistogramSnapshot*		previous;
+	HistogramSnapshot*		current;
+	bool					is_running		= false;
+	mutex					dump_mutex;
+	condition_variable		dump_condition;
+	thread					dump_thread;
+
+	void Run()
+	{
+		unique_lock<mutex> lock(dump_mutex);
+		while (is_running)
+		{
+			dump_condition.wait_for(lock, dump_interval, [this] { return !is_running; });
+			Dump();
+		}
+	}
+};
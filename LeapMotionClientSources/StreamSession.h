@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+using namespace std;
+
+/// State of a streaming session. STOPPED is final.
+enum class SessionState
+{
+	STREAMING,
+	PAUSED,
+	STOPPED
+};
+
+/// Streaming state shared by the control channel, the console and the main thread. The state is an atomic, so reading
+/// it never blocks. Transitions are serialized together with the state change callback, so the callbacks see the
+/// transitions in the order they happened and nothing can leave a stopped session.
+class StreamSession
+{
+public:
+
+	SessionState State() const
+	{
+		return state.load();
+	}
+
+	bool IsStopped() const
+	{
+		return state.load() == SessionState::STOPPED;
+	}
+
+	/// Called on the thread that made the transition, with the new state. Must not change the state itself.
+	void SetStateCallback(function<void(SessionState)> callback)
+	{
+		lock_guard<mutex> lock(transition_mutex);
+		state_callback = callback;
+	}
+
+	/// Returns false if the session was not streaming
+	bool Pause()
+	{
+		return Transition(SessionState::STREAMING, SessionState::PAUSED);
+	}
+
+	/// Returns false if the session was not paused
+	bool Resume()
+	{
+		return Transition(SessionState::PAUSED, SessionState::STREAMING);
+	}
+
+	/// Returns false if the session was already stopped
+	bool Stop()
+	{
+		while (true)
+		{
+			SessionState current = state.load();
+			if (current == SessionState::STOPPED)
+			{
+				return false;
+			}
+			if (Transition(current, SessionState::STOPPED))
+			{
+				return true;
+			}
+		}
+	}
+
+	void WaitUntilStopped()
+	{
+		unique_lock<mutex> lock(session_mutex);
+		session_condition.wait(lock, [this] { return IsStopped(); });
+	}
+
+private:
+
+	atomic<SessionState>			state			= { SessionState::STREAMING };
+	mutex							transition_mutex;
+	function<void(SessionState)>	state_callback;
+	mutex							session_mutex;
+	condition_variable				session_condition;
+
+	bool Transition(SessionState from, SessionState to)
+	{
+		{
+			lock_guard<mutex> lock(transition_mutex);
+			if (state.load() != from)
+			{
+				return false;
+			}
+			state.store(to);
+			if (state_callback)
+			{
+				state_callback(to);
+			}
+		}
+
+		if (to == SessionState::STOPPED)
+		{
+			// Taking the lock makes sure a waiter either sees the new state or is already waiting
+			lock_guard<mutex> lock(session_mutex);
+			session_condition.notify_all();
+		}
+		return true;
+	}
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "DatagramStamp.h"
+
+#include <math.h>
+#include <stdint.h>
+
+using namespace std;
+
+/// Receiver side statistics of a stamped datagram stream. Feed it the stamp of every received datagram together with
+/// the local arrival time. Loss is the number of sequence numbers that were expected but never arrived, and jitter is
+/// the interarrival jitter of RFC 3550 in microseconds. The sender and receiver clocks need not be synchronized, only
+/// the differences between transit times are used.
+class StreamStatistics
+{
+public:
+
+	void OnDatagram(const DatagramStamp* stamp, int64_t arrival_timestamp)
+	{
+		OnDatagram(stamp->sequence, stamp->send_timestamp, arrival_timestamp);
+	}
+
+	void OnDatagram(uint32_t sequence, int64_t send_timestamp, int64_t arrival_timestamp)
+	{
+		++received_count;
+		int64_t transit = arrival_timestamp - send_timestamp;
+
+		if (received_count == 1)
+		{
+			first_sequence = sequence;
+			highest_sequence = sequence;
+			previous_transit = transit;
+			return;
+		}
+
+		// The signed difference keeps working when the 32-bit sequence number wraps around
+		int32_t sequence_difference = (int32_t)(sequence - (uint32_t)highest_sequence);
+		if (sequence_difference > 0)
+		{
+			highest_sequence += sequence_difference;
+		}
+		else
+		{
+			++reordered_count;
+		}
+
+		double transit_difference = fabs((double)(transit - previous_transit));
+		jitter += (transit_difference - jitter) / 16.0;
+		previous_transit = transit;
+	}
+
+	uint64_t Received() const
+	{
+		return received_count;
+	}
+
+	/// Number of datagrams between the first and the highest received sequence number that have not arrived.
+	/// Duplicates can make this negative.
+	int64_t Lost() const
+	{
+		if (received_count == 0)
+		{
+			return 0;
+		}
+		int64_t expected = highest_sequence - first_sequence + 1;
+		return expected - (int64_t)received_count;
+	}
+
+	double LossRate() const
+	{
+		if (received_count == 0)
+		{
+			return 0.0;
+		}
+		int64_t expected = highest_sequence - first_sequence + 1;
+		int64_t lost = Lost();
+		return lost > 0 ? (double)lost / (double)expected : 0.0;
+	}
+
+	/// Number of datagrams that arrived after a datagram with a higher sequence number
+	uint64_t Reordered() const
+	{
+		return reordered_count;
+	}
+
+	/// Interarrival jitter in microseconds
+	double Jitter() const
+	{
+		return jitter;
+	}
+
+	void Reset()
+	{
+		received_count = 0;
+		reordered_count = 0;
+		first_sequence = 0;
+		highest_sequence = 0;
+		previous_transit = 0;
+		jitter = 0.0;
+	}
+
+private:
+
+	uint64_t	received_count		= 0;
+	uint64_t	reordered_count		= 0;
+	// Sequence numbers unwrapped to 64 bits
+	int64_t		first_sequence		= 0;
+	int64_t		highest_sequence	= 0;
+	int64_t		previous_transit	= 0;
+	double		jitter				= 0.0;
+};
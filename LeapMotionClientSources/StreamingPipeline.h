@@ -0,0 +1,175 @@
+#pragma once
+
+#include "ConnectionManager.h"
+#include "FrameLog.h"
+#include "FrameSource.h"
+#include "SharedFrameRing.h"
+#include "SpscRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace std;
+
+#define PIPELINE_RING_CAPACITY			8
+#define PIPELINE_WAIT_TIMEOUT_MS		100
+
+/// Counters of one queue between two stages
+struct PipelineQueueStats
+{
+	size_t		depth;
+	size_t		capacity;
+	uint64_t	pushed;
+	uint64_t	dropped;
+};
+
+/// Runs acquisition, encoding and sending as three stages. Frames are acquired on the frame source's own thread,
+/// encoded on a second thread and sent on a third. The stages are joined by bounded SPSC rings, so a send that blocks
+/// on the network only fills the rings instead of delaying the next frame read.
+class StreamingPipeline
+{
+public:
+
+	StreamingPipeline(FrameSource* source, ConnectionManager* cm, OverflowPolicy policy,
+		size_t capacity = PIPELINE_RING_CAPACITY) :
+		frame_ring(capacity, policy),
+		encoded_ring(capacity, policy)
+	{
+		frame_source = source;
+		connection_manager = cm;
+	}
+
+	~StreamingPipeline()
+	{
+		Stop();
+	}
+
+	/// Record every acquired frame, including the ones that are dropped later on. Call before Start.
+	void SetRecorder(FrameLogWriter* recorder)
+	{
+		frame_recorder = recorder;
+	}
+
+	/// Publish every acquired frame to shared memory for local readers. Call before Start.
+	void SetSharedFrameWriter(SharedFrameWriter* writer)
+	{
+		shared_frame_writer = writer;
+	}
+
+	void Start()
+	{
+		is_running = true;
+		encode_thread = thread(&StreamingPipeline::RunEncodeStage, this);
+		send_thread = thread(&StreamingPipeline::RunSendStage, this);
+		frame_source->SetFrameCallback([this](const FrameData& frame)
+		{
+			AcquireFrame(frame);
+		});
+	}
+
+	void Stop()
+	{
+		if (!is_running.exchange(false))
+		{
+			return;
+		}
+		// Waits for a frame that is being acquired, so that the recorder and shared memory can be closed after Stop
+		frame_source->SetFrameCallback(nullptr);
+		frame_ring.WakeConsumer();
+		encoded_ring.WakeConsumer();
+		encode_thread.join();
+		send_thread.join();
+	}
+
+	PipelineQueueStats FrameQueueStats() const
+	{
+		return MakeStats(&frame_ring);
+	}
+
+	PipelineQueueStats EncodedQueueStats() const
+	{
+		return MakeStats(&encoded_ring);
+	}
+
+	void PrintStats()
+	{
+		PipelineQueueStats acquired = FrameQueueStats();
+		PipelineQueueStats encoded = EncodedQueueStats();
+		cout << "Acquired frames: " << acquired.pushed << ", dropped before encoding: " << acquired.dropped
+			<< ", queue depth: " << acquired.depth << "/" << acquired.capacity << endl;
+		cout << "Encoded frames: " << encoded.pushed << ", dropped before sending: " << encoded.dropped
+			<< ", queue depth: " << encoded.depth << "/" << encoded.capacity << endl;
+		cout << "Sent frames: " << sent_count.load() << endl;
+	}
+
+private:
+
+	FrameSource*				frame_source;
+	ConnectionManager*			connection_manager;
+	SpscRing<FrameData>			frame_ring;
+	SpscRing<EncodedFrame>		encoded_ring;
+	FrameLogWriter*				frame_recorder		= nullptr;
+	SharedFrameWriter*			shared_frame_writer	= nullptr;
+	atomic<bool>				is_running			= { false };
+	atomic<uint64_t>			sent_count			= { 0 };
+	thread						encode_thread;
+	thread						send_thread;
+
+	/// Acquire stage. Runs on the frame source's thread and only copies the frame into the ring, and into the
+	/// recording and shared memory if there are any.
+	void AcquireFrame(const FrameData& frame)
+	{
+		if (frame_recorder != nullptr)
+		{
+			frame_recorder->Append(&frame);
+		}
+		if (shared_frame_writer != nullptr)
+		{
+			shared_frame_writer->Publish(&frame);
+		}
+		*frame_ring.BeginPush() = frame;
+		frame_ring.CommitPush();
+	}
+
+	void RunEncodeStage()
+	{
+		FrameData frame;
+		while (is_running)
+		{
+			if (frame_ring.WaitPop(&frame, chrono::milliseconds(PIPELINE_WAIT_TIMEOUT_MS)))
+			{
+				EncodedFrame* encoded = encoded_ring.BeginPush();
+				connection_manager->EncodeFrame(&frame, encoded);
+				encoded_ring.CommitPush();
+			}
+		}
+	}
+
+	void RunSendStage()
+	{
+		// Popping copies the slot, so the send buffer is kept here rather than on the stack
+		unique_ptr<EncodedFrame> encoded(new EncodedFrame());
+		while (is_running)
+		{
+			if (encoded_ring.WaitPop(encoded.get(), chrono::milliseconds(PIPELINE_WAIT_TIMEOUT_MS)))
+			{
+				connection_manager->SendEncodedFrame(encoded.get());
+				++sent_count;
+			}
+		}
+	}
+
+	template<typename T>
+	static PipelineQueueStats MakeStats(const SpscRing<T>* ring)
+	{
+		PipelineQueueStats stats;
+		stats.depth = ring->Depth();
+		stats.capacity = ring->Capacity();
+		stats.pushed = ring->Pushes();
+		stats.dropped = ring->Drops();
+		return stats;
+	}
+};
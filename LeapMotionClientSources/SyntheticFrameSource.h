@@ -0,0 +1,122 @@
+#pragma once
+
+#include "FrameData.h"
+#include "FrameSource.h"
+
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+using namespace std;
+
+#define SYNTHETIC_FRAME_RATE		110.0
+
+/// Fills the frame with hand_count hands (0, 1 or 2) whose palms move on a small circle. The values are in the
+/// streamed coordinate system and roughly match what the Leap produces for hands held in front of a HMD.
+inline void MakeSyntheticFrame(int hand_count, double time, FrameData* frame)
+{
+	memset(frame, 0, sizeof(FrameData));
+	frame->capture_timestamp = (int64_t)(time * 1000000.0);
+	for (int i = 0; i < hand_count && i < MAX_HANDS_PER_FRAME; ++i)
+	{
+		frame->hand_mask |= HandBit(i);
+		HandData* hand = &frame->hands[i];
+		float side = i == LEFT_HAND_INDEX ? -1.0f : 1.0f;
+		float phase = (float)(time * 2.0) + i;
+
+		hand->palm = { side * 0.1f + 0.02f * cosf(phase), 0.3f + 0.02f * sinf(phase), -0.05f };
+		hand->stabilized_palm = hand->palm;
+		hand->palm_normal = { 0.0f, 0.0f, 0.001f };
+		hand->palm_velocity = { -0.04f * sinf(phase), 0.04f * cosf(phase), 0.0f };
+		hand->palm_to_fingers = { 0.0f, 0.001f, 0.0f };
+		hand->grab_angle = 0.5f + 0.5f * sinf(phase);
+		hand->pinch_distance = 0.03f;
+
+		hand->finger_count = MAX_FINGERS_PER_HAND;
+		for (int f = 0; f < MAX_FINGERS_PER_HAND; ++f)
+		{
+			FingerData* finger = &hand->fingers[f];
+			float offset = side * (f - 2) * 0.02f;
+			finger->type = f;
+			finger->is_extended = f != 0;
+			finger->direction = { 0.0f, 0.001f, 0.0f };
+			finger->tip = { hand->palm.x + offset, hand->palm.y + 0.08f, hand->palm.z };
+			finger->stabilized_tip = finger->tip;
+			finger->tip_velocity = hand->palm_velocity;
+		}
+
+		hand->forearm.is_valid = true;
+		hand->forearm.wrist = { hand->palm.x, hand->palm.y - 0.05f, hand->palm.z };
+		hand->forearm.direction = { 0.0f, 0.001f, 0.0f };
+		hand->forearm.elbow = { hand->palm.x, hand->palm.y - 0.3f, hand->palm.z - 0.05f };
+	}
+}
+
+/// Frame source that generates frames at a fixed rate on its own thread. Lets the streaming pipeline run on a
+/// machine without a Leap controller.
+class SyntheticFrameSource : public FrameSource
+{
+public:
+
+	SyntheticFrameSource(int hands = MAX_HANDS_PER_FRAME, double rate = SYNTHETIC_FRAME_RATE)
+	{
+		hand_count = hands;
+		frame_rate = rate;
+	}
+
+	~SyntheticFrameSource()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		if (is_running)
+		{
+			return;
+		}
+		ResetStopped();
+		is_running = true;
+		generator_thread = thread(&SyntheticFrameSource::Generate, this);
+		SetConnected(true);
+	}
+
+	void Stop()
+	{
+		is_running = false;
+		if (generator_thread.joinable())
+		{
+			generator_thread.join();
+		}
+		SetConnected(false);
+		FrameSource::Stop();
+	}
+
+private:
+
+	int				hand_count;
+	double			frame_rate;
+	atomic<bool>	is_running		= { false };
+	thread			generator_thread;
+
+	void Generate()
+	{
+		auto frame_interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / frame_rate));
+		auto start_time = chrono::steady_clock::now();
+		auto next_frame_time = start_time;
+		FrameData frame;
+		int64_t frame_id = 0;
+		while (is_running)
+		{
+			double time = chrono::duration<double>(next_frame_time - start_time).count();
+			MakeSyntheticFrame(hand_count, time, &frame);
+			frame.id = ++frame_id;
+			PublishFrame(frame);
+
+			next_frame_time += frame_interval;
+			this_thread::sleep_until(next_frame_time);
+		}
+	}
+};
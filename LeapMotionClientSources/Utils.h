@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Leap.h"
+#include "FrameData.h"
+#include "FrameTransform.h"
 #include "opencv2\core.hpp"
 
 #include <iostream>
@@ -14,7 +16,7 @@ using namespace std;
 using namespace Leap;
 using namespace cv;
 
-const float mm_to_m = 0.001f;
+const float mm_to_m = LEAP_MM_TO_M;
 
 
 string GetInputString()
@@ -64,170 +66,68 @@ bool DoRetryBasedOnInput(string retry_string)
 	return choice == 'y';
 }
 
-string LeapArmToJsonForearm(Arm* arm)
+/// Copies a Leap vector as is. The conversion to the streamed coordinate system is done for the whole frame at once
+/// by LeapFrameToFrameData.
+Float3 LeapVectorToFloat3(const Vector& vec)
 {
-	string forearm_string;
-	stringstream ss;
+	Float3 result;
+	result.x = vec.x;
+	result.y = vec.y;
+	result.z = vec.z;
+	return result;
+}
 
-	if (!arm->isValid())
-	{
-		forearm_string = "null";
-	}
-	else
+void LeapArmToForearmData(Arm* arm, ForearmData* forearm)
+{
+	forearm->is_valid = arm->isValid();
+	if (forearm->is_valid)
 	{
-		// { "wrist_x": 2.2, ....., "elbow_z": 0.3 }
-		ss << "{ ";
-
-		// Wrist position
-		ss << "\"wrist_x\": " << -(arm->wristPosition().x) * mm_to_m;
-		ss << ", \"wrist_y\": " << arm->wristPosition().z * mm_to_m;
-		ss << ", \"wrist_z\": " << arm->wristPosition().y * mm_to_m;
-		// Forearm direction
-		ss << ", \"direction_x\": " << -(arm->direction().x) * mm_to_m;
-		ss << ", \"direction_y\": " << arm->direction().z * mm_to_m;
-		ss << ", \"direction_z\": " << arm->direction().y * mm_to_m;
-		// Elbow position
-		ss << ", \"elbow_x\": " << -(arm->elbowPosition().x) * mm_to_m;
-		ss << ", \"elbow_y\": " << arm->elbowPosition().z * mm_to_m;
-		ss << ", \"elbow_z\": " << arm->elbowPosition().y * mm_to_m;
-
-		ss << " }";
-
-		forearm_string = ss.str();
+		forearm->wrist = LeapVectorToFloat3(arm->wristPosition());
+		forearm->direction = LeapVectorToFloat3(arm->direction());
+		forearm->elbow = LeapVectorToFloat3(arm->elbowPosition());
 	}
-
-	return forearm_string;
 }
 
-string LeapFingerToJsonFinger(Finger* finger)
+void LeapFingerToFingerData(Finger* finger, FingerData* finger_data)
 {
-	string finger_string;
-	stringstream ss;
-
-	// { "type": 2, ....., "tip_velocity_z": 0.2 }
-
-	ss << "{ ";
-
-	// Type
-	ss << "\"type\": " << finger->type();
-	// Direction
-	ss << ", \"direction_x\": " << -(finger->direction().x) * mm_to_m;
-	ss << ", \"direction_y\": " << finger->direction().z * mm_to_m;
-	ss << ", \"direction_z\": " << finger->direction().y * mm_to_m;
-	// Is extended
-	ss << ", \"is_extended\": " << finger->isExtended();
-	// Tip position
-	ss << ", \"tip_x\": " << -(finger->tipPosition().x) * mm_to_m;
-	ss << ", \"tip_y\": " << finger->tipPosition().z * mm_to_m;
-	ss << ", \"tip_z\": " << finger->tipPosition().y * mm_to_m;
-	// Stabilized tip position
-	ss << ", \"stabilized_tip_x\": " << -(finger->stabilizedTipPosition().x) * mm_to_m;
-	ss << ", \"stabilized_tip_y\": " << finger->stabilizedTipPosition().z * mm_to_m;
-	ss << ", \"stabilized_tip_z\": " << finger->stabilizedTipPosition().y * mm_to_m;
-	// Tip velocity
-	ss << ", \"tip_velocity_x\": " << -(finger->tipVelocity().x) * mm_to_m;
-	ss << ", \"tip_velocity_y\": " << finger->tipVelocity().z * mm_to_m;
-	ss << ", \"tip_velocity_z\": " << finger->tipVelocity().y * mm_to_m;
-
-	ss << " }";
-
-	finger_string = ss.str();
-	return finger_string;
+	finger_data->type = finger->type();
+	finger_data->is_extended = finger->isExtended();
+	finger_data->direction = LeapVectorToFloat3(finger->direction());
+	finger_data->tip = LeapVectorToFloat3(finger->tipPosition());
+	finger_data->stabilized_tip = LeapVectorToFloat3(finger->stabilizedTipPosition());
+	finger_data->tip_velocity = LeapVectorToFloat3(finger->tipVelocity());
 }
 
-string LeapHandToJsonHand(Hand* hand)
+void LeapHandToHandData(Hand* hand, HandData* hand_data)
 {
-	string hand_string;
-	stringstream ss;
-
+	hand_data->palm = LeapVectorToFloat3(hand->palmPosition());
+	hand_data->stabilized_palm = LeapVectorToFloat3(hand->stabilizedPalmPosition());
+	hand_data->palm_normal = LeapVectorToFloat3(hand->palmNormal());
+	hand_data->palm_velocity = LeapVectorToFloat3(hand->palmVelocity());
+	hand_data->palm_to_fingers = LeapVectorToFloat3(hand->direction());
+	hand_data->grab_angle = hand->grabAngle();
+	hand_data->pinch_distance = hand->pinchDistance() * mm_to_m;
+
+	// Only valid fingers are kept, in the same order as they appear in the JSON
 	FingerList fingers = hand->fingers();
-
-	// { "palm_x": 32.4, ....., "fingers": [ {.....},.....{.....} ], ....., "pinch_distance": 2.1 }
-
-	ss << "{ ";
-
-	// Palm position
-	ss << "\"palm_x\": " << -(hand->palmPosition().x) * mm_to_m;
-	ss << ", \"palm_y\": " << hand->palmPosition().z * mm_to_m;
-	ss << ", \"palm_z\": " << hand->palmPosition().y * mm_to_m;
-	// Stabilized palm position
-	ss << ", \"stabilized_palm_x\": " << -(hand->stabilizedPalmPosition().x) * mm_to_m;
-	ss << ", \"stabilized_palm_y\": " << hand->stabilizedPalmPosition().z * mm_to_m;
-	ss << ", \"stabilized_palm_z\": " << hand->stabilizedPalmPosition().y * mm_to_m;
-	// Palm normal
-	ss << ", \"palm_normal_x\": " << -(hand->palmNormal().x) * mm_to_m;
-	ss << ", \"palm_normal_y\": " << hand->palmNormal().z * mm_to_m;
-	ss << ", \"palm_normal_z\": " << hand->palmNormal().y * mm_to_m;
-	// Palm velocity
-	ss << ", \"palm_velocity_x\": " << -(hand->palmVelocity().x) * mm_to_m;
-	ss << ", \"palm_velocity_y\": " << hand->palmVelocity().z * mm_to_m;
-	ss << ", \"palm_velocity_z\": " << hand->palmVelocity().y * mm_to_m;
-	// Palm to fingers direction
-	ss << ", \"palm_to_fingers_x\": " << -(hand->direction().x) * mm_to_m;
-	ss << ", \"palm_to_fingers_y\": " << hand->direction().z * mm_to_m;
-	ss << ", \"palm_to_fingers_z\": " << hand->direction().y * mm_to_m;
-	// Fingers
-	ss << ", \"fingers\": [ ";
-	int fingers_added = 0;
-	for (int i = 0; i < fingers.count(); ++i)
+	hand_data->finger_count = 0;
+	for (int i = 0; i < fingers.count() && hand_data->finger_count < MAX_FINGERS_PER_HAND; ++i)
 	{
 		if (fingers[i].isValid())
 		{
-			if (fingers_added > 0)
-			{
-				ss << ", ";
-			}
-			ss << LeapFingerToJsonFinger(&(fingers[i]));
-			++fingers_added;
+			LeapFingerToFingerData(&(fingers[i]), &hand_data->fingers[hand_data->finger_count]);
+			++hand_data->finger_count;
 		}
 	}
-	ss << " ]";
-	// Grab angle
-	ss << ", \"grab_angle\": " << hand->grabAngle();
-	// Pinch distance
-	ss << ", \"pinch_distance\": " << hand->pinchDistance() * mm_to_m;
-
-	ss << " }";
-
-	hand_string = ss.str();
-
-	return hand_string;
-}
-
-string LeapHandToJsonArm(Hand* hand)
-{
-	string arm_string;
-	stringstream ss;
-
-	if (!hand->isValid())
-	{
-		arm_string = "null";
-	}
-	else
-	{
-		Arm forearm = hand->arm();
-
-		// { "forearm": {.....}, "hand": {.....} }
-		ss << "{ ";
-
-		// Forearm
-		ss << "\"forearm\": " << LeapArmToJsonForearm(&forearm);
-		// Hand
-		ss << ", \"hand\": " << LeapHandToJsonHand(hand);
-
-		ss << " }";
-
-		arm_string = ss.str();
-	}
 
-	return arm_string;
+	Arm forearm = hand->arm();
+	LeapArmToForearmData(&forearm, &hand_data->forearm);
 }
 
-string LeapFrameToJson(Frame* frame)
+/// Copies the fields of a frame that are streamed to the Hololens into a plain FrameData and maps all of its vectors
+/// to the streamed coordinate system with the given transform
+void LeapFrameToFrameData(Frame* frame, FrameData* frame_data, const FrameTransform* transform)
 {
-	string frame_string;
-	stringstream ss;
-	
 	HandList hands = frame->hands();
 	Hand left_hand;
 	Hand right_hand;
@@ -244,35 +144,29 @@ string LeapFrameToJson(Frame* frame)
 		}
 	}
 
-
-	// { "left_arm": {.....}, "right_arm": {.....} }
-	ss << "{ ";
-
+	frame_data->id = frame->id();
+	frame_data->capture_timestamp = frame->timestamp();
+	frame_data->hand_mask = 0;
 	if (left_hand.isValid())
 	{
-		// Add the left arm
-		ss << "\"left_arm\": ";
-		ss << LeapHandToJsonArm(&left_hand);
-	}
-
-	// Add comma to to separate left and right hand if we have info for both
-	if (left_hand.isValid() && right_hand.isValid())
-	{
-		ss << ", ";
+		frame_data->hand_mask |= LEFT_HAND_BIT;
+		LeapHandToHandData(&left_hand, &frame_data->hands[LEFT_HAND_INDEX]);
 	}
-
 	if (right_hand.isValid())
 	{
-		// Add the right arm
-		ss << "\"right_arm\": ";
-		ss << LeapHandToJsonArm(&right_hand);
+		frame_data->hand_mask |= RIGHT_HAND_BIT;
+		LeapHandToHandData(&right_hand, &frame_data->hands[RIGHT_HAND_INDEX]);
 	}
 
-	// Close JSON response
-	ss << " }";
+	TransformFrame(transform, frame_data);
+}
 
-	frame_string = ss.str();
-	return frame_string;
+/// As above, using the uncalibrated stream transform
+void LeapFrameToFrameData(Frame* frame, FrameData* frame_data)
+{
+	FrameTransform transform;
+	MakeStreamTransform(&transform);
+	LeapFrameToFrameData(frame, frame_data, &transform);
 }
 
 /// Takes all the fingertips from a Leap frame, processes them so they can be used for calibration, adds them to output ordered left to right
@@ -317,4 +211,26 @@ void ExtractFingertips(Frame* leap_frame, vector<Point3f>* fingertips)
 		tip_position *= 0.001f;
 		fingertips->push_back(tip_position);
 	}
-}
\ No newline at end of file
+}
+
+/// As above, for a frame that was converted with the uncalibrated stream transform, which maps the Leap coordinates to
+/// the same camera-aligned metres. Fingers are taken by position in the hand, and a missing hand or finger gives the
+/// origin, just as the Leap SDK's invalid fingers do.
+void ExtractFingertips(const FrameData* frame_data, vector<Point3f>* fingertips)
+{
+	const HandData* left_hand = &frame_data->hands[LEFT_HAND_INDEX];
+	const HandData* right_hand = &frame_data->hands[RIGHT_HAND_INDEX];
+	int left_count = HasHand(frame_data, LEFT_HAND_INDEX) ? left_hand->finger_count : 0;
+	int right_count = HasHand(frame_data, RIGHT_HAND_INDEX) ? right_hand->finger_count : 0;
+
+	for (int i = 0; i < 5; ++i)
+	{
+		Float3 tip = i < left_count ? left_hand->fingers[i].stabilized_tip : Float3{ 0.0f, 0.0f, 0.0f };
+		fingertips->push_back(Point3f(tip.x, tip.y, tip.z));
+	}
+	for (int i = 4; i >= 0; --i)
+	{
+		Float3 tip = i < right_count ? right_hand->fingers[i].stabilized_tip : Float3{ 0.0f, 0.0f, 0.0f };
+		fingertips->push_back(Point3f(tip.x, tip.y, tip.z));
+	}
+}
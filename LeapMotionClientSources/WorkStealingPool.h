@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Worker threads of the shared pool, 0 for one per core besides the thread that runs a loop
+#define POOL_WORKER_COUNT				0
+// Picked tiles are at most this wide, so that the rows of a tile stay in the cache while it is worked on
+#define POOL_TILE_MAX_COLS				256
+// Tiles per thread when the tile size is picked, enough for stealing to even out uneven tiles and busy workers
+#define POOL_TILES_PER_THREAD			8
+// Smallest picked tile, so that taking a tile stays a small part of working on it
+#define POOL_TILE_MIN_PIXELS			4096
+// Most threads a pool runs loops on, including the calling thread, so that a loop needs no memory but the stack
+#define POOL_MAX_THREADS				64
+
+/// Rows [row_begin, row_end) and columns [col_begin, col_end) of an image
+struct ImageTile
+{
+	int		row_begin;
+	int		row_end;
+	int		col_begin;
+	int		col_end;
+};
+
+/// Work done by a thread of the pool since the utilization was last reset
+struct PoolThreadStats
+{
+	int64_t		busy_ns;
+	int64_t		tiles;
+	// Times the thread ran out of tiles and took some from another thread
+	int64_t		steals;
+};
+
+struct PoolUtilization
+{
+	int64_t					wall_ns;
+	vector<PoolThreadStats>	workers;
+	// The threads that ran loops, which work on their own loops instead of waiting
+	PoolThreadStats			callers;
+};
+
+/// Prints the share of the time each worker spent working, to see how the loops scale with the number of cores
+inline void PrintPoolUtilization(const PoolUtilization& utilization)
+{
+	double wall_ms = utilization.wall_ns / 1e6;
+	cout << "Worker utilization over " << wall_ms << " ms:" << endl;
+	for (size_t i = 0; i < utilization.workers.size(); ++i)
+	{
+		const PoolThreadStats& worker = utilization.workers[i];
+		double busy_percent = utilization.wall_ns > 0 ? 100.0 * worker.busy_ns / utilization.wall_ns : 0.0;
+		cout << "  worker " << i << ": " << busy_percent << "% busy, " << worker.tiles << " tiles, " << worker.steals
+			<< " steals" << endl;
+	}
+	cout << "  calling threads: " << utilization.callers.busy_ns / 1e6 << " ms busy, " << utilization.callers.tiles
+		<< " tiles, " << utilization.callers.steals << " steals" << endl;
+}
+
+/// A pool of worker threads that runs the tiles of 2D loops over images. The tiles of a loop are divided evenly
+/// between the workers and the thread that runs the loop, and each takes tiles from the front of its own share. A
+/// thread that runs out steals the back half of another's share, so uneven tiles and workers busy with other loops
+/// even out without a central queue. Several threads may run loops on one pool at once, and a tile may run a loop of
+/// its own. Running a loop allocates no memory.
+class WorkStealingPool
+{
+public:
+
+	WorkStealingPool(int worker_count = DefaultWorkerCount()) :
+		counters(new ThreadCounters[min(max(worker_count, 0), POOL_MAX_THREADS - 1) + 1])
+	{
+		worker_count = min(max(worker_count, 0), POOL_MAX_THREADS - 1);
+		ResetUtilization();
+		for (int i = 0; i < worker_count; ++i)
+		{
+			worker_threads.push_back(thread(&WorkStealingPool::Run, this, i));
+		}
+	}
+
+	~WorkStealingPool()
+	{
+		{
+			lock_guard<mutex> lock(pool_mutex);
+			is_stopping = true;
+		}
+		work_condition.notify_all();
+		for (thread& worker_thread : worker_threads)
+		{
+			worker_thread.join();
+		}
+	}
+
+	/// The pool of the detector and the trainer, with POOL_WORKER_COUNT workers
+	static WorkStealingPool& Shared()
+	{
+		static WorkStealingPool shared_pool(POOL_WORKER_COUNT > 0 ? POOL_WORKER_COUNT : DefaultWorkerCount());
+		return shared_pool;
+	}
+
+	/// One worker per core besides the thread that runs a loop
+	static int DefaultWorkerCount()
+	{
+		int core_count = min((int)thread::hardware_concurrency(), POOL_MAX_THREADS);
+		return core_count > 1 ? core_count - 1 : 0;
+	}
+
+	/// Calls body for tiles that cover rows [0, rows) and columns [0, cols), returning once every tile is done. The
+	/// tile size is picked from the size of the loop and the number of threads unless given. If body throws, the
+	/// remaining tiles are skipped and the first exception is rethrown here.
+	template<typename Body>
+	void ParallelForTiles(int rows, int cols, const Body& body, int tile_rows = 0, int tile_cols = 0)
+	{
+		RunLoop(rows, cols, &CallBody<Body>, &body, tile_rows, tile_cols);
+	}
+
+	int WorkerCount() const
+	{
+		return (int)worker_threads.size();
+	}
+
+	void Utilization(PoolUtilization* utilization) const
+	{
+		utilization->wall_ns = PoolClock() - reset_time.load();
+		utilization->workers.resize(WorkerCount());
+		for (int i = 0; i <= WorkerCount(); ++i)
+		{
+			PoolThreadStats* stats = i < WorkerCount() ? &utilization->workers[i] : &utilization->callers;
+			stats->busy_ns = counters[i].busy_ns.load();
+			stats->tiles = counters[i].tiles.load();
+			stats->steals = counters[i].steals.load();
+		}
+	}
+
+	void ResetUtilization()
+	{
+		for (int i = 0; i <= WorkerCount(); ++i)
+		{
+			counters[i].busy_ns = 0;
+			counters[i].tiles = 0;
+			counters[i].steals = 0;
+		}
+		reset_time = PoolClock();
+	}
+
+private:
+
+	// Calls the body of a loop, given as the address of its function object, on a tile
+	typedef void (*TileFunction)(const void* body_data, const ImageTile& tile);
+
+	/// Tiles [begin, end) of a loop, in row major order, that a thread has yet to take
+	struct TileShare
+	{
+		mutex		share_mutex;
+		int			begin			= 0;
+		int			end				= 0;
+	};
+
+	/// A running loop, on the stack of the thread that runs it
+	struct Loop
+	{
+		Loop(int thread_count)
+		{
+			share_count = thread_count;
+		}
+
+		TileFunction		body				= nullptr;
+		const void*			body_data			= nullptr;
+		int					rows				= 0;
+		int					cols				= 0;
+		int					tile_rows			= 1;
+		int					tile_cols			= 1;
+		int					tiles_across		= 1;
+		int					tile_count			= 0;
+		// One share per worker and the last for the calling thread
+		TileShare			shares[POOL_MAX_THREADS];
+		int					share_count;
+		atomic<int>			unclaimed_tiles{ 0 };
+		atomic<int>			finished_tiles{ 0 };
+		// The running loops are linked through here, and the workers working on a loop counted, under pool_mutex
+		Loop*				next_loop			= nullptr;
+		int					participants		= 0;
+		mutex				error_mutex;
+		exception_ptr		error;
+		atomic<bool>		is_failed{ false };
+	};
+
+	struct ThreadCounters
+	{
+		atomic<int64_t>		busy_ns{ 0 };
+		atomic<int64_t>		tiles{ 0 };
+		atomic<int64_t>		steals{ 0 };
+	};
+
+	vector<thread>					worker_threads;
+	// One per worker and the last shared by the calling threads
+	unique_ptr<ThreadCounters[]>	counters;
+	atomic<int64_t>					reset_time{ 0 };
+	mutex							pool_mutex;
+	condition_variable				work_condition;
+	condition_variable				loop_condition;
+	// The running loops, oldest first
+	Loop*							first_loop			= nullptr;
+	bool							is_stopping			= false;
+
+	static int64_t PoolClock()
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	template<typename Body>
+	static void CallBody(const void* body_data, const ImageTile& tile)
+	{
+		(*(const Body*)body_data)(tile);
+	}
+
+	/// Runs the tiles of a loop with body(body_data, tile)
+	void RunLoop(int rows, int cols, TileFunction body, const void* body_data, int tile_rows, int tile_cols)
+	{
+		if (rows <= 0 || cols <= 0)
+		{
+			return;
+		}
+		int thread_count = WorkerCount() + 1;
+		Loop loop(thread_count);
+		loop.body = body;
+		loop.body_data = body_data;
+		loop.rows = rows;
+		loop.cols = cols;
+		loop.tile_cols = tile_cols > 0 ? min(tile_cols, cols) : min(cols, POOL_TILE_MAX_COLS);
+		loop.tiles_across = (cols + loop.tile_cols - 1) / loop.tile_cols;
+		if (tile_rows <= 0)
+		{
+			int bands = max(1, (thread_count * POOL_TILES_PER_THREAD + loop.tiles_across - 1) / loop.tiles_across);
+			tile_rows = max((rows + bands - 1) / bands, (POOL_TILE_MIN_PIXELS + loop.tile_cols - 1) / loop.tile_cols);
+		}
+		loop.tile_rows = min(tile_rows, rows);
+		int tile_count = loop.tiles_across * ((rows + loop.tile_rows - 1) / loop.tile_rows);
+		loop.tile_count = tile_count;
+		loop.unclaimed_tiles = tile_count;
+		for (int i = 0; i < thread_count; ++i)
+		{
+			loop.shares[i].begin = (int)((int64_t)tile_count * i / thread_count);
+			loop.shares[i].end = (int)((int64_t)tile_count * (i + 1) / thread_count);
+		}
+
+		// The calling thread takes the last share, so a pool without workers runs the loop on its own
+		bool is_shared = tile_count > 1 && !worker_threads.empty();
+		if (is_shared)
+		{
+			{
+				lock_guard<mutex> lock(pool_mutex);
+				AddLoop(&loop);
+			}
+			work_condition.notify_all();
+		}
+		RunTiles(&loop, thread_count - 1, &counters[thread_count - 1]);
+		if (is_shared)
+		{
+			// The loop must not go away while a worker may still look at it
+			unique_lock<mutex> lock(pool_mutex);
+			loop_condition.wait(lock, [&loop] { return loop.finished_tiles.load() == loop.tile_count; });
+			RemoveLoop(&loop);
+			loop_condition.wait(lock, [&loop] { return loop.participants == 0; });
+		}
+		if (loop.error)
+		{
+			rethrow_exception(loop.error);
+		}
+	}
+
+	/// A loop with tiles no thread has taken yet. Called with pool_mutex held.
+	Loop* FindLoop() const
+	{
+		for (Loop* loop = first_loop; loop != nullptr; loop = loop->next_loop)
+		{
+			if (loop->unclaimed_tiles.load() > 0)
+			{
+				return loop;
+			}
+		}
+		return nullptr;
+	}
+
+	/// Called with pool_mutex held
+	void AddLoop(Loop* loop)
+	{
+		Loop** link = &first_loop;
+		while (*link != nullptr)
+		{
+			link = &(*link)->next_loop;
+		}
+		*link = loop;
+	}
+
+	/// Called with pool_mutex held
+	void RemoveLoop(Loop* loop)
+	{
+		Loop** link = &first_loop;
+		while (*link != loop)
+		{
+			link = &(*link)->next_loop;
+		}
+		*link = loop->next_loop;
+	}
+
+	void Run(int worker_index)
+	{
+		unique_lock<mutex> lock(pool_mutex);
+		while (true)
+		{
+			// Other threads take tiles without pool_mutex, so the loop found is the one joined
+			Loop* loop = nullptr;
+			work_condition.wait(lock, [this, &loop]
+			{
+				loop = FindLoop();
+				return is_stopping || loop != nullptr;
+			});
+			if (is_stopping)
+			{
+				break;
+			}
+			++loop->participants;
+			lock.unlock();
+
+			RunTiles(loop, worker_index, &counters[worker_index]);
+
+			lock.lock();
+			if (--loop->participants == 0)
+			{
+				loop_condition.notify_all();
+			}
+		}
+	}
+
+	void RunTiles(Loop* loop, int share_index, ThreadCounters* thread_counters)
+	{
+		int tile;
+		while (TakeTile(loop, share_index, &tile, thread_counters))
+		{
+			int64_t start_time = PoolClock();
+			if (!loop->is_failed.load())
+			{
+				int band = tile / loop->tiles_across;
+				int column = tile % loop->tiles_across;
+				ImageTile image_tile;
+				image_tile.row_begin = band * loop->tile_rows;
+				image_tile.row_end = min(image_tile.row_begin + loop->tile_rows, loop->rows);
+				image_tile.col_begin = column * loop->tile_cols;
+				image_tile.col_end = min(image_tile.col_begin + loop->tile_cols, loop->cols);
+				try
+				{
+					loop->body(loop->body_data, image_tile);
+				}
+				catch (...)
+				{
+					lock_guard<mutex> lock(loop->error_mutex);
+					if (!loop->error)
+					{
+						loop->error = current_exception();
+					}
+					loop->is_failed = true;
+				}
+			}
+			thread_counters->busy_ns += PoolClock() - start_time;
+			++thread_counters->tiles;
+			if (++loop->finished_tiles == loop->tile_count)
+			{
+				lock_guard<mutex> lock(pool_mutex);
+				loop_condition.notify_all();
+			}
+		}
+	}
+
+	/// Takes the next tile of the thread's own share, or else steals the back half of another thread's share
+	bool TakeTile(Loop* loop, int share_index, int* tile, ThreadCounters* thread_counters)
+	{
+		TileShare* own_share = &loop->shares[share_index];
+		{
+			lock_guard<mutex> lock(own_share->share_mutex);
+			if (own_share->begin < own_share->end)
+			{
+				*tile = own_share->begin++;
+				--loop->unclaimed_tiles;
+				return true;
+			}
+		}
+
+		for (int i = 1; i < loop->share_count; ++i)
+		{
+			TileShare* victim_share = &loop->shares[(share_index + i) % loop->share_count];
+			int stolen_begin, stolen_end;
+			{
+				lock_guard<mutex> lock(victim_share->share_mutex);
+				int remaining = victim_share->end - victim_share->begin;
+				if (remaining <= 0)
+				{
+					continue;
+				}
+				stolen_end = victim_share->end;
+				stolen_begin = stolen_end - (remaining + 1) / 2;
+				victim_share->end = stolen_begin;
+			}
+			++thread_counters->steals;
+			*tile = stolen_begin;
+			--loop->unclaimed_tiles;
+			// The rest of the stolen tiles become the thread's own share, where others can steal them in turn
+			lock_guard<mutex> lock(own_share->share_mutex);
+			own_share->begin = stolen_begin + 1;
+			own_share->end = stolen_end;
+			return true;
+		}
+		return false;
+	}
+};
@@ -0,0 +1,403 @@
+// SerializationBenchmark.cpp : Measures the cost of encoding streamed frames without the Leap SDK.
+//
+// Usage: SerializationBenchmark [--frames N] [--threads N] [--seconds S] [--baseline FILE] [--write-baseline FILE]
+//
+// For every encoder and for 0, 1 and 2 hands the benchmark reports nanoseconds, bytes and heap allocations per frame.
+// With --threads it also runs every encoder on that many threads at once and reports frames per second. A baseline
+// written with --write-baseline can be passed back with --baseline, in which case the benchmark exits with an error if
+// any encoder got more than BASELINE_TOLERANCE slower or started allocating. The json-legacy row is the stringstream
+// encoder JsonFrameWriter replaced, kept for comparison.
+
+#include "BenchmarkBaseline.h"
+#include "FrameData.h"
+#include "FrameTransform.h"
+#include "BinaryFrameEncoding.h"
+#include "DeltaFrameEncoding.h"
+#include "JsonFrameWriter.h"
+#include "SyntheticFrameSource.h"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#define DEFAULT_BENCHMARK_FRAMES		200000
+#define WARMUP_FRAMES					1000
+// Distinct frames cycled through, so that the delta encoder sees moving hands
+#define BENCHMARK_FRAME_SET_SIZE		256
+#define DEFAULT_THROUGHPUT_SECONDS		2.0
+#define BASELINE_TOLERANCE				0.2
+
+// Every heap allocation made by the process is counted so that allocations per frame can be reported
+atomic<uint64_t> allocation_count(0);
+
+void* operator new(size_t size)
+{
+	allocation_count.fetch_add(1, memory_order_relaxed);
+	void* memory = malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+	{
+		throw bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+/// The JSON encoder the client had before JsonFrameWriter, building every object in a stringstream of its own, so that
+/// the two can be compared. It reads FrameData rather than the Leap frame, whose values are already converted.
+string LegacyForearmToJson(const ForearmData* forearm)
+{
+	string forearm_string;
+	stringstream ss;
+
+	if (!forearm->is_valid)
+	{
+		forearm_string = "null";
+	}
+	else
+	{
+		ss << "{ ";
+		ss << "\"wrist_x\": " << forearm->wrist.x;
+		ss << ", \"wrist_y\": " << forearm->wrist.y;
+		ss << ", \"wrist_z\": " << forearm->wrist.z;
+		ss << ", \"direction_x\": " << forearm->direction.x;
+		ss << ", \"direction_y\": " << forearm->direction.y;
+		ss << ", \"direction_z\": " << forearm->direction.z;
+		ss << ", \"elbow_x\": " << forearm->elbow.x;
+		ss << ", \"elbow_y\": " << forearm->elbow.y;
+		ss << ", \"elbow_z\": " << forearm->elbow.z;
+		ss << " }";
+
+		forearm_string = ss.str();
+	}
+
+	return forearm_string;
+}
+
+string LegacyFingerToJson(const FingerData* finger)
+{
+	stringstream ss;
+	ss << "{ ";
+	ss << "\"type\": " << finger->type;
+	ss << ", \"direction_x\": " << finger->direction.x;
+	ss << ", \"direction_y\": " << finger->direction.y;
+	ss << ", \"direction_z\": " << finger->direction.z;
+	ss << ", \"is_extended\": " << finger->is_extended;
+	ss << ", \"tip_x\": " << finger->tip.x;
+	ss << ", \"tip_y\": " << finger->tip.y;
+	ss << ", \"tip_z\": " << finger->tip.z;
+	ss << ", \"stabilized_tip_x\": " << finger->stabilized_tip.x;
+	ss << ", \"stabilized_tip_y\": " << finger->stabilized_tip.y;
+	ss << ", \"stabilized_tip_z\": " << finger->stabilized_tip.z;
+	ss << ", \"tip_velocity_x\": " << finger->tip_velocity.x;
+	ss << ", \"tip_velocity_y\": " << finger->tip_velocity.y;
+	ss << ", \"tip_velocity_z\": " << finger->tip_velocity.z;
+	ss << " }";
+
+	string finger_string = ss.str();
+	return finger_string;
+}
+
+string LegacyHandToJson(const HandData* hand)
+{
+	stringstream ss;
+	ss << "{ ";
+	ss << "\"palm_x\": " << hand->palm.x;
+	ss << ", \"palm_y\": " << hand->palm.y;
+	ss << ", \"palm_z\": " << hand->palm.z;
+	ss << ", \"stabilized_palm_x\": " << hand->stabilized_palm.x;
+	ss << ", \"stabilized_palm_y\": " << hand->stabilized_palm.y;
+	ss << ", \"stabilized_palm_z\": " << hand->stabilized_palm.z;
+	ss << ", \"palm_normal_x\": " << hand->palm_normal.x;
+	ss << ", \"palm_normal_y\": " << hand->palm_normal.y;
+	ss << ", \"palm_normal_z\": " << hand->palm_normal.z;
+	ss << ", \"palm_velocity_x\": " << hand->palm_velocity.x;
+	ss << ", \"palm_velocity_y\": " << hand->palm_velocity.y;
+	ss << ", \"palm_velocity_z\": " << hand->palm_velocity.z;
+	ss << ", \"palm_to_fingers_x\": " << hand->palm_to_fingers.x;
+	ss << ", \"palm_to_fingers_y\": " << hand->palm_to_fingers.y;
+	ss << ", \"palm_to_fingers_z\": " << hand->palm_to_fingers.z;
+	ss << ", \"fingers\": [ ";
+	for (int i = 0; i < hand->finger_count; ++i)
+	{
+		if (i > 0)
+		{
+			ss << ", ";
+		}
+		ss << LegacyFingerToJson(&hand->fingers[i]);
+	}
+	ss << " ]";
+	ss << ", \"grab_angle\": " << hand->grab_angle;
+	ss << ", \"pinch_distance\": " << hand->pinch_distance;
+	ss << " }";
+
+	string hand_string = ss.str();
+	return hand_string;
+}
+
+string LegacyArmToJson(const HandData* hand)
+{
+	stringstream ss;
+	ss << "{ ";
+	ss << "\"forearm\": " << LegacyForearmToJson(&hand->forearm);
+	ss << ", \"hand\": " << LegacyHandToJson(hand);
+	ss << " }";
+
+	string arm_string = ss.str();
+	return arm_string;
+}
+
+string LegacyFrameToJson(const FrameData* frame)
+{
+	stringstream ss;
+	bool has_left = HasHand(frame, LEFT_HAND_INDEX);
+	bool has_right = HasHand(frame, RIGHT_HAND_INDEX);
+	ss << "{ ";
+	if (has_left)
+	{
+		ss << "\"left_arm\": ";
+		ss << LegacyArmToJson(&frame->hands[LEFT_HAND_INDEX]);
+	}
+	if (has_left && has_right)
+	{
+		ss << ", ";
+	}
+	if (has_right)
+	{
+		ss << "\"right_arm\": ";
+		ss << LegacyArmToJson(&frame->hands[RIGHT_HAND_INDEX]);
+	}
+	ss << " }";
+
+	string frame_string = ss.str();
+	return frame_string;
+}
+
+enum class BenchmarkEncoder
+{
+	JSON,
+	JSON_LEGACY,
+	BINARY,
+	DELTA,
+	TRANSFORM,
+	COUNT
+};
+
+const char* encoder_names[] = { "json", "json-legacy", "binary", "delta", "transform" };
+
+/// One encoder with all of its state, so that every thread can have its own
+class EncoderState
+{
+public:
+
+	EncoderState() : delta_encoder(DEFAULT_KEYFRAME_INTERVAL)
+	{
+		MakeStreamTransform(&transform);
+	}
+
+	/// Encodes the frame and returns the number of bytes produced
+	size_t Encode(BenchmarkEncoder encoder, const FrameData* frame)
+	{
+		switch (encoder)
+		{
+		case BenchmarkEncoder::JSON:
+			json_writer.WriteFrame(frame);
+			return json_writer.Size();
+		case BenchmarkEncoder::JSON_LEGACY:
+			// The string is made anew for every frame, as it was before
+			legacy_json = LegacyFrameToJson(frame);
+			return legacy_json.size();
+		case BenchmarkEncoder::BINARY:
+			return EncodeBinaryFrame(frame, buffer, sizeof(buffer));
+		case BenchmarkEncoder::DELTA:
+			return delta_encoder.EncodeFrame(frame, buffer, sizeof(buffer));
+		case BenchmarkEncoder::TRANSFORM:
+			transform_frame = *frame;
+			TransformFrame(&transform, &transform_frame);
+			return 0;
+		default:
+			return 0;
+		}
+	}
+
+private:
+
+	JsonFrameWriter		json_writer;
+	string				legacy_json;
+	DeltaFrameEncoder	delta_encoder;
+	FrameTransform		transform;
+	FrameData			transform_frame;
+	char				buffer[DELTA_FRAME_MAX_SIZE];
+};
+
+struct BenchmarkResult
+{
+	double	ns_per_frame;
+	double	bytes_per_frame;
+	double	allocations_per_frame;
+};
+
+vector<FrameData> MakeFrameSet(int hand_count)
+{
+	vector<FrameData> frames(BENCHMARK_FRAME_SET_SIZE);
+	for (int i = 0; i < BENCHMARK_FRAME_SET_SIZE; ++i)
+	{
+		MakeSyntheticFrame(hand_count, i / SYNTHETIC_FRAME_RATE, &frames[i]);
+		frames[i].id = i + 1;
+	}
+	return frames;
+}
+
+BenchmarkResult RunLatencyBenchmark(BenchmarkEncoder encoder, const vector<FrameData>& frames, int frame_count)
+{
+	EncoderState state;
+	for (int i = 0; i < WARMUP_FRAMES; ++i)
+	{
+		state.Encode(encoder, &frames[i % frames.size()]);
+	}
+
+	uint64_t total_bytes = 0;
+	uint64_t allocations_before = allocation_count.load();
+	auto start_time = chrono::steady_clock::now();
+	for (int i = 0; i < frame_count; ++i)
+	{
+		total_bytes += state.Encode(encoder, &frames[i % frames.size()]);
+	}
+	auto end_time = chrono::steady_clock::now();
+	uint64_t allocations = allocation_count.load() - allocations_before;
+
+	BenchmarkResult result;
+	result.ns_per_frame = chrono::duration<double, nano>(end_time - start_time).count() / frame_count;
+	result.bytes_per_frame = (double)total_bytes / frame_count;
+	result.allocations_per_frame = (double)allocations / frame_count;
+	return result;
+}
+
+/// Runs the encoder on thread_count threads for the given time and returns the total frames per second
+double RunThroughputBenchmark(BenchmarkEncoder encoder, const vector<FrameData>& frames, int thread_count, double seconds)
+{
+	atomic<bool> is_running(true);
+	atomic<uint64_t> total_frames(0);
+	vector<thread> threads;
+	for (int t = 0; t < thread_count; ++t)
+	{
+		threads.emplace_back([&]
+		{
+			EncoderState state;
+			uint64_t frame_count = 0;
+			while (is_running.load(memory_order_relaxed))
+			{
+				state.Encode(encoder, &frames[frame_count % frames.size()]);
+				++frame_count;
+			}
+			total_frames += frame_count;
+		});
+	}
+
+	auto start_time = chrono::steady_clock::now();
+	this_thread::sleep_for(chrono::duration<double>(seconds));
+	is_running = false;
+	for (thread& t : threads)
+	{
+		t.join();
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+	return total_frames / elapsed;
+}
+
+string BaselineKey(BenchmarkEncoder encoder, int hand_count)
+{
+	return string(encoder_names[(int)encoder]) + "/" + to_string(hand_count);
+}
+
+int main(int argc, char* argv[])
+{
+	int frame_count = DEFAULT_BENCHMARK_FRAMES;
+	int thread_count = 0;
+	double throughput_seconds = DEFAULT_THROUGHPUT_SECONDS;
+	string baseline_path;
+	string write_baseline_path;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		string option = argv[i];
+		if (option == "--frames")
+		{
+			frame_count = atoi(argv[i + 1]);
+		}
+		else if (option == "--threads")
+		{
+			thread_count = atoi(argv[i + 1]);
+		}
+		else if (option == "--seconds")
+		{
+			throughput_seconds = atof(argv[i + 1]);
+		}
+		else if (option == "--baseline")
+		{
+			baseline_path = argv[i + 1];
+		}
+		else if (option == "--write-baseline")
+		{
+			write_baseline_path = argv[i + 1];
+		}
+	}
+
+	BenchmarkBaseline baseline(baseline_path, write_baseline_path);
+	// Time may vary from run to run, but any allocation more per frame is a regression
+	BaselineTolerance tolerances[] = { { BASELINE_TOLERANCE, 0.0 }, BaselineTolerance::Unchecked(), { 0.0, 0.001 } };
+
+	bool has_regression = false;
+	cout << left << setw(12) << "encoder" << setw(8) << "hands" << setw(14) << "ns/frame" << setw(14) << "bytes/frame"
+		<< setw(14) << "allocs/frame" << endl;
+	for (int hand_count = 0; hand_count <= MAX_HANDS_PER_FRAME; ++hand_count)
+	{
+		vector<FrameData> frames = MakeFrameSet(hand_count);
+		for (int e = 0; e < (int)BenchmarkEncoder::COUNT; ++e)
+		{
+			BenchmarkEncoder encoder = (BenchmarkEncoder)e;
+			BenchmarkResult result = RunLatencyBenchmark(encoder, frames, frame_count);
+			cout << left << setw(12) << encoder_names[e] << setw(8) << hand_count << fixed << setprecision(1)
+				<< setw(14) << result.ns_per_frame << setw(14) << result.bytes_per_frame
+				<< setprecision(3) << setw(14) << result.allocations_per_frame;
+
+			if (baseline.Check(BaselineKey(encoder, hand_count),
+				{ result.ns_per_frame, result.bytes_per_frame, result.allocations_per_frame }, tolerances))
+			{
+				cout << "REGRESSION";
+				has_regression = true;
+			}
+			cout << endl;
+		}
+	}
+
+	if (thread_count > 0)
+	{
+		cout << endl << "Throughput with " << thread_count << " threads, two hands per frame" << endl;
+		vector<FrameData> frames = MakeFrameSet(MAX_HANDS_PER_FRAME);
+		for (int e = 0; e < (int)BenchmarkEncoder::COUNT; ++e)
+		{
+			double frames_per_second = RunThroughputBenchmark((BenchmarkEncoder)e, frames, thread_count, throughput_seconds);
+			cout << left << setw(12) << encoder_names[e] << fixed << setprecision(0) << frames_per_second
+				<< " frames/s, " << frames_per_second / thread_count << " frames/s per thread" << endl;
+		}
+	}
+
+	return has_regression ? EXIT_FAILURE : EXIT_SUCCESS;
+}
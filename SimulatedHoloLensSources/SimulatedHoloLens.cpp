@@ -0,0 +1,796 @@
+// SimulatedHoloLens.cpp : Stands in for the HoloLens, so that the Leap Motion client can be run and profiled on one
+// machine over loopback.
+//
+// Usage: SimulatedHoloLens [--tcp-port N] [--udp-port N] [--images FILE,FILE,...] [--intrinsics FX,FY,CX,CY]
+//                          [--loss P] [--delay MS] [--jitter MS] [--bandwidth KBIT/S] [--queue MS]
+//                          [--render-rate HZ] [--playout-delay MS]
+//                          [--pause-at S] [--resume-at S] [--end-at S] [--report-interval S] [--seed N]
+//
+// The peer listens where the HoloLens would and answers the client the way the Unity application does. With --images
+// it chooses to calibrate and uploads the given JPEG or PNG files as the calibration images, otherwise it skips the
+// calibration. It then consumes the frame stream through the frame decoder library, as a native plugin on the
+// HoloLens would, and takes a frame from its jitter buffer at the render rate, --playout-delay behind the stream.
+// Received datagrams go through a simulated link first that drops them with probability --loss, holds them back by
+// --delay plus up to --jitter, and limits them to --bandwidth with a queue of --queue ms beyond which they are
+// dropped. --pause-at, --resume-at and --end-at send the matching control messages that many seconds into streaming.
+//
+// Every --report-interval seconds and at the end the peer prints the delivered frame rate and bandwidth, the latency
+// from the client's send stamp to delivery, which is exact over loopback since both share the clock, and the loss,
+// reordering and jitter seen by the receiver.
+
+#include "AppMessages.h"
+#include "BinaryFrameEncoding.h"
+#include "CalibrationProtocol.h"
+#include "ControlMessageFramer.h"
+#include "DatagramStamp.h"
+#include "DeltaFrameEncoding.h"
+#include "JsonFrameWriter.h"
+#include "LatencyHistogram.h"
+#include "LeapFrameDecoder.h"
+#include "StreamStatistics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#define poll							WSAPoll
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET					-1
+#define closesocket						close
+#endif
+
+using namespace std;
+
+#define DEFAULT_HOLO_TCP_PORT			6000
+#define DEFAULT_HOLO_UDP_PORT			6001
+#define DEFAULT_RENDER_RATE				60.0
+#define DEFAULT_PLAYOUT_DELAY_MS		20.0
+#define DEFAULT_QUEUE_MS				100.0
+#define DEFAULT_REPORT_INTERVAL			1.0
+// Lets the client finish the session after "End data streaming" before the peer gives up on it
+#define END_GRACE_MS					2000
+#define KEYFRAME_REQUEST_INTERVAL_US	100000
+#define PEER_RECEIVE_BUFFER_LENGTH		65536
+#define PEER_SOCKET_BUFFER_SIZE			(4 * 1024 * 1024)
+
+struct PeerOptions
+{
+	int				tcp_port				= DEFAULT_HOLO_TCP_PORT;
+	int				udp_port				= DEFAULT_HOLO_UDP_PORT;
+	vector<string>	image_paths;
+	// Intrinsics of the calibration camera, 0 for a guess from the image size
+	float			fx						= 0.0f;
+	float			fy						= 0.0f;
+	float			cx						= 0.0f;
+	float			cy						= 0.0f;
+	double			loss					= 0.0;
+	double			delay_ms				= 0.0;
+	double			jitter_ms				= 0.0;
+	// 0 for no limit
+	double			bandwidth_kbps			= 0.0;
+	double			queue_ms				= DEFAULT_QUEUE_MS;
+	double			render_rate				= DEFAULT_RENDER_RATE;
+	double			playout_delay_ms		= DEFAULT_PLAYOUT_DELAY_MS;
+	// Seconds into streaming, negative to never send
+	double			pause_at				= -1.0;
+	double			resume_at				= -1.0;
+	double			end_at					= -1.0;
+	double			report_interval			= DEFAULT_REPORT_INTERVAL;
+	unsigned int	seed					= 1;
+};
+
+/// A stored calibration image, sent as it is
+struct CalibrationImageFile
+{
+	vector<char>	data;
+	int32_t			format;
+	int32_t			width;
+	int32_t			height;
+};
+
+inline uint32_t ReadBigEndian16(const unsigned char* source)
+{
+	return ((uint32_t)source[0] << 8) | source[1];
+}
+
+inline uint32_t ReadBigEndian32(const unsigned char* source)
+{
+	return (ReadBigEndian16(source) << 16) | ReadBigEndian16(source + 2);
+}
+
+/// Reads the size of a PNG from its IHDR chunk, or of a JPEG from its first start of frame segment
+bool ReadImageSize(const vector<char>& file, int32_t format, int32_t* width, int32_t* height)
+{
+	const unsigned char* data = (const unsigned char*)file.data();
+	size_t length = file.size();
+	if (format == CALIBRATION_FORMAT_PNG)
+	{
+		if (length < 24 || memcmp(data + 12, "IHDR", 4) != 0)
+		{
+			return false;
+		}
+		*width = (int32_t)ReadBigEndian32(data + 16);
+		*height = (int32_t)ReadBigEndian32(data + 20);
+		return true;
+	}
+
+	size_t position = 2;
+	while (position + 4 <= length)
+	{
+		if (data[position] != 0xFF)
+		{
+			return false;
+		}
+		unsigned char marker = data[position + 1];
+		if (marker == 0xFF)
+		{
+			++position;
+			continue;
+		}
+		// SOF0 to SOF15, except DHT, JPG and DAC which share the range
+		bool is_start_of_frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+		if (is_start_of_frame && position + 9 <= length)
+		{
+			*height = (int32_t)ReadBigEndian16(data + position + 5);
+			*width = (int32_t)ReadBigEndian16(data + position + 7);
+			return true;
+		}
+		position += 2 + ReadBigEndian16(data + position + 2);
+	}
+	return false;
+}
+
+bool ReadCalibrationImageFile(const string& path, CalibrationImageFile* image)
+{
+	ifstream file(path, ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	image->data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	const unsigned char* data = (const unsigned char*)image->data.data();
+	if (image->data.size() >= 8 && memcmp(data, "\x89PNG", 4) == 0)
+	{
+		image->format = CALIBRATION_FORMAT_PNG;
+	}
+	else if (image->data.size() >= 4 && data[0] == 0xFF && data[1] == 0xD8)
+	{
+		image->format = CALIBRATION_FORMAT_JPEG;
+	}
+	else
+	{
+		return false;
+	}
+	return ReadImageSize(image->data, image->format, &image->width, &image->height);
+}
+
+/// A datagram held back by the simulated link
+struct LinkDatagram
+{
+	int64_t			delivery_time;
+	uint64_t		order;
+	vector<char>	data;
+};
+
+/// Simulates the network between the client and the HoloLens for the datagrams that arrive over loopback. Each
+/// datagram is dropped with the loss probability, waits for the link when a bandwidth is set, and is then delayed by
+/// the delay plus a random jitter, which can reorder datagrams as on a real network.
+class ImpairedLink
+{
+public:
+
+	ImpairedLink(const PeerOptions& options) : random(options.seed), jitter_distribution(0.0, options.jitter_ms * 1000.0)
+	{
+		loss = options.loss;
+		delay_us = (int64_t)(options.delay_ms * 1000.0);
+		bandwidth_bps = options.bandwidth_kbps * 1000.0;
+		queue_us = (int64_t)(options.queue_ms * 1000.0);
+	}
+
+	void Receive(const char* data, size_t length, int64_t arrival_time)
+	{
+		if (loss > 0.0 && loss_distribution(random) < loss)
+		{
+			++lost_count;
+			return;
+		}
+
+		int64_t sent_time = arrival_time;
+		if (bandwidth_bps > 0.0)
+		{
+			int64_t link_start = link_free_time > arrival_time ? link_free_time : arrival_time;
+			if (link_start - arrival_time > queue_us)
+			{
+				++queue_drop_count;
+				return;
+			}
+			link_free_time = link_start + (int64_t)((double)length * 8.0 * 1000000.0 / bandwidth_bps);
+			sent_time = link_free_time;
+		}
+		int64_t jitter_us = jitter_distribution.b() > 0.0 ? (int64_t)jitter_distribution(random) : 0;
+
+		// Buffers of delivered datagrams are reused
+		LinkDatagram datagram;
+		if (!free_buffers.empty())
+		{
+			datagram.data.swap(free_buffers.back());
+			free_buffers.pop_back();
+		}
+		datagram.data.assign(data, data + length);
+		datagram.delivery_time = sent_time + delay_us + jitter_us;
+		datagram.order = next_order++;
+		queue.push_back(move(datagram));
+		push_heap(queue.begin(), queue.end(), IsLater);
+	}
+
+	/// Time the next datagram is due, or -1 if there is none
+	int64_t NextDeliveryTime() const
+	{
+		return queue.empty() ? -1 : queue.front().delivery_time;
+	}
+
+	/// Calls deliver with every datagram that is due by now, in the order of their delivery times
+	template<typename Deliver>
+	void DeliverDue(int64_t now, Deliver deliver)
+	{
+		while (!queue.empty() && queue.front().delivery_time <= now)
+		{
+			pop_heap(queue.begin(), queue.end(), IsLater);
+			LinkDatagram& datagram = queue.back();
+			deliver(datagram.data.data(), datagram.data.size());
+			free_buffers.push_back(move(datagram.data));
+			queue.pop_back();
+		}
+	}
+
+	uint64_t LostCount() const
+	{
+		return lost_count;
+	}
+
+	uint64_t QueueDropCount() const
+	{
+		return queue_drop_count;
+	}
+
+private:
+
+	mt19937								random;
+	uniform_real_distribution<double>	loss_distribution;
+	uniform_real_distribution<double>	jitter_distribution;
+	double								loss;
+	int64_t								delay_us;
+	double								bandwidth_bps;
+	int64_t								queue_us;
+	int64_t								link_free_time		= 0;
+	uint64_t							next_order			= 0;
+	uint64_t							lost_count			= 0;
+	uint64_t							queue_drop_count	= 0;
+	// Min-heap on the delivery time, ties broken by arrival
+	vector<LinkDatagram>				queue;
+	vector<vector<char>>				free_buffers;
+
+	static bool IsLater(const LinkDatagram& a, const LinkDatagram& b)
+	{
+		return a.delivery_time != b.delivery_time ? a.delivery_time > b.delivery_time : a.order > b.order;
+	}
+};
+
+/// Reads the stamp of a datagram in any of the client's encodings
+bool ReadAnyFrameStamp(const char* datagram, size_t length, DatagramStamp* stamp)
+{
+	return ReadBinaryFrameStamp(datagram, length, stamp) || ReadDeltaFrameStamp(datagram, length, stamp) ||
+		ReadJsonFrameStamp(datagram, length, stamp);
+}
+
+bool SendAll(SOCKET socket, const char* data, size_t length)
+{
+	size_t total_bytes_sent = 0;
+	while (total_bytes_sent < length)
+	{
+		int bytes_sent = send(socket, data + total_bytes_sent, (int)(length - total_bytes_sent), 0);
+		if (bytes_sent <= 0)
+		{
+			return false;
+		}
+		total_bytes_sent += bytes_sent;
+	}
+	return true;
+}
+
+bool SendString(SOCKET socket, const string& message)
+{
+	return SendAll(socket, message.data(), message.size());
+}
+
+void SetNonBlocking(SOCKET socket)
+{
+#ifdef _WIN32
+	u_long non_blocking = 1;
+	ioctlsocket(socket, FIONBIO, &non_blocking);
+#else
+	fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+/// Waits for the next message from the client. Returns false if the connection was closed.
+bool ReceiveMessage(SOCKET socket, ControlMessageFramer* framer, string* message)
+{
+	char buffer[CONTROL_MESSAGE_MAX_LENGTH];
+	while (!framer->Next(message))
+	{
+		int bytes_received = recv(socket, buffer, sizeof(buffer), 0);
+		if (bytes_received <= 0)
+		{
+			return false;
+		}
+		framer->Append(buffer, bytes_received);
+	}
+	return true;
+}
+
+/// Uploads the calibration images framed as described in CalibrationProtocol.h, the way the HoloLens does. The images
+/// were checked to have the same format and size.
+bool UploadCalibrationImages(SOCKET socket, const PeerOptions& options, const vector<CalibrationImageFile>& images)
+{
+	int32_t width = images[0].width;
+	int32_t height = images[0].height;
+	// Without known intrinsics the camera is taken to have a horizontal field of view of about 53 degrees
+	float intrinsics[4] = {
+		options.fx > 0.0f ? options.fx : (float)width,
+		options.fy > 0.0f ? options.fy : (float)width,
+		options.cx > 0.0f ? options.cx : width / 2.0f,
+		options.cy > 0.0f ? options.cy : height / 2.0f };
+
+	char header[CALIBRATION_FRAME_HEADER_SIZE + CALIBRATION_HEADER_PAYLOAD_SIZE];
+	WriteStampUInt32(header, CALIBRATION_HEADER_PAYLOAD_SIZE + 1);
+	header[4] = (char)CALIBRATION_MESSAGE_HEADER;
+	char* payload = header + CALIBRATION_FRAME_HEADER_SIZE;
+	for (int i = 0; i < 4; ++i)
+	{
+		uint32_t bits;
+		memcpy(&bits, &intrinsics[i], sizeof(float));
+		WriteStampUInt32(payload + 4 * i, bits);
+	}
+	WriteStampUInt32(payload + 16, (uint32_t)width);
+	WriteStampUInt32(payload + 20, (uint32_t)height);
+	WriteStampUInt32(payload + 24, (uint32_t)images.size());
+	WriteStampUInt32(payload + 28, (uint32_t)(width * height * 3));
+	WriteStampUInt32(payload + 32, (uint32_t)images[0].format);
+	if (!SendAll(socket, header, sizeof(header)))
+	{
+		return false;
+	}
+
+	for (const CalibrationImageFile& image : images)
+	{
+		// The stored images were taken long ago, so the capture age only covers the sending, as if each image had
+		// just been taken
+		auto capture_time = chrono::steady_clock::now();
+		char prefix[CALIBRATION_FRAME_HEADER_SIZE + CALIBRATION_IMAGE_PREFIX_SIZE];
+		WriteStampUInt32(prefix, (uint32_t)(image.data.size() + 1 + CALIBRATION_IMAGE_PREFIX_SIZE));
+		prefix[4] = (char)CALIBRATION_MESSAGE_IMAGE;
+		int64_t capture_age = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - capture_time).count();
+		WriteStampInt64(prefix + CALIBRATION_FRAME_HEADER_SIZE, capture_age);
+		if (!SendAll(socket, prefix, sizeof(prefix)) || !SendAll(socket, image.data.data(), image.data.size()))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Consumes the delivered datagrams the way the HoloLens would, through the frame decoder library, and keeps the
+/// statistics of the stream
+class StreamConsumer
+{
+public:
+
+	StreamConsumer(const PeerOptions& options)
+	{
+		decoder = LeapDecoderCreate(0, (int64_t)(options.playout_delay_ms * 1000.0));
+		latency_histogram.Snapshot(&report_snapshot);
+	}
+
+	~StreamConsumer()
+	{
+		LeapDecoderDestroy(decoder);
+	}
+
+	/// Returns true if the decoder needs a keyframe
+	bool Deliver(const char* datagram, size_t length, int64_t now)
+	{
+		DatagramStamp stamp;
+		if (ReadAnyFrameStamp(datagram, length, &stamp))
+		{
+			statistics.OnDatagram(&stamp, now);
+			latency_histogram.Record(now - stamp.send_timestamp);
+		}
+		++delivered_count;
+		delivered_bytes += length;
+		return LeapDecoderPush(decoder, (const uint8_t*)datagram, (int32_t)length, now) == LEAP_DECODER_NEED_KEYFRAME;
+	}
+
+	/// Takes the frame that would be rendered now
+	void Render(int64_t now)
+	{
+		++render_count;
+		if (LeapDecoderGetFrame(decoder, now, &render_frame) == LEAP_FRAME_NONE)
+		{
+			++render_empty_count;
+		}
+	}
+
+	/// Prints the rate and latency since the last report
+	void PrintInterval(double seconds)
+	{
+		HistogramSnapshot snapshot;
+		latency_histogram.Snapshot(&snapshot);
+		HistogramSnapshot interval = snapshot;
+		interval.Subtract(&report_snapshot);
+		report_snapshot = snapshot;
+		uint64_t frames = delivered_count - report_delivered_count;
+		uint64_t bytes = delivered_bytes - report_delivered_bytes;
+		report_delivered_count = delivered_count;
+		report_delivered_bytes = delivered_bytes;
+
+		cout << fixed << setprecision(1) << frames / seconds << " frames/s, " << bytes * 8 / seconds / 1000.0
+			<< " kbit/s, latency ms p50 " << setprecision(2) << interval.Percentile(0.5) / 1000.0 << " p99 "
+			<< interval.Percentile(0.99) / 1000.0 << endl;
+	}
+
+	void PrintSummary(double seconds, const ImpairedLink& link)
+	{
+		HistogramSnapshot snapshot;
+		latency_histogram.Snapshot(&snapshot);
+		LeapDecoderStats decoder_stats;
+		LeapDecoderGetStats(decoder, &decoder_stats);
+
+		cout << fixed << setprecision(1) << "Delivered " << delivered_count << " datagrams, " << delivered_bytes
+			<< " bytes in " << seconds << " s: " << delivered_count / seconds << " frames/s, "
+			<< delivered_bytes * 8 / seconds / 1000.0 << " kbit/s" << endl;
+		cout << setprecision(2) << "Latency from send to delivery, ms: p50 " << snapshot.Percentile(0.5) / 1000.0
+			<< ", p90 " << snapshot.Percentile(0.9) / 1000.0 << ", p99 " << snapshot.Percentile(0.99) / 1000.0
+			<< ", max " << snapshot.max_value / 1000.0 << endl;
+		cout << "Link: dropped " << link.LostCount() << " by loss, " << link.QueueDropCount() << " by bandwidth" << endl;
+		// Reordering around the first datagram can make the loss negative
+		cout << "Receiver: lost " << (statistics.Lost() > 0 ? statistics.Lost() : 0) << " (" << setprecision(2) << statistics.LossRate() * 100.0
+			<< " %), reordered " << statistics.Reordered() << ", jitter " << statistics.Jitter() / 1000.0 << " ms" << endl;
+		cout << "Decoder: invalid " << decoder_stats.invalid << ", waiting for keyframe " << decoder_stats.keyframes_needed
+			<< ", late " << decoder_stats.late << ", duplicates " << decoder_stats.duplicates << endl;
+		cout << "Rendered " << render_count << " frames, " << render_empty_count << " without any frame, "
+			<< decoder_stats.underruns << " with the newest frame older than the playout delay" << endl;
+	}
+
+private:
+
+	LeapFrameDecoder*	decoder;
+	LeapDecodedFrame	render_frame;
+	StreamStatistics	statistics;
+	// Microseconds from the client's send stamp to delivery
+	LatencyHistogram	latency_histogram;
+	HistogramSnapshot	report_snapshot;
+	uint64_t			delivered_count			= 0;
+	uint64_t			delivered_bytes			= 0;
+	uint64_t			report_delivered_count	= 0;
+	uint64_t			report_delivered_bytes	= 0;
+	uint64_t			render_count			= 0;
+	uint64_t			render_empty_count		= 0;
+};
+
+/// A control message sent a given number of seconds into streaming
+struct ScheduledMessage
+{
+	double		at;
+	string		message;
+	bool		is_sent;
+};
+
+vector<string> SplitList(const string& list)
+{
+	vector<string> items;
+	stringstream stream(list);
+	string item;
+	while (getline(stream, item, ','))
+	{
+		items.push_back(item);
+	}
+	return items;
+}
+
+int main(int argc, char* argv[])
+{
+	PeerOptions options;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		string option = argv[i];
+		if (option == "--tcp-port")
+		{
+			options.tcp_port = atoi(argv[i + 1]);
+		}
+		else if (option == "--udp-port")
+		{
+			options.udp_port = atoi(argv[i + 1]);
+		}
+		else if (option == "--images")
+		{
+			options.image_paths = SplitList(argv[i + 1]);
+		}
+		else if (option == "--intrinsics")
+		{
+			vector<string> values = SplitList(argv[i + 1]);
+			if (values.size() == 4)
+			{
+				options.fx = (float)atof(values[0].c_str());
+				options.fy = (float)atof(values[1].c_str());
+				options.cx = (float)atof(values[2].c_str());
+				options.cy = (float)atof(values[3].c_str());
+			}
+		}
+		else if (option == "--loss")
+		{
+			options.loss = atof(argv[i + 1]);
+		}
+		else if (option == "--delay")
+		{
+			options.delay_ms = atof(argv[i + 1]);
+		}
+		else if (option == "--jitter")
+		{
+			options.jitter_ms = atof(argv[i + 1]);
+		}
+		else if (option == "--bandwidth")
+		{
+			options.bandwidth_kbps = atof(argv[i + 1]);
+		}
+		else if (option == "--queue")
+		{
+			options.queue_ms = atof(argv[i + 1]);
+		}
+		else if (option == "--render-rate")
+		{
+			options.render_rate = atof(argv[i + 1]);
+		}
+		else if (option == "--playout-delay")
+		{
+			options.playout_delay_ms = atof(argv[i + 1]);
+		}
+		else if (option == "--pause-at")
+		{
+			options.pause_at = atof(argv[i + 1]);
+		}
+		else if (option == "--resume-at")
+		{
+			options.resume_at = atof(argv[i + 1]);
+		}
+		else if (option == "--end-at")
+		{
+			options.end_at = atof(argv[i + 1]);
+		}
+		else if (option == "--report-interval")
+		{
+			options.report_interval = atof(argv[i + 1]);
+		}
+		else if (option == "--seed")
+		{
+			options.seed = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+
+	vector<CalibrationImageFile> images(options.image_paths.size());
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		if (!ReadCalibrationImageFile(options.image_paths[i], &images[i]) ||
+			images[i].format != images[0].format || images[i].width != images[0].width ||
+			images[i].height != images[0].height)
+		{
+			cout << "Could not use calibration image " << options.image_paths[i]
+				<< ". The images must be JPEG or PNG files of the same format and size." << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+#ifdef _WIN32
+	WSADATA wsa_data;
+	WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+
+	// Listen where the HoloLens would
+	SOCKET listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKET udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	int reuse = 1;
+	setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+	int receive_buffer_size = PEER_SOCKET_BUFFER_SIZE;
+	setsockopt(udp_socket, SOL_SOCKET, SO_RCVBUF, (const char*)&receive_buffer_size, sizeof(receive_buffer_size));
+	sockaddr_in tcp_address = {};
+	tcp_address.sin_family = AF_INET;
+	tcp_address.sin_addr.s_addr = htonl(INADDR_ANY);
+	tcp_address.sin_port = htons((unsigned short)options.tcp_port);
+	sockaddr_in udp_address = tcp_address;
+	udp_address.sin_port = htons((unsigned short)options.udp_port);
+	if (::bind(listen_socket, (sockaddr*)&tcp_address, sizeof(tcp_address)) != 0 || listen(listen_socket, 1) != 0 ||
+		::bind(udp_socket, (sockaddr*)&udp_address, sizeof(udp_address)) != 0)
+	{
+		cout << "Could not listen on TCP port " << options.tcp_port << " and UDP port " << options.udp_port << endl;
+		return EXIT_FAILURE;
+	}
+	cout << "Waiting for the Leap Motion client on TCP port " << options.tcp_port << "." << endl;
+	SOCKET tcp_socket = accept(listen_socket, NULL, NULL);
+	closesocket(listen_socket);
+	if (tcp_socket == INVALID_SOCKET)
+	{
+		cout << "Accepting the connection failed." << endl;
+		return EXIT_FAILURE;
+	}
+
+	// Calibration
+	string leap_running_message(LEAP_RUNNING_MESSAGE_STRING);
+	leap_running_message.pop_back();
+	ControlMessageFramer framer({ LEAP_CALIBRATION_FAIL_STRING });
+	string message;
+	while (message != leap_running_message)
+	{
+		if (!ReceiveMessage(tcp_socket, &framer, &message))
+		{
+			cout << "The client closed the connection before it was ready." << endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if (images.empty())
+	{
+		cout << "Client ready, skipping calibration." << endl;
+		SendString(tcp_socket, string(SKIP_CALIBRATION_STRING) + "\n");
+	}
+	else
+	{
+		cout << "Client ready, uploading " << images.size() << " calibration images." << endl;
+		SendString(tcp_socket, string(DO_CALIBRATION_STRING) + "\n");
+		auto upload_start = chrono::steady_clock::now();
+		if (!UploadCalibrationImages(tcp_socket, options, images) || !ReceiveMessage(tcp_socket, &framer, &message))
+		{
+			cout << "The client closed the connection during calibration." << endl;
+			return EXIT_FAILURE;
+		}
+		double calibration_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - upload_start).count();
+		cout << message << endl << "Calibration took " << calibration_ms << " ms from the start of the upload." << endl;
+		if (message.compare(0, strlen(LEAP_CALIBRATION_SUCCESS_STRING), LEAP_CALIBRATION_SUCCESS_STRING) != 0)
+		{
+			return EXIT_FAILURE;
+		}
+		SendString(tcp_socket, string(HOLO_CALIBRATION_SUCCESS_STRING) + "\n");
+	}
+
+	// Streaming
+	SetNonBlocking(udp_socket);
+	SetNonBlocking(tcp_socket);
+	ImpairedLink link(options);
+	StreamConsumer consumer(options);
+	vector<ScheduledMessage> scheduled_messages = {
+		{ options.pause_at, PAUSE_STREAMING_STRING, false },
+		{ options.resume_at, RESUME_STREAMING_STRING, false },
+		{ options.end_at, END_STREAMING_STRING, false } };
+	int64_t render_period = options.render_rate > 0.0 ? (int64_t)(1000000.0 / options.render_rate) : 0;
+	int64_t report_period = (int64_t)(options.report_interval * 1000000.0);
+	int64_t stream_start = CurrentTimestamp();
+	int64_t next_render = stream_start + render_period;
+	int64_t next_report = stream_start + report_period;
+	int64_t end_deadline = -1;
+	int64_t last_keyframe_request = 0;
+	vector<char> datagram(PEER_RECEIVE_BUFFER_LENGTH);
+	char control_buffer[CONTROL_MESSAGE_MAX_LENGTH];
+	cout << "Streaming." << endl;
+	while (true)
+	{
+		// Sleep until a socket is readable or something is due
+		int64_t now = CurrentTimestamp();
+		int64_t wake_time = next_report;
+		wake_time = render_period > 0 && next_render < wake_time ? next_render : wake_time;
+		wake_time = link.NextDeliveryTime() >= 0 && link.NextDeliveryTime() < wake_time ? link.NextDeliveryTime() : wake_time;
+		for (const ScheduledMessage& scheduled : scheduled_messages)
+		{
+			int64_t send_time = stream_start + (int64_t)(scheduled.at * 1000000.0);
+			wake_time = scheduled.at >= 0.0 && !scheduled.is_sent && send_time < wake_time ? send_time : wake_time;
+		}
+		wake_time = end_deadline >= 0 && end_deadline < wake_time ? end_deadline : wake_time;
+		int timeout_ms = wake_time > now ? (int)((wake_time - now + 999) / 1000) : 0;
+		pollfd poll_sockets[2];
+		poll_sockets[0].fd = udp_socket;
+		poll_sockets[0].events = POLLIN;
+		poll_sockets[1].fd = tcp_socket;
+		poll_sockets[1].events = POLLIN;
+		poll(poll_sockets, 2, timeout_ms);
+
+		if (poll_sockets[0].revents & POLLIN)
+		{
+			int bytes_received;
+			while ((bytes_received = recv(udp_socket, datagram.data(), (int)datagram.size(), 0)) > 0)
+			{
+				link.Receive(datagram.data(), bytes_received, CurrentTimestamp());
+			}
+		}
+		if (poll_sockets[1].revents != 0)
+		{
+			int bytes_received = recv(tcp_socket, control_buffer, sizeof(control_buffer), 0);
+			if (bytes_received == 0)
+			{
+				cout << "The client closed the connection." << endl;
+				break;
+			}
+			if (bytes_received > 0)
+			{
+				framer.Append(control_buffer, bytes_received);
+				while (framer.Next(&message))
+				{
+					cout << message << endl;
+				}
+			}
+		}
+
+		now = CurrentTimestamp();
+		link.DeliverDue(now, [&](const char* data, size_t length)
+		{
+			// A lost keyframe is asked for again, but not for every delta that cannot be decoded without it
+			if (consumer.Deliver(data, length, now) && now - last_keyframe_request >= KEYFRAME_REQUEST_INTERVAL_US)
+			{
+				SendString(tcp_socket, string(REQUEST_KEYFRAME_STRING) + "\n");
+				last_keyframe_request = now;
+			}
+		});
+		if (render_period > 0 && now >= next_render)
+		{
+			consumer.Render(now);
+			next_render = next_render + render_period > now ? next_render + render_period : now + render_period;
+		}
+		for (ScheduledMessage& scheduled : scheduled_messages)
+		{
+			if (scheduled.at >= 0.0 && !scheduled.is_sent && now >= stream_start + (int64_t)(scheduled.at * 1000000.0))
+			{
+				cout << "Sending: " << scheduled.message << endl;
+				SendString(tcp_socket, scheduled.message + "\n");
+				scheduled.is_sent = true;
+				if (scheduled.message == END_STREAMING_STRING)
+				{
+					end_deadline = now + END_GRACE_MS * 1000;
+				}
+			}
+		}
+		if (end_deadline >= 0 && now >= end_deadline)
+		{
+			cout << "The client did not close the connection after the end of streaming." << endl;
+			break;
+		}
+		if (now >= next_report)
+		{
+			consumer.PrintInterval((now - next_report + report_period) / 1000000.0);
+			next_report = now + report_period;
+		}
+	}
+
+	consumer.PrintSummary((CurrentTimestamp() - stream_start) / 1000000.0, link);
+	closesocket(tcp_socket);
+	closesocket(udp_socket);
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	return EXIT_SUCCESS;
+}
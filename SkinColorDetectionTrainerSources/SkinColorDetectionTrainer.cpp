@@ -7,7 +7,6 @@
 using namespace std;
 using namespace cv;
 using namespace ml;
-using namespace concurrency;
 
 #define TRAINING_IMAGES_FOLDER		"./training_images/"
 #define GROUND_TRUTHS_FOLDER		"./ground_truths/"
@@ -93,22 +92,28 @@ size_t CountNumberOfSamples()
 		int rows = current_ground_truth.rows;
 		int cols = current_ground_truth.cols;
 
-		parallel_for(0, rows, [&](int row)
+		WorkStealingPool::Shared().ParallelForTiles(rows, cols, [&](const ImageTile& tile)
 		{
-			parallel_for(0, cols, [&](int col)
+			// Counted per tile, so that the threads do not contend for the shared count on every sample
+			size_t tile_sample_amount = 0;
+			for (int row = tile.row_begin; row < tile.row_end; ++row)
 			{
-				uchar ground_truth = current_ground_truth.at<uchar>(row, col);
-				if (ground_truth == 255)
+				for (int col = tile.col_begin; col < tile.col_end; ++col)
 				{
-					Vec3b current_pixel = masked_data.at<Vec3b>(row, col);
-					int highest_intensity = max(current_pixel[0], max(current_pixel[1], current_pixel[2]));
-					int lowest_intensity = min(current_pixel[0], min(current_pixel[1], current_pixel[2]));
-					if (highest_intensity >= min_intensity && lowest_intensity <= max_intensity)
+					uchar ground_truth = current_ground_truth.at<uchar>(row, col);
+					if (ground_truth == 255)
 					{
-						++sample_amount;
+						Vec3b current_pixel = masked_data.at<Vec3b>(row, col);
+						int highest_intensity = max(current_pixel[0], max(current_pixel[1], current_pixel[2]));
+						int lowest_intensity = min(current_pixel[0], min(current_pixel[1], current_pixel[2]));
+						if (highest_intensity >= min_intensity && lowest_intensity <= max_intensity)
+						{
+							++tile_sample_amount;
+						}
 					}
 				}
-			});
+			}
+			sample_amount += tile_sample_amount;
 		});
 
 		++current_ground_truth_number;
@@ -162,126 +167,129 @@ void BuildSampleMatrix(Mat* sample_matrix)
 		// Loop over images and save values to samples array
 		int rows = masked_data.rows;
 		int cols = masked_data.cols;
-		parallel_for (0, rows, [&](int row)
+		WorkStealingPool::Shared().ParallelForTiles(rows, cols, [&](const ImageTile& tile)
 		{
-			parallel_for(0, cols, [&](int col)
+			for (int row = tile.row_begin; row < tile.row_end; ++row)
 			{
-				uchar ground_truth = current_ground_truth.at<uchar>(row, col);
-				if (ground_truth == 255)
+				for (int col = tile.col_begin; col < tile.col_end; ++col)
 				{
-					Vec3b current_pixel = masked_data.at<Vec3b>(row, col);
-					int highest_intensity = max(current_pixel[0], max(current_pixel[1], current_pixel[2]));
-					int lowest_intensity = min(current_pixel[0], min(current_pixel[1], current_pixel[2]));
-
-					// Skip pixels that are too light or dark
-					if (highest_intensity >= min_intensity && lowest_intensity <= max_intensity)
+					uchar ground_truth = current_ground_truth.at<uchar>(row, col);
+					if (ground_truth == 255)
 					{
-						int sample_index = current_sample_index++;
-
-						float rgb_sum = current_pixel[0] + current_pixel[1] + current_pixel[2];
-
-						// Normalized red and green
-						int nr = ((float)current_pixel[2] / rgb_sum) * 255.0f;
-						int ng = ((float)current_pixel[1] / rgb_sum) * 255.0f;
-
-						// Opponent colors
-						int RG = current_pixel[2] - current_pixel[1];
-						int YB = (2 * current_pixel[0] - current_pixel[2] + current_pixel[1]) / 4;
-
-						// YCbCr
-						Vec3b ycbcr_pixel = YCrCb.at<Vec3b>(row, col);
+						Vec3b current_pixel = masked_data.at<Vec3b>(row, col);
+						int highest_intensity = max(current_pixel[0], max(current_pixel[1], current_pixel[2]));
+						int lowest_intensity = min(current_pixel[0], min(current_pixel[1], current_pixel[2]));
 
-						// HSV
-						Vec3b hsv_pixel = HSV.at<Vec3b>(row, col);
-
-						// CIELab
-						Vec3b cielab_pixel = CIELab.at<Vec3b>(row, col);
+						// Skip pixels that are too light or dark
+						if (highest_intensity >= min_intensity && lowest_intensity <= max_intensity)
+						{
+							int sample_index = current_sample_index++;
 
-						// Blurred values
-						Vec3b blurred_pixel = blurred_RGB.at<Vec3b>(row, col);
-						float blurred_rgb_sum = blurred_pixel[0] + blurred_pixel[1] + blurred_pixel[2];
+							float rgb_sum = current_pixel[0] + current_pixel[1] + current_pixel[2];
 
-						// Blurred normalized red and green
-						int blurred_nr = ((float)blurred_pixel[2] / blurred_rgb_sum) * 255.0f;
-						int blurred_ng = ((float)blurred_pixel[1] / blurred_rgb_sum) * 255.0f;
+							// Normalized red and green
+							int nr = ((float)current_pixel[2] / rgb_sum) * 255.0f;
+							int ng = ((float)current_pixel[1] / rgb_sum) * 255.0f;
 
-						// Blurred opponent colors
-						int blurred_RG = blurred_pixel[2] - blurred_pixel[1];
-						int blurred_YB = (2 * blurred_pixel[0] - blurred_pixel[2] + blurred_pixel[1]) / 4;
+							// Opponent colors
+							int RG = current_pixel[2] - current_pixel[1];
+							int YB = (2 * current_pixel[0] - current_pixel[2] + current_pixel[1]) / 4;
 
-						// Blurred YCbCr
-						Vec3b blurred_ycbcr_pixel = blurred_YCrCb.at<Vec3b>(row, col);
+							// YCbCr
+							Vec3b ycbcr_pixel = YCrCb.at<Vec3b>(row, col);
 
-						// Blurred HSV
-						Vec3b blurred_hsv_pixel = blurred_HSV.at<Vec3b>(row, col);
+							// HSV
+							Vec3b hsv_pixel = HSV.at<Vec3b>(row, col);
 
-						// Blurred CIELab
-						Vec3b blurred_cielab_pixel = blurred_CIELab.at<Vec3b>(row, col);
+							// CIELab
+							Vec3b cielab_pixel = CIELab.at<Vec3b>(row, col);
 
-						/*----------------------- Add sample values -----------------------------------------*/
-						
-						int target_col = 0;
-						// RGB
-						sample_matrix->at<uchar>(sample_index, target_col++) = current_pixel[2];
-						sample_matrix->at<uchar>(sample_index, target_col++) = current_pixel[1];
-						sample_matrix->at<uchar>(sample_index, target_col++) = current_pixel[0];
-
-						// Normalized red and green
-						sample_matrix->at<uchar>(sample_index, target_col++) = nr;
-						sample_matrix->at<uchar>(sample_index, target_col++) = ng;
-
-						// Opponent colors
-						sample_matrix->at<uchar>(sample_index, target_col++) = RG;
-						sample_matrix->at<uchar>(sample_index, target_col++) = YB;
-
-						// YCbCr
-						sample_matrix->at<uchar>(sample_index, target_col++) = ycbcr_pixel[0];
-						sample_matrix->at<uchar>(sample_index, target_col++) = ycbcr_pixel[1];
-						sample_matrix->at<uchar>(sample_index, target_col++) = ycbcr_pixel[2];
-
-						// HSV
-						sample_matrix->at<uchar>(sample_index, target_col++) = hsv_pixel[0];
-						sample_matrix->at<uchar>(sample_index, target_col++) = hsv_pixel[1];
-						sample_matrix->at<uchar>(sample_index, target_col++) = hsv_pixel[2];
-
-						// CIELab
-						sample_matrix->at<uchar>(sample_index, target_col++) = cielab_pixel[0];
-						sample_matrix->at<uchar>(sample_index, target_col++) = cielab_pixel[1];
-						sample_matrix->at<uchar>(sample_index, target_col++) = cielab_pixel[2];
-
-						if (use_surrounding_values)
-						{
-							// Blurred RGB
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_pixel[2];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_pixel[1];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_pixel[0];
+							// Blurred values
+							Vec3b blurred_pixel = blurred_RGB.at<Vec3b>(row, col);
+							float blurred_rgb_sum = blurred_pixel[0] + blurred_pixel[1] + blurred_pixel[2];
 
 							// Blurred normalized red and green
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_nr;
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ng;
+							int blurred_nr = ((float)blurred_pixel[2] / blurred_rgb_sum) * 255.0f;
+							int blurred_ng = ((float)blurred_pixel[1] / blurred_rgb_sum) * 255.0f;
 
 							// Blurred opponent colors
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_RG;
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_YB;
+							int blurred_RG = blurred_pixel[2] - blurred_pixel[1];
+							int blurred_YB = (2 * blurred_pixel[0] - blurred_pixel[2] + blurred_pixel[1]) / 4;
 
 							// Blurred YCbCr
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ycbcr_pixel[0];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ycbcr_pixel[1];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ycbcr_pixel[2];
+							Vec3b blurred_ycbcr_pixel = blurred_YCrCb.at<Vec3b>(row, col);
 
 							// Blurred HSV
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_hsv_pixel[0];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_hsv_pixel[1];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_hsv_pixel[2];
+							Vec3b blurred_hsv_pixel = blurred_HSV.at<Vec3b>(row, col);
 
 							// Blurred CIELab
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_cielab_pixel[0];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_cielab_pixel[1];
-							sample_matrix->at<uchar>(sample_index, target_col++) = blurred_cielab_pixel[2];
+							Vec3b blurred_cielab_pixel = blurred_CIELab.at<Vec3b>(row, col);
+
+							/*----------------------- Add sample values -----------------------------------------*/
+						
+							int target_col = 0;
+							// RGB
+							sample_matrix->at<uchar>(sample_index, target_col++) = current_pixel[2];
+							sample_matrix->at<uchar>(sample_index, target_col++) = current_pixel[1];
+							sample_matrix->at<uchar>(sample_index, target_col++) = current_pixel[0];
+
+							// Normalized red and green
+							sample_matrix->at<uchar>(sample_index, target_col++) = nr;
+							sample_matrix->at<uchar>(sample_index, target_col++) = ng;
+
+							// Opponent colors
+							sample_matrix->at<uchar>(sample_index, target_col++) = RG;
+							sample_matrix->at<uchar>(sample_index, target_col++) = YB;
+
+							// YCbCr
+							sample_matrix->at<uchar>(sample_index, target_col++) = ycbcr_pixel[0];
+							sample_matrix->at<uchar>(sample_index, target_col++) = ycbcr_pixel[1];
+							sample_matrix->at<uchar>(sample_index, target_col++) = ycbcr_pixel[2];
+
+							// HSV
+							sample_matrix->at<uchar>(sample_index, target_col++) = hsv_pixel[0];
+							sample_matrix->at<uchar>(sample_index, target_col++) = hsv_pixel[1];
+							sample_matrix->at<uchar>(sample_index, target_col++) = hsv_pixel[2];
+
+							// CIELab
+							sample_matrix->at<uchar>(sample_index, target_col++) = cielab_pixel[0];
+							sample_matrix->at<uchar>(sample_index, target_col++) = cielab_pixel[1];
+							sample_matrix->at<uchar>(sample_index, target_col++) = cielab_pixel[2];
+
+							if (use_surrounding_values)
+							{
+								// Blurred RGB
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_pixel[2];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_pixel[1];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_pixel[0];
+
+								// Blurred normalized red and green
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_nr;
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ng;
+
+								// Blurred opponent colors
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_RG;
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_YB;
+
+								// Blurred YCbCr
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ycbcr_pixel[0];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ycbcr_pixel[1];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_ycbcr_pixel[2];
+
+								// Blurred HSV
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_hsv_pixel[0];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_hsv_pixel[1];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_hsv_pixel[2];
+
+								// Blurred CIELab
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_cielab_pixel[0];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_cielab_pixel[1];
+								sample_matrix->at<uchar>(sample_index, target_col++) = blurred_cielab_pixel[2];
+							}
 						}
 					}
 				}
-			});
+			}
 		});
 
 		cout << "Finished sampling " << training_image_name << endl;
@@ -345,11 +353,15 @@ int main()
 		use_errosion = false;
 	}
 
+	WorkStealingPool::Shared().ResetUtilization();
 	size_t sample_amount = CountNumberOfSamples();
 	int sample_dimension = use_surrounding_values ? 2 * BASE_SAMPLE_DIMENSION : BASE_SAMPLE_DIMENSION;
 	Mat sample_matrix(Size(sample_dimension, sample_amount), CV_8U);
 	cout << "Starting sampling." << endl;
 	BuildSampleMatrix(&sample_matrix);
+	PoolUtilization sampling_utilization;
+	WorkStealingPool::Shared().Utilization(&sampling_utilization);
+	PrintPoolUtilization(sampling_utilization);
 	cout << "Number of samples collected: " << to_string(sample_matrix.rows) << endl;
 	cout << "Finished building sample matrix. Releasing resources." << endl;
 
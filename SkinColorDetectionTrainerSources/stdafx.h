@@ -5,18 +5,20 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
+#include <tchar.h>
+#endif
 
 #include <stdio.h>
 #include <iostream>
 #include <fstream>
-#include <tchar.h>
-#include "opencv2\core.hpp"
-#include "opencv2\highgui.hpp"
-#include "opencv2\imgproc\imgproc.hpp"
-#include "opencv2\ml\ml.hpp"
-#include <ppl.h>
+#include "opencv2/core.hpp"
+#include "opencv2/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/ml/ml.hpp"
 #include <atomic>
+#include "WorkStealingPool.h"
 
 
 